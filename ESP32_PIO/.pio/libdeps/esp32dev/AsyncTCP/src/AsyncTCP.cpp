@@ -36,10 +36,10 @@ extern "C"{
  * */
 
 typedef enum {
-    LWIP_TCP_SENT, LWIP_TCP_RECV, LWIP_TCP_FIN, LWIP_TCP_ERROR, LWIP_TCP_POLL, LWIP_TCP_CLEAR, LWIP_TCP_ACCEPT, LWIP_TCP_CONNECTED, LWIP_TCP_DNS
+    LWIP_TCP_SENT, LWIP_TCP_RECV, LWIP_TCP_FIN, LWIP_TCP_ERROR, LWIP_TCP_POLL, LWIP_TCP_ACCEPT, LWIP_TCP_CONNECTED, LWIP_TCP_DNS
 } lwip_event_t;
 
-typedef struct {
+typedef struct lwip_event_packet_s {
         lwip_event_t event;
         void *arg;
         union {
@@ -52,7 +52,7 @@ typedef struct {
                 } error;
                 struct {
                         tcp_pcb * pcb;
-                        uint16_t len;
+                        uint32_t len;
                 } sent;
                 struct {
                         tcp_pcb * pcb;
@@ -74,6 +74,10 @@ typedef struct {
                         ip_addr_t addr;
                 } dns;
         };
+        struct lwip_event_packet_s * next_free;
+        //links in the owning client's list of queued events
+        struct lwip_event_packet_s * client_prev;
+        struct lwip_event_packet_s * client_next;
 } lwip_event_packet_t;
 
 static xQueueHandle _async_queue;
@@ -92,10 +96,94 @@ static int _closed_index = []() {
     return 1;
 }();
 
+/*
+ * Event packets come from a fixed pool; the heap is only touched when the
+ * pool runs dry. _async_event_mux guards the free list, the per-client
+ * lists of queued events, the pending SENT/POLL pointers used for
+ * coalescing, and the counters.
+ *
+ * Every queued event whose arg is a client is also linked into that
+ * client's _events list. Tearing a client down tombstones just those
+ * packets (arg = NULL) instead of rotating the whole queue; the task
+ * discards tombstones as it reaches them.
+ * */
+
+static portMUX_TYPE _async_event_mux = portMUX_INITIALIZER_UNLOCKED;
+static lwip_event_packet_t _event_pool[CONFIG_ASYNC_TCP_EVENT_POOL_SIZE];
+static lwip_event_packet_t * _event_free_list = NULL;
+static bool _event_pool_ready = false;
+static async_tcp_event_stats_t _event_stats;
+
+static inline bool _is_pool_event(lwip_event_packet_t * e){
+    return e >= &_event_pool[0] && e < &_event_pool[CONFIG_ASYNC_TCP_EVENT_POOL_SIZE];
+}
+
+static lwip_event_packet_t * _alloc_event(){
+    lwip_event_packet_t * e = NULL;
+    portENTER_CRITICAL(&_async_event_mux);
+    if(!_event_pool_ready){
+        for(int i = 0; i < CONFIG_ASYNC_TCP_EVENT_POOL_SIZE; i++){
+            _event_pool[i].next_free = _event_free_list;
+            _event_free_list = &_event_pool[i];
+        }
+        _event_pool_ready = true;
+    }
+    e = _event_free_list;
+    if(e){
+        _event_free_list = e->next_free;
+        _event_stats.pool_in_use++;
+    } else {
+        _event_stats.pool_exhausted++;
+    }
+    portEXIT_CRITICAL(&_async_event_mux);
+    if(!e){
+        e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    }
+    return e;
+}
+
+static void _free_event(lwip_event_packet_t * e){
+    if(!_is_pool_event(e)){
+        free((void*)(e));
+        return;
+    }
+    portENTER_CRITICAL(&_async_event_mux);
+    e->next_free = _event_free_list;
+    _event_free_list = e;
+    _event_stats.pool_in_use--;
+    portEXIT_CRITICAL(&_async_event_mux);
+}
+
+static inline void _update_queue_high_water(){
+    UBaseType_t waiting = uxQueueMessagesWaiting(_async_queue);
+    portENTER_CRITICAL(&_async_event_mux);
+    if(waiting > _event_stats.queue_high_water){
+        _event_stats.queue_high_water = waiting;
+    }
+    portEXIT_CRITICAL(&_async_event_mux);
+}
+
+static inline void _count_event(uint32_t * counter){
+    portENTER_CRITICAL(&_async_event_mux);
+    (*counter)++;
+    portEXIT_CRITICAL(&_async_event_mux);
+}
+
+void async_tcp_get_event_stats(async_tcp_event_stats_t * stats){
+    if(!stats){
+        return;
+    }
+    portENTER_CRITICAL(&_async_event_mux);
+    *stats = _event_stats;
+    portEXIT_CRITICAL(&_async_event_mux);
+    stats->queue_size = CONFIG_ASYNC_TCP_QUEUE_SIZE;
+    stats->queue_waiting = _async_queue ? uxQueueMessagesWaiting(_async_queue) : 0;
+    stats->pool_size = CONFIG_ASYNC_TCP_EVENT_POOL_SIZE;
+}
 
 static inline bool _init_async_event_queue(){
     if(!_async_queue){
-        _async_queue = xQueueCreate(32, sizeof(lwip_event_packet_t *));
+        _async_queue = xQueueCreate(CONFIG_ASYNC_TCP_QUEUE_SIZE, sizeof(lwip_event_packet_t *));
         if(!_async_queue){
             return false;
         }
@@ -103,58 +191,115 @@ static inline bool _init_async_event_queue(){
     return true;
 }
 
-static inline bool _send_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueSend(_async_queue, e, portMAX_DELAY) == pdPASS;
+static inline bool _is_client_event(lwip_event_packet_t * e){
+    return e->arg != NULL && e->event != LWIP_TCP_ACCEPT;
 }
 
-static inline bool _prepend_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueSendToFront(_async_queue, e, portMAX_DELAY) == pdPASS;
+static void _link_event(lwip_event_packet_t * e){
+    e->client_prev = NULL;
+    e->client_next = NULL;
+    if(!_is_client_event(e)){
+        return;
+    }
+    AsyncClient * client = reinterpret_cast<AsyncClient*>(e->arg);
+    portENTER_CRITICAL(&_async_event_mux);
+    e->client_next = client->_events;
+    if(client->_events){
+        client->_events->client_prev = e;
+    }
+    client->_events = e;
+    if(e->event == LWIP_TCP_SENT){
+        client->_sent_event = e;
+    } else if(e->event == LWIP_TCP_POLL){
+        client->_poll_event = e;
+    }
+    portEXIT_CRITICAL(&_async_event_mux);
 }
 
-static inline bool _get_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueReceive(_async_queue, e, portMAX_DELAY) == pdPASS;
+//caller holds _async_event_mux
+static void _unlink_event_locked(lwip_event_packet_t * e){
+    AsyncClient * client = reinterpret_cast<AsyncClient*>(e->arg);
+    if(e->client_prev){
+        e->client_prev->client_next = e->client_next;
+    } else if(client->_events == e){
+        client->_events = e->client_next;
+    }
+    if(e->client_next){
+        e->client_next->client_prev = e->client_prev;
+    }
+    e->client_prev = NULL;
+    e->client_next = NULL;
+    if(client->_sent_event == e){
+        client->_sent_event = NULL;
+    }
+    if(client->_poll_event == e){
+        client->_poll_event = NULL;
+    }
 }
 
-static bool _remove_events_with_arg(void * arg){
-    lwip_event_packet_t * first_packet = NULL;
-    lwip_event_packet_t * packet = NULL;
+static void _unlink_event(lwip_event_packet_t * e){
+    portENTER_CRITICAL(&_async_event_mux);
+    if(_is_client_event(e)){
+        _unlink_event_locked(e);
+    }
+    portEXIT_CRITICAL(&_async_event_mux);
+}
 
+static inline bool _send_async_event(lwip_event_packet_t ** e, TickType_t wait = portMAX_DELAY){
     if(!_async_queue){
         return false;
     }
-    //figure out which is the first packet so we can keep the order
-    while(!first_packet){
-        if(xQueueReceive(_async_queue, &first_packet, 0) != pdPASS){
-            return false;
-        }
-        //discard packet if matching
-        if((int)first_packet->arg == (int)arg){
-            free(first_packet);
-            first_packet = NULL;
-        //return first packet to the back of the queue
-        } else if(xQueueSend(_async_queue, &first_packet, portMAX_DELAY) != pdPASS){
-            return false;
-        }
+    _link_event(*e);
+    if(xQueueSend(_async_queue, e, wait) != pdPASS){
+        _unlink_event(*e);
+        return false;
     }
+    _update_queue_high_water();
+    return true;
+}
 
-    while(xQueuePeek(_async_queue, &packet, 0) == pdPASS && packet != first_packet){
-        if(xQueueReceive(_async_queue, &packet, 0) != pdPASS){
-            return false;
-        }
-        if((int)packet->arg == (int)arg){
-            free(packet);
-            packet = NULL;
-        } else if(xQueueSend(_async_queue, &packet, portMAX_DELAY) != pdPASS){
-            return false;
-        }
+static inline bool _prepend_async_event(lwip_event_packet_t ** e){
+    if(!_async_queue){
+        return false;
+    }
+    _link_event(*e);
+    if(xQueueSendToFront(_async_queue, e, portMAX_DELAY) != pdPASS){
+        _unlink_event(*e);
+        return false;
     }
+    _update_queue_high_water();
     return true;
 }
 
+static inline bool _get_async_event(lwip_event_packet_t ** e){
+    return _async_queue && xQueueReceive(_async_queue, e, portMAX_DELAY) == pdPASS;
+}
+
 static void _handle_async_event(lwip_event_packet_t * e){
-    if(e->event == LWIP_TCP_CLEAR){
-        _remove_events_with_arg(e->arg);
-    } else if(e->event == LWIP_TCP_RECV){
+    uint32_t trace_start = async_tcp_trace_hook ? micros() : 0;
+    uint32_t trace_event = e->event;
+    //detach from the client, or find that it was torn down while queued
+    uint32_t unreported = 0;
+    portENTER_CRITICAL(&_async_event_mux);
+    bool tombstone = e->arg == NULL;
+    if(!tombstone && e->event != LWIP_TCP_ACCEPT){
+        _unlink_event_locked(e);
+        //acks that found the queue full ride along with the next SENT or POLL
+        if(e->event == LWIP_TCP_SENT || e->event == LWIP_TCP_POLL){
+            AsyncClient * client = reinterpret_cast<AsyncClient*>(e->arg);
+            unreported = client->_sent_unreported;
+            client->_sent_unreported = 0;
+        }
+    }
+    portEXIT_CRITICAL(&_async_event_mux);
+    if(tombstone){
+        if(e->event == LWIP_TCP_RECV && e->recv.pb){
+            pbuf_free(e->recv.pb);
+        }
+        _free_event(e);
+        return;
+    }
+    if(e->event == LWIP_TCP_RECV){
         //ets_printf("-R: 0x%08x\n", e->recv.pcb);
         AsyncClient::_s_recv(e->arg, e->recv.pcb, e->recv.pb, e->recv.err);
     } else if(e->event == LWIP_TCP_FIN){
@@ -162,10 +307,15 @@ static void _handle_async_event(lwip_event_packet_t * e){
         AsyncClient::_s_fin(e->arg, e->fin.pcb, e->fin.err);
     } else if(e->event == LWIP_TCP_SENT){
         //ets_printf("-S: 0x%08x\n", e->sent.pcb);
-        AsyncClient::_s_sent(e->arg, e->sent.pcb, e->sent.len);
+        AsyncClient::_s_sent(e->arg, e->sent.pcb, e->sent.len + unreported);
     } else if(e->event == LWIP_TCP_POLL){
         //ets_printf("-P: 0x%08x\n", e->poll.pcb);
-        AsyncClient::_s_poll(e->arg, e->poll.pcb);
+        //the ack may close the client, the poll is skipped then and comes again
+        if(unreported){
+            AsyncClient::_s_sent(e->arg, e->poll.pcb, unreported);
+        } else {
+            AsyncClient::_s_poll(e->arg, e->poll.pcb);
+        }
     } else if(e->event == LWIP_TCP_ERROR){
         //ets_printf("-E: 0x%08x %d\n", e->arg, e->error.err);
         AsyncClient::_s_error(e->arg, e->error.err);
@@ -179,7 +329,10 @@ static void _handle_async_event(lwip_event_packet_t * e){
         //ets_printf("D: 0x%08x %s = %s\n", e->arg, e->dns.name, ipaddr_ntoa(&e->dns.addr));
         AsyncClient::_s_dns_found(e->dns.name, &e->dns.addr, e->arg);
     }
-    free((void*)(e));
+    _free_event(e);
+    if(async_tcp_trace_hook){
+        async_tcp_trace_hook(ASYNC_TCP_TRACE_EVENT, trace_start, trace_event);
+    }
 }
 
 static void _async_service_task(void *pvParameters){
@@ -215,7 +368,7 @@ static bool _start_async_task(){
         return false;
     }
     if(!_async_service_task_handle){
-        xTaskCreateUniversal(_async_service_task, "async_tcp", 8192 * 2, NULL, 3, &_async_service_task_handle, CONFIG_ASYNC_TCP_RUNNING_CORE);
+        xTaskCreateUniversal(_async_service_task, "async_tcp", CONFIG_ASYNC_TCP_STACK_SIZE, NULL, CONFIG_ASYNC_TCP_PRIORITY, &_async_service_task_handle, CONFIG_ASYNC_TCP_RUNNING_CORE);
         if(!_async_service_task_handle){
             return false;
         }
@@ -227,90 +380,166 @@ static bool _start_async_task(){
  * LwIP Callbacks
  * */
 
+//tombstone the client's queued events, the rest of the queue is not touched
 static int8_t _tcp_clear_events(void * arg) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
-    e->event = LWIP_TCP_CLEAR;
-    e->arg = arg;
-    if (!_prepend_async_event(&e)) {
-        free((void*)(e));
-    }
+    AsyncClient * client = reinterpret_cast<AsyncClient*>(arg);
+    portENTER_CRITICAL(&_async_event_mux);
+    lwip_event_packet_t * e = client->_events;
+    while(e){
+        lwip_event_packet_t * next = e->client_next;
+        e->arg = NULL;
+        e->client_prev = NULL;
+        e->client_next = NULL;
+        _event_stats.tombstoned++;
+        e = next;
+    }
+    client->_events = NULL;
+    client->_sent_event = NULL;
+    client->_poll_event = NULL;
+    portEXIT_CRITICAL(&_async_event_mux);
     return ERR_OK;
 }
 
 static int8_t _tcp_connected(void * arg, tcp_pcb * pcb, int8_t err) {
     //ets_printf("+C: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        return ERR_MEM;
+    }
     e->event = LWIP_TCP_CONNECTED;
     e->arg = arg;
     e->connected.pcb = pcb;
     e->connected.err = err;
     if (!_prepend_async_event(&e)) {
-        free((void*)(e));
+        _free_event(e);
     }
     return ERR_OK;
 }
 
 static int8_t _tcp_poll(void * arg, struct tcp_pcb * pcb) {
     //ets_printf("+P: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    AsyncClient * client = reinterpret_cast<AsyncClient*>(arg);
+    if(!client){
+        return ERR_OK;
+    }
+    //one pending poll per client is enough
+    portENTER_CRITICAL(&_async_event_mux);
+    bool pending = client->_poll_event != NULL;
+    if(pending){
+        _event_stats.coalesced++;
+    }
+    portEXIT_CRITICAL(&_async_event_mux);
+    if(pending){
+        return ERR_OK;
+    }
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        _count_event(&_event_stats.dropped);
+        return ERR_OK;
+    }
     e->event = LWIP_TCP_POLL;
     e->arg = arg;
     e->poll.pcb = pcb;
-    if (!_send_async_event(&e)) {
-        free((void*)(e));
+    //polls are periodic, drop this one rather than block the tcpip thread
+    if (!_send_async_event(&e, 0)) {
+        _count_event(&_event_stats.dropped);
+        _free_event(e);
     }
     return ERR_OK;
 }
 
 static int8_t _tcp_recv(void * arg, struct tcp_pcb * pcb, struct pbuf *pb, int8_t err) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        //lwIP keeps the pbuf and offers it again later
+        return pb ? ERR_MEM : ERR_OK;
+    }
     e->arg = arg;
+    int8_t result = ERR_OK;
     if(pb){
         //ets_printf("+R: 0x%08x\n", pcb);
         e->event = LWIP_TCP_RECV;
         e->recv.pcb = pcb;
         e->recv.pb = pb;
         e->recv.err = err;
+        //on a full queue refuse the data instead of blocking the tcpip thread
+        if (!_send_async_event(&e, 0)) {
+            _count_event(&_event_stats.deferred);
+            _free_event(e);
+            return ERR_MEM;
+        }
+        return ERR_OK;
     } else {
         //ets_printf("+F: 0x%08x\n", pcb);
         e->event = LWIP_TCP_FIN;
         e->fin.pcb = pcb;
         e->fin.err = err;
         //close the PCB in LwIP thread
-        AsyncClient::_s_lwip_fin(e->arg, e->fin.pcb, e->fin.err);
+        result = AsyncClient::_s_lwip_fin(e->arg, e->fin.pcb, e->fin.err);
     }
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event(e);
     }
-    return ERR_OK;
+    //an aborted pcb must not be touched by lwIP after we return
+    return result;
 }
 
 static int8_t _tcp_sent(void * arg, struct tcp_pcb * pcb, uint16_t len) {
     //ets_printf("+S: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
-    e->event = LWIP_TCP_SENT;
-    e->arg = arg;
-    e->sent.pcb = pcb;
-    e->sent.len = len;
-    if (!_send_async_event(&e)) {
-        free((void*)(e));
+    AsyncClient * client = reinterpret_cast<AsyncClient*>(arg);
+    if(!client){
+        return ERR_OK;
+    }
+    //acked byte counts must not be lost and the tcpip thread must never wait:
+    //merge into the client's queued SENT event if there is one
+    portENTER_CRITICAL(&_async_event_mux);
+    lwip_event_packet_t * pending = client->_sent_event;
+    if(pending){
+        pending->sent.len += len;
+        _event_stats.coalesced++;
+    }
+    portEXIT_CRITICAL(&_async_event_mux);
+    if(pending){
+        return ERR_OK;
     }
+    lwip_event_packet_t * e = _alloc_event();
+    if(e){
+        e->event = LWIP_TCP_SENT;
+        e->arg = arg;
+        e->sent.pcb = pcb;
+        e->sent.len = len;
+        if(_send_async_event(&e, 0)){
+            return ERR_OK;
+        }
+        _free_event(e);
+    }
+    //the queue is full, the client's next SENT or POLL event reports them
+    portENTER_CRITICAL(&_async_event_mux);
+    client->_sent_unreported += len;
+    _event_stats.coalesced++;
+    portEXIT_CRITICAL(&_async_event_mux);
     return ERR_OK;
 }
 
 static void _tcp_error(void * arg, int8_t err) {
     //ets_printf("+E: 0x%08x\n", arg);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        return;
+    }
     e->event = LWIP_TCP_ERROR;
     e->arg = arg;
     e->error.err = err;
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event(e);
     }
 }
 
 static void _tcp_dns_found(const char * name, struct ip_addr * ipaddr, void * arg) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        return;
+    }
     //ets_printf("+DNS: name=%s ipaddr=0x%08x arg=%x\n", name, ipaddr, arg);
     e->event = LWIP_TCP_DNS;
     e->arg = arg;
@@ -321,18 +550,21 @@ static void _tcp_dns_found(const char * name, struct ip_addr * ipaddr, void * ar
         memset(&e->dns.addr, 0, sizeof(e->dns.addr));
     }
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _free_event(e);
     }
 }
 
 //Used to switch out from LwIP thread
 static int8_t _tcp_accept(void * arg, AsyncClient * client) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        return ERR_MEM;
+    }
     e->event = LWIP_TCP_ACCEPT;
     e->arg = arg;
     e->accept.client = client;
     if (!_prepend_async_event(&e)) {
-        free((void*)(e));
+        _free_event(e);
     }
     return ERR_OK;
 }
@@ -350,10 +582,11 @@ typedef struct {
     int8_t err;
     union {
             struct {
-                    const char* data;
-                    size_t size;
-                    uint8_t apiflags;
-            } write;
+                    const async_tcp_segment_t * segments;
+                    size_t count;
+                    size_t written;
+                    bool output;
+            } writev;
             size_t received;
             struct {
                     ip_addr_t * addr;
@@ -388,27 +621,78 @@ static esp_err_t _tcp_output(tcp_pcb * pcb, int8_t closed_slot) {
     return msg.err;
 }
 
-static err_t _tcp_write_api(struct tcpip_api_call_data *api_call_msg){
+//tcp_write() fills the last unsent segment up to this many bytes before it starts another
+static size_t _tcp_write_mss(tcp_pcb * pcb) {
+    size_t mss = pcb->snd_wnd_max / 2;
+    if(!mss || mss > pcb->mss) {
+        mss = pcb->mss;
+    }
+    return mss ? mss : 1;
+}
+
+//Most bytes that many more tcp_write() calls can take without going past TCP_SND_QUEUELEN,
+//when bytes are already written since the last tcp_output(). Each write can put one pbuf
+//into the rest of the last unsent segment and each segment it starts takes one more, two
+//when the data is referenced (the data and the segment's header). Segments are filled
+//before another one starts, so all the bytes need at most one per mss, rounded up.
+static size_t _tcp_write_room(tcp_pcb * pcb, size_t writes, size_t bytes) {
+    size_t queued = tcp_sndqueuelen(pcb);
+    if(queued + writes >= TCP_SND_QUEUELEN) {
+        return 0;
+    }
+    size_t carried = ((TCP_SND_QUEUELEN - queued - writes) / 2) * _tcp_write_mss(pcb);
+    return (carried > bytes) ? carried - bytes : 0;
+}
+
+//all segments and the output in one trip to the lwIP thread; tcp_write() takes a segment whole
+//or refuses it, past tcp_sndbuf() or TCP_SND_QUEUELEN, so this stops at the first one that does
+//not fit. The cork has counted its segments against both, they only fail if lwIP needed more.
+static err_t _tcp_writev_api(struct tcpip_api_call_data *api_call_msg){
     tcp_api_call_t * msg = (tcp_api_call_t *)api_call_msg;
     msg->err = ERR_CONN;
+    msg->writev.written = 0;
     if(msg->closed_slot == -1 || !_closed_slots[msg->closed_slot]) {
-        msg->err = tcp_write(msg->pcb, msg->write.data, msg->write.size, msg->write.apiflags);
+        msg->err = ERR_OK;
+        for(size_t i = 0; i < msg->writev.count; i++) {
+            const async_tcp_segment_t * segment = &msg->writev.segments[i];
+            if(segment->size > tcp_sndbuf(msg->pcb)) {
+                msg->err = ERR_MEM;
+                break;
+            }
+            msg->err = tcp_write(msg->pcb, segment->data, segment->size, segment->apiflags);
+            if(msg->err != ERR_OK) {
+                break;
+            }
+            msg->writev.written += segment->size;
+        }
+        if(msg->writev.output && msg->writev.written) {
+            err_t err = tcp_output(msg->pcb);
+            if(msg->err == ERR_OK) {
+                msg->err = err;
+            }
+        }
     }
     return msg->err;
 }
 
-static esp_err_t _tcp_write(tcp_pcb * pcb, int8_t closed_slot, const char* data, size_t size, uint8_t apiflags) {
+static size_t _tcp_writev(tcp_pcb * pcb, int8_t closed_slot, const async_tcp_segment_t * segments, size_t count, bool output, int8_t * err) {
     if(!pcb){
-        return ERR_CONN;
+        *err = ERR_CONN;
+        return 0;
     }
     tcp_api_call_t msg;
     msg.pcb = pcb;
     msg.closed_slot = closed_slot;
-    msg.write.data = data;
-    msg.write.size = size;
-    msg.write.apiflags = apiflags;
-    tcpip_api_call(_tcp_write_api, (struct tcpip_api_call_data*)&msg);
-    return msg.err;
+    msg.writev.segments = segments;
+    msg.writev.count = count;
+    msg.writev.output = output;
+    uint32_t trace_start = async_tcp_trace_hook ? micros() : 0;
+    tcpip_api_call(_tcp_writev_api, (struct tcpip_api_call_data*)&msg);
+    if(async_tcp_trace_hook){
+        async_tcp_trace_hook(ASYNC_TCP_TRACE_WRITE, trace_start, msg.writev.written);
+    }
+    *err = msg.err;
+    return msg.writev.written;
 }
 
 static err_t _tcp_recved_api(struct tcpip_api_call_data *api_call_msg){
@@ -537,8 +821,22 @@ static tcp_pcb * _tcp_listen_with_backlog(tcp_pcb * pcb, uint8_t backlog) {
   Async TCP Client
  */
 
+typedef struct async_tcp_cork_s {
+    async_tcp_segment_t segments[CONFIG_ASYNC_TCP_CORK_SEGMENTS];
+    char copy[CONFIG_ASYNC_TCP_CORK_COPY_SIZE];
+    size_t count;
+    size_t copied;
+    size_t bytes;
+    bool send;
+    bool failed;//a flush was cut short, everything added until uncork() is refused
+} async_tcp_cork_t;
+
 AsyncClient::AsyncClient(tcp_pcb* pcb)
-: _connect_cb(0)
+: _events(NULL)
+, _sent_event(NULL)
+, _poll_event(NULL)
+, _sent_unreported(0)
+, _connect_cb(0)
 , _connect_cb_arg(0)
 , _discard_cb(0)
 , _discard_cb_arg(0)
@@ -559,6 +857,11 @@ AsyncClient::AsyncClient(tcp_pcb* pcb)
 , _rx_since_timeout(0)
 , _ack_timeout(ASYNC_MAX_ACK_TIME)
 , _connect_port(0)
+, _cork_depth(0)
+, _cork(NULL)
+, _tx_written(0)
+, _tx_acked(0)
+, _tx_ref_until(0)
 , prev(NULL)
 , next(NULL)
 {
@@ -589,6 +892,8 @@ AsyncClient::~AsyncClient(){
     if(_pcb) {
         _close();
     }
+    _tcp_clear_events(this);
+    ::free(_cork);
 }
 
 /*
@@ -745,9 +1050,18 @@ int8_t AsyncClient::abort(){
     return ERR_ABRT;
 }
 
-size_t AsyncClient::space(){
+size_t AsyncClient::space(size_t writes){
     if((_pcb != NULL) && (_pcb->state == 4)){
-        return tcp_sndbuf(_pcb);
+        size_t room = tcp_sndbuf(_pcb);
+        size_t bytes = 0;
+        if(_cork_depth){
+            //the collected segments are written first
+            room = (room > _cork->bytes) ? room - _cork->bytes : 0;
+            writes += _cork->count;
+            bytes = _cork->bytes;
+        }
+        size_t queue_room = _tcp_write_room(_pcb, writes, bytes);
+        return (room < queue_room) ? room : queue_room;
     }
     return 0;
 }
@@ -761,15 +1075,134 @@ size_t AsyncClient::add(const char* data, size_t size, uint8_t apiflags) {
         return 0;
     }
     size_t will_send = (room < size) ? room : size;
-    int8_t err = ERR_OK;
-    err = _tcp_write(_pcb, _closed_slot, data, will_send, apiflags);
-    if(err != ERR_OK) {
+    if(_cork_depth) {
+        if(_cork->failed) {
+            return 0;
+        }
+        bool copy = (apiflags & ASYNC_WRITE_FLAG_COPY) && will_send <= CONFIG_ASYNC_TCP_CORK_COPY_SIZE;
+        if(_cork->count == CONFIG_ASYNC_TCP_CORK_SEGMENTS || (copy && _cork->copied + will_send > CONFIG_ASYNC_TCP_CORK_COPY_SIZE)) {
+            if(!_flush_cork(false)) {
+                return 0;
+            }
+        }
+        async_tcp_segment_t * last = _cork->count ? &_cork->segments[_cork->count - 1] : NULL;
+        char * copied = _cork->copy + _cork->copied;
+        _cork->bytes += will_send;
+        if(copy) {
+            memcpy(copied, data, will_send);
+            _cork->copied += will_send;
+            //straight after the previous copy: one tcp_write() and one pbuf for both
+            if(last && last->apiflags == apiflags && last->data + last->size == copied) {
+                last->size += will_send;
+                return will_send;
+            }
+        }
+        async_tcp_segment_t * segment = &_cork->segments[_cork->count++];
+        segment->data = copy ? copied : data;
+        segment->size = will_send;
+        segment->apiflags = apiflags;
+        return will_send;
+    }
+    async_tcp_segment_t segment = { data, will_send, apiflags };
+    return add(&segment, 1, false);
+}
+
+size_t AsyncClient::add(const async_tcp_segment_t * segments, size_t count, bool send) {
+    if(!_pcb || !segments || !count) {
         return 0;
     }
-    return will_send;
+    //a FIN handled in the lwIP thread during the write must already see the
+    //referenced bytes, so assume they all go out and correct it afterwards
+    uint32_t ref_until = _tx_ref_until;
+    uint32_t end = _tx_written;
+    for(size_t i = 0; i < count; i++) {
+        end += segments[i].size;
+        if(!(segments[i].apiflags & ASYNC_WRITE_FLAG_COPY)) {
+            _tx_ref_until = end;
+        }
+    }
+    int8_t err = ERR_OK;
+    size_t written = _tcp_writev(_pcb, _closed_slot, segments, count, send, &err);
+    //segments are written whole, up to the first one that did not fit
+    end = _tx_written;
+    for(size_t i = 0; i < count && (end - _tx_written) + segments[i].size <= written; i++) {
+        end += segments[i].size;
+        if(!(segments[i].apiflags & ASYNC_WRITE_FLAG_COPY)) {
+            ref_until = end;
+        }
+    }
+    _tx_ref_until = ref_until;
+    _tx_written += written;
+    if(send && written && err == ERR_OK) {
+        _pcb_busy = true;
+        _pcb_sent_at = millis();
+    }
+    return written;
+}
+
+void AsyncClient::cork() {
+    if(!_cork) {
+        _cork = (async_tcp_cork_t *)malloc(sizeof(async_tcp_cork_t));
+        if(!_cork) {
+            return;
+        }
+    }
+    if(!_cork_depth) {
+        _cork->count = 0;
+        _cork->copied = 0;
+        _cork->bytes = 0;
+        _cork->send = false;
+        _cork->failed = false;
+    }
+    _cork_depth++;
+}
+
+bool AsyncClient::uncork() {
+    if(!_cork_depth) {
+        return false;
+    }
+    if(--_cork_depth) {
+        return !_cork->failed;
+    }
+    if(_cork->failed) {
+        return false;
+    }
+    return _flush_cork(_cork->send);
+}
+
+bool AsyncClient::_flush_cork(bool output) {
+    size_t count = _cork->count;
+    size_t bytes = _cork->bytes;
+    _cork->count = 0;
+    _cork->copied = 0;
+    _cork->bytes = 0;
+    _cork->send = false;
+    if(!count) {
+        if(!output) {
+            return true;
+        }
+        //the data is in lwIP already, a push that fails now is retried by its timers
+        uint8_t depth = _cork_depth;
+        _cork_depth = 0;
+        send();
+        _cork_depth = depth;
+        return true;
+    }
+    //add() only collected what fits, and acks can only have made room since; if lwIP
+    //still stops short the caller has already counted the rest as sent, so the stream
+    //is broken and must be closed
+    if(add(_cork->segments, count, output) != bytes) {
+        _cork->failed = true;
+        return false;
+    }
+    return true;
 }
 
 bool AsyncClient::send(){
+    if(_cork_depth) {
+        _cork->send = true;
+        return true;
+    }
     int8_t err = ERR_OK;
     err = _tcp_output(_pcb, _closed_slot);
     if(err == ERR_OK){
@@ -813,9 +1246,14 @@ int8_t AsyncClient::_close(){
         tcp_err(_pcb, NULL);
         tcp_poll(_pcb, NULL, 0);
         _tcp_clear_events(this);
-        err = _tcp_close(_pcb, _closed_slot);
-        if(err != ERR_OK) {
+        if(_tx_referenced()) {
+            //a graceful close would keep sending from memory the caller frees next
             err = abort();
+        } else {
+            err = _tcp_close(_pcb, _closed_slot);
+            if(err != ERR_OK) {
+                err = abort();
+            }
         }
         _pcb = NULL;
         if(_discard_cb) {
@@ -845,6 +1283,7 @@ int8_t AsyncClient::_connected(void* pcb, int8_t err){
 }
 
 void AsyncClient::_error(int8_t err) {
+    _tcp_clear_events(this);
     if(_pcb){
         tcp_arg(_pcb, NULL);
         tcp_sent(_pcb, NULL);
@@ -872,13 +1311,15 @@ int8_t AsyncClient::_lwip_fin(tcp_pcb* pcb, int8_t err) {
     tcp_recv(_pcb, NULL);
     tcp_err(_pcb, NULL);
     tcp_poll(_pcb, NULL, 0);
-    if(tcp_close(_pcb) != ERR_OK) {
+    int8_t result = ERR_OK;
+    if(_tx_referenced() || tcp_close(_pcb) != ERR_OK) {
         tcp_abort(_pcb);
+        result = ERR_ABRT;
     }
     _closed_slots[_closed_slot] = _closed_index;
     ++ _closed_index;
     _pcb = NULL;
-    return ERR_OK;
+    return result;
 }
 
 //In Async Thread
@@ -890,8 +1331,9 @@ int8_t AsyncClient::_fin(tcp_pcb* pcb, int8_t err) {
     return ERR_OK;
 }
 
-int8_t AsyncClient::_sent(tcp_pcb* pcb, uint16_t len) {
+int8_t AsyncClient::_sent(tcp_pcb* pcb, size_t len) {
     _rx_last_packet = millis();
+    _tx_acked += len;
     //log_i("%u", len);
     _pcb_busy = false;
     if(_sent_cb) {
@@ -1199,7 +1641,7 @@ int8_t AsyncClient::_s_lwip_fin(void * arg, struct tcp_pcb * pcb, int8_t err) {
     return reinterpret_cast<AsyncClient*>(arg)->_lwip_fin(pcb, err);
 }
 
-int8_t AsyncClient::_s_sent(void * arg, struct tcp_pcb * pcb, uint16_t len) {
+int8_t AsyncClient::_s_sent(void * arg, struct tcp_pcb * pcb, size_t len) {
     return reinterpret_cast<AsyncClient*>(arg)->_sent(pcb, len);
 }
 
@@ -36,10 +36,68 @@ extern "C" {
 #define CONFIG_ASYNC_TCP_USE_WDT 1 //if enabled, adds between 33us and 200us per event
 #endif
 
+#ifndef CONFIG_ASYNC_TCP_STACK_SIZE
+#define CONFIG_ASYNC_TCP_STACK_SIZE (8192 * 2) //bytes for the async_tcp task, GET /tasks shows how much it ever used
+#endif
+
+#ifndef CONFIG_ASYNC_TCP_PRIORITY
+#define CONFIG_ASYNC_TCP_PRIORITY 3 //above loop() (1) so network events are not held up by the sketch
+#endif
+
+#ifndef CONFIG_ASYNC_TCP_QUEUE_SIZE
+#define CONFIG_ASYNC_TCP_QUEUE_SIZE 32 //depth of the lwIP -> async_tcp event queue
+#endif
+
+#ifndef CONFIG_ASYNC_TCP_EVENT_POOL_SIZE
+#define CONFIG_ASYNC_TCP_EVENT_POOL_SIZE (CONFIG_ASYNC_TCP_QUEUE_SIZE + 8) //preallocated event packets, the heap is used when they run out
+#endif
+
+#ifndef CONFIG_ASYNC_TCP_CORK_SEGMENTS
+#define CONFIG_ASYNC_TCP_CORK_SEGMENTS 16 //writes collected between cork() and uncork()
+#endif
+
+#ifndef CONFIG_ASYNC_TCP_CORK_COPY_SIZE
+#define CONFIG_ASYNC_TCP_CORK_COPY_SIZE 256 //small copied writes (frame headers, small frames) are buffered while corked
+#endif
+
 class AsyncClient;
+struct lwip_event_packet_s;
+struct async_tcp_cork_s;
+
+typedef struct {
+    const char * data;
+    size_t size;
+    uint8_t apiflags;
+} async_tcp_segment_t;
+
+typedef struct {
+    uint32_t queue_size;
+    uint32_t queue_waiting;
+    uint32_t queue_high_water;  //most events ever waiting in the queue
+    uint32_t pool_size;
+    uint32_t pool_in_use;
+    uint32_t pool_exhausted;    //packets that had to come from the heap
+    uint32_t coalesced;         //poll/sent events merged into a pending one, or acks kept on a client
+    uint32_t dropped;           //poll events dropped on a full queue
+    uint32_t deferred;          //received data refused on a full queue, lwIP redelivers it
+    uint32_t tombstoned;        //queued events discarded because their client was torn down
+} async_tcp_event_stats_t;
+
+void async_tcp_get_event_stats(async_tcp_event_stats_t * stats);
+
+//tracing: define this function in the application and it is called when the
+//async_tcp task finishes an event (arg is the lwip_event_t) and when a write
+//returns from the lwIP thread (arg is the bytes written). start is micros() at
+//the beginning, the end is the time of the call.
+typedef enum {
+    ASYNC_TCP_TRACE_EVENT,
+    ASYNC_TCP_TRACE_WRITE
+} async_tcp_trace_point_t;
+
+void async_tcp_trace_hook(async_tcp_trace_point_t point, uint32_t start, uint32_t arg) __attribute__((weak));
 
 #define ASYNC_MAX_ACK_TIME 5000
-#define ASYNC_WRITE_FLAG_COPY 0x01 //will allocate new buffer to hold the data while sending (else will hold reference to the data given)
+#define ASYNC_WRITE_FLAG_COPY 0x01 //will allocate new buffer to hold the data while sending (else will hold reference to the data given, which must stay valid until acked)
 #define ASYNC_WRITE_FLAG_MORE 0x02 //will not send PSH flag, meaning that there should be more data to be sent before the application should react.
 
 typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
@@ -73,9 +131,26 @@ class AsyncClient {
     bool free();
 
     bool canSend();//ack is not pending
-    size_t space();//space available in the TCP window
+    size_t space(size_t writes=1);//bytes that many more writes can take in all: room in the TCP window and in lwIP's send queue (TCP_SND_QUEUELEN pbufs)
     size_t add(const char* data, size_t size, uint8_t apiflags=ASYNC_WRITE_FLAG_COPY);//add for sending
     bool send();//send all data added with the method above
+    size_t add(const async_tcp_segment_t * segments, size_t count, bool send = true);//add several buffers, and send, in a single call into the lwIP thread
+
+    //While corked, add() and send() are collected and handed to lwIP in one call by uncork().
+    //Copied writes up to CONFIG_ASYNC_TCP_CORK_COPY_SIZE are buffered, one right after
+    //another becomes a single write, larger ones are referenced and must stay valid
+    //until uncork() returns. add() only collects what fits
+    //the send buffer and the send queue, counting pbufs the way lwIP will, so a full queue
+    //makes it return 0 instead of cutting the batch short. uncork() returns false when
+    //lwIP did not take everything anyway, part of the data is then lost and the connection
+    //should be aborted.
+    void cork();
+    bool uncork();
+    bool corked(){ return _cork_depth > 0; }
+
+    //Bytes written without ASYNC_WRITE_FLAG_COPY that the peer has not acked yet.
+    //While there are any, close() aborts the connection instead, so lwIP lets go of them.
+    size_t referenced(){ return _tx_referenced() ? _tx_ref_until - _tx_acked : 0; }
 
     //write equals add()+send()
     size_t write(const char* data);
@@ -132,13 +207,18 @@ class AsyncClient {
     static int8_t _s_fin(void *arg, struct tcp_pcb *tpcb, int8_t err);
     static int8_t _s_lwip_fin(void *arg, struct tcp_pcb *tpcb, int8_t err);
     static void _s_error(void *arg, int8_t err);
-    static int8_t _s_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len);
+    static int8_t _s_sent(void *arg, struct tcp_pcb *tpcb, size_t len);
     static int8_t _s_connected(void* arg, void* tpcb, int8_t err);
     static void _s_dns_found(const char *name, struct ip_addr *ipaddr, void *arg);
 
     int8_t _recv(tcp_pcb* pcb, pbuf* pb, int8_t err);
     tcp_pcb * pcb(){ return _pcb; }
 
+    struct lwip_event_packet_s * _events;     //this client's queued events, tombstoned on teardown
+    struct lwip_event_packet_s * _sent_event; //queued SENT event that new acks are merged into
+    struct lwip_event_packet_s * _poll_event; //queued POLL event, further polls are skipped
+    uint32_t _sent_unreported;                //acked bytes that found the event queue full
+
   protected:
     tcp_pcb* _pcb;
     int8_t  _closed_slot;
@@ -168,12 +248,20 @@ class AsyncClient {
     uint32_t _rx_since_timeout;
     uint32_t _ack_timeout;
     uint16_t _connect_port;
+    uint8_t _cork_depth;
+    struct async_tcp_cork_s * _cork;
+    uint32_t _tx_written;   //bytes handed to lwIP
+    uint32_t _tx_acked;     //bytes acked by the peer
+    uint32_t _tx_ref_until; //_tx_written at the end of the last referenced write
+
+    bool _tx_referenced(){ return (int32_t)(_tx_ref_until - _tx_acked) > 0; }
 
+    bool _flush_cork(bool output);
     int8_t _close();
     int8_t _connected(void* pcb, int8_t err);
     void _error(int8_t err);
     int8_t _poll(tcp_pcb* pcb);
-    int8_t _sent(tcp_pcb* pcb, uint16_t len);
+    int8_t _sent(tcp_pcb* pcb, size_t len);
     int8_t _fin(tcp_pcb* pcb, int8_t err);
     int8_t _lwip_fin(tcp_pcb* pcb, int8_t err);
     void _dns_found(struct ip_addr *ipaddr);
@@ -116,6 +116,7 @@ class AsyncEventSource: public AsyncWebHandler {
     void _handleDisconnect(AsyncEventSourceClient * client);
     virtual bool canHandle(AsyncWebServerRequest *request) override final;
     virtual void handleRequest(AsyncWebServerRequest *request) override final;
+    virtual WebRouteKind route(String& uri) override final { uri = _url; return ROUTE_EXACT; }
 };
 
 class AsyncEventSourceResponse: public AsyncWebServerResponse {
@@ -180,6 +180,9 @@ protected:
   size_t _contentLength;
 #ifndef ARDUINOJSON_5_COMPATIBILITY   
   const size_t maxJsonBufferSize;
+#endif
+#if ARDUINOJSON_VERSION_MAJOR >= 7
+  ArduinoJson::Allocator *_allocator = ArduinoJson::detail::DefaultAllocator::instance();
 #endif
   size_t _maxContentLength;
 public:
@@ -194,6 +197,10 @@ public:
   void setMethod(WebRequestMethodComposite method){ _method = method; }
   void setMaxContentLength(int maxContentLength){ _maxContentLength = maxContentLength; }
   void onRequest(ArJsonRequestHandlerFunction fn){ _onRequest = fn; }
+#if ARDUINOJSON_VERSION_MAJOR >= 7
+  // Request documents take their memory from here instead of the heap
+  void setAllocator(ArduinoJson::Allocator *allocator){ _allocator = allocator; }
+#endif
 
   virtual bool canHandle(AsyncWebServerRequest *request) override final{
     if(!_onRequest)
@@ -202,7 +209,7 @@ public:
     if(!(_method & request->method()))
       return false;
 
-    if(_uri.length() && (_uri != request->url() && !request->url().startsWith(_uri+"/")))
+    if(_uri.length() && !webRouteMatchesPath(request->url(), _uri))
       return false;
 
     if ( !request->contentType().equalsIgnoreCase(JSON_MIMETYPE) )
@@ -220,6 +227,11 @@ public:
         DynamicJsonBuffer jsonBuffer;
         JsonVariant json = jsonBuffer.parse((uint8_t*)(request->_tempObject));
         if (json.success()) {
+#elif ARDUINOJSON_VERSION_MAJOR >= 7
+        JsonDocument jsonBuffer(_allocator);
+        DeserializationError error = deserializeJson(jsonBuffer, (uint8_t*)(request->_tempObject), _contentLength);
+        if(!error) {
+          JsonVariant json = jsonBuffer.as<JsonVariant>();
 #else
         DynamicJsonDocument jsonBuffer(this->maxJsonBufferSize);
         DeserializationError error = deserializeJson(jsonBuffer, (uint8_t*)(request->_tempObject));
@@ -250,5 +262,6 @@ public:
     }
   }
   virtual bool isRequestHandlerTrivial() override final {return _onRequest ? false : true;}
+  virtual WebRouteKind route(String& uri) override final { uri = _uri; return _uri.length() ? ROUTE_PATH : ROUTE_ANY; }
 };
 #endif
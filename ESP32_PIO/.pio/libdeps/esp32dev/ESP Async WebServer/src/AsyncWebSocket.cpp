@@ -20,6 +20,7 @@
 */
 #include "Arduino.h"
 #include "AsyncWebSocket.h"
+#include "WebSocketMask.h"
 
 #include <libb64/cencode.h>
 
@@ -36,19 +37,21 @@
 
 #define MAX_PRINTF_LEN 64
 
+//header and payload are two writes, room for both keeps lwIP from taking the header alone
 size_t webSocketSendFrameWindow(AsyncClient *client){
   if(!client->canSend())
     return 0;
-  size_t space = client->space();
+  size_t space = client->space(2);
   if(space < 9)
     return 0;
   return space - 8;
 }
 
-size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool mask, uint8_t *data, size_t len){
+//without copy the payload is referenced by lwIP and must stay untouched until the client acks it
+size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool mask, uint8_t *data, size_t len, bool copy = true){
   if(!client->canSend())
     return 0;
-  size_t space = client->space();
+  size_t space = client->space(2);
   if(space < 2)
     return 0;
   uint8_t mbuf[4] = {0,0,0,0};
@@ -68,12 +71,7 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
 
   if(len > space) len = space;
 
-  uint8_t *buf = (uint8_t*)malloc(headLen);
-  if(buf == NULL){
-    //os_printf("could not malloc %u bytes for frame header\n", headLen);
-    return 0;
-  }
-
+  uint8_t buf[8];
   buf[0] = opcode & 0x0F;
   if(final)
     buf[0] |= 0x80;
@@ -88,25 +86,34 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
     buf[1] |= 0x80;
     memcpy(buf + (headLen - 4), mbuf, 4);
   }
-  if(client->add((const char *)buf, headLen) != headLen){
-    //os_printf("error adding %lu header bytes\n", headLen);
-    free(buf);
-    return 0;
-  }
-  free(buf);
-
-  if(len){
-    if(len && mask){
-      size_t i;
-      for(i=0;i<len;i++)
-        data[i] = data[i] ^ mbuf[i%4];
-    }
-    if(client->add((const char *)data, len) != len){
-      //os_printf("error adding %lu data bytes\n", len);
+  if(len && mask)
+    webSocketMaskPayload(data, len, mbuf, 0);
+  uint8_t dataFlags = copy ? ASYNC_WRITE_FLAG_COPY : 0;
+
+  if(client->corked()){
+    //a shared payload small enough is copied too, the client then makes header and
+    //payload one write: one pbuf in lwIP's send queue instead of one for each
+    if(!copy && headLen + len <= CONFIG_ASYNC_TCP_CORK_COPY_SIZE)
+      dataFlags = ASYNC_WRITE_FLAG_COPY;
+    //collected by the client and written together with the rest of the batch; space(2)
+    //made room for both writes, so the payload fits after the header. When a flush in between
+    //fails anyway the header may be out without its payload, but then the cork refuses
+    //everything and _runQueue() aborts the connection at uncork()
+    if(client->add((const char *)buf, headLen) != headLen)
       return 0;
-    }
+    if(len && client->add((const char *)data, len, dataFlags) != len)
+      return 0;
+    if(!client->send())
+      return 0;
+    return len;
   }
-  if(!client->send()){
+
+  //header, payload and push in a single call into the lwIP thread
+  async_tcp_segment_t segments[2] = {
+    { (const char *)buf, headLen, ASYNC_WRITE_FLAG_COPY },
+    { (const char *)data, len, dataFlags }
+  };
+  if(client->add(segments, len ? 2 : 1, true) != headLen + len){
     //os_printf("error sending frame: %lu\n", headLen+len);
     return 0;
   }
@@ -450,7 +457,9 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
   uint8_t* dPtr = (uint8_t*)(_data + (_sent - toSend));
   uint8_t opCode = (toSend && _sent == toSend)?_opcode:(uint8_t)WS_CONTINUATION;
 
-  size_t sent = webSocketSendFrame(client, final, opCode, _mask, dPtr, toSend);
+  //the shared buffer outlives this message, which is only done once every byte is acked,
+  //so all clients can point lwIP at the same payload; masking rewrites it and needs a copy
+  size_t sent = webSocketSendFrame(client, final, opCode, _mask, dPtr, toSend, _mask);
   _status = WS_MSG_SENDING;
   if(toSend && sent != toSend){
       //ets_printf("E: %u != %u\n", toSend, sent);
@@ -469,8 +478,8 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
  const size_t AWSC_PING_PAYLOAD_LEN = 22;
 
 AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server)
-  : _controlQueue(LinkedList<AsyncWebSocketControl *>([](AsyncWebSocketControl *c){ delete  c; }))
-  , _messageQueue(LinkedList<AsyncWebSocketMessage *>([](AsyncWebSocketMessage *m){ delete  m; }))
+  : _controlQueue([](AsyncWebSocketControl * const &c){ delete  c; })
+  , _messageQueue([](AsyncWebSocketMessage * const &m){ delete  m; })
   , _tempObject(NULL)
 {
   _client = request->client();
@@ -500,21 +509,39 @@ AsyncWebSocketClient::~AsyncWebSocketClient(){
 
 void AsyncWebSocketClient::_onAck(size_t len, uint32_t time){
   _lastMessageTime = millis();
-  if(!_controlQueue.isEmpty()){
-    auto head = _controlQueue.front();
-    if(head->finished()){
-      len -= head->len();
-      if(_status == WS_DISCONNECTING && head->opcode() == WS_DISCONNECT){
-        _controlQueue.remove(head);
-        _status = WS_DISCONNECTED;
-        _client->close(true);
-        return;
+  bool closing = false;
+  {
+    AsyncWebLockGuard l(_lock);
+    if(!_controlQueue.isEmpty()){
+      auto head = _controlQueue.front();
+      if(head->finished()){
+        len = (len > head->len()) ? len - head->len() : 0;
+        closing = _status == WS_DISCONNECTING && head->opcode() == WS_DISCONNECT;
+        _controlQueue.pop();
+      }
+    }
+    if(closing){
+      _status = WS_DISCONNECTED;
+    } else if(len && !_messageQueue.isEmpty()){
+      if(!_messageQueue.front()->inFlight()){
+        _messageQueue.front()->ack(len, time);
+      } else {
+        //several messages may be in flight, acks arrive in order
+        for(size_t i = 0; len && i < _messageQueue.length(); i++){
+          AsyncWebSocketMessage *m = _messageQueue[i];
+          size_t part = std::min(len, m->inFlight());
+          if(!part)
+            break;
+          m->ack(part, time);
+          len -= part;
+        }
       }
-      _controlQueue.remove(head);
     }
   }
-  if(len && !_messageQueue.isEmpty()){
-    _messageQueue.front()->ack(len, time);
+  //close() deletes this client, so it must not run under its lock
+  if(closing){
+    _client->close(true);
+    return;
   }
   _server->_cleanBuffers(); 
   _runQueue();
@@ -529,45 +556,90 @@ void AsyncWebSocketClient::_onPoll(){
 }
 
 void AsyncWebSocketClient::_runQueue(){
+  //loop() queues from its task while acks and polls run it from async_tcp
+  AsyncWebLockGuard l(_lock);
+  if(_status == WS_DISCONNECTED || !_client)
+    return;
   while(!_messageQueue.isEmpty() && _messageQueue.front()->finished()){
-    _messageQueue.remove(_messageQueue.front());
+    _messageQueue.pop();
   }
 
+  bool batch = _server->batching();
+  if(batch){
+    _client->cork();
+    batch = _client->corked();
+  }
   if(!_controlQueue.isEmpty() && (_messageQueue.isEmpty() || _messageQueue.front()->betweenFrames()) && webSocketSendFrameWindow(_client) > (size_t)(_controlQueue.front()->len() - 1)){
     _controlQueue.front()->send(_client);
-  } else if(!_messageQueue.isEmpty() && _messageQueue.front()->betweenFrames() && webSocketSendFrameWindow(_client)){
-    _messageQueue.front()->send(_client);
+  } else {
+    //messages whose bytes are all queued are skipped while they wait for
+    //their ack; without batching only the first ready message is sent
+    for(size_t i = 0; i < _messageQueue.length(); i++){
+      AsyncWebSocketMessage *m = _messageQueue[i];
+      if(m->queued())
+        continue;
+      if(!m->betweenFrames() || !webSocketSendFrameWindow(_client))
+        break;
+      m->send(_client);
+      if(!batch || !m->queued())
+        break;
+    }
+  }
+  if(batch && !_client->uncork()){
+    //lwIP did not take the whole batch while the messages count it as sent, so
+    //the stream is broken; abort() leaves deleting this client to the error event
+    _status = WS_DISCONNECTED;
+    _client->abort();
   }
 }
 
 bool AsyncWebSocketClient::queueIsFull(){
-  if((_messageQueue.length() >= WS_MAX_QUEUED_MESSAGES) || (_status != WS_CONNECTED) ) return true;
+  if(_messageQueue.isFull() || (_status != WS_CONNECTED) ) return true;
   return false;
 }
 
-void AsyncWebSocketClient::_queueMessage(AsyncWebSocketMessage *dataMessage){
+bool AsyncWebSocketClient::_queueMessage(AsyncWebSocketMessage *dataMessage){
   if(dataMessage == NULL)
-    return;
+    return false;
   if(_status != WS_CONNECTED){
     delete dataMessage;
-    return;
+    return false;
   }
-  if(_messageQueue.length() >= WS_MAX_QUEUED_MESSAGES){
-      ets_printf("ERROR: Too many messages queued\n");
-      delete dataMessage;
-  } else {
-      _messageQueue.add(dataMessage);
+  uint32_t traceStart = async_websocket_trace_hook ? micros() : 0;
+  bool queued;
+  {
+    AsyncWebLockGuard l(_lock);
+    queued = _messageQueue.push(dataMessage);
+    if(!queued){
+        ets_printf("ERROR: Too many messages queued\n");
+        _server->_messageDropped();
+        delete dataMessage;
+    }
+    //inside a batch the server writes every client's queue once at endBatch()
+    if(!_server->inBatch() && _client->canSend())
+      _runQueue();
   }
-  if(_client->canSend())
-    _runQueue();
+  if(async_websocket_trace_hook)
+    async_websocket_trace_hook(traceStart, _messageQueue.length());
+  return queued;
 }
 
 void AsyncWebSocketClient::_queueControl(AsyncWebSocketControl *controlMessage){
   if(controlMessage == NULL)
     return;
-  _controlQueue.add(controlMessage);
-  if(_client->canSend())
-    _runQueue();
+  bool closing = false;
+  {
+    AsyncWebLockGuard l(_lock);
+    if(!_controlQueue.push(controlMessage)){
+      ets_printf("ERROR: Too many control frames queued\n");
+      closing = controlMessage->opcode() == WS_DISCONNECT;
+      delete controlMessage;
+    } else if(_client->canSend()){
+      _runQueue();
+    }
+  }
+  if(closing && _client)
+    _client->close(true);
 }
 
 void AsyncWebSocketClient::close(uint16_t code, const char * message){
@@ -645,10 +717,8 @@ void AsyncWebSocketClient::_onData(void *pbuf, size_t plen){
     const size_t datalen = std::min((size_t)(_pinfo.len - _pinfo.index), plen);
     const auto datalast = data[datalen];
 
-    if(_pinfo.masked){
-      for(size_t i=0;i<datalen;i++)
-        data[i] ^= _pinfo.mask[(_pinfo.index+i)%4];
-    }
+    if(_pinfo.masked)
+      webSocketMaskPayload(data, datalen, _pinfo.mask, (size_t)_pinfo.index);
 
     if((datalen + _pinfo.index) < _pinfo.len){
       _pstate = 1;
@@ -765,22 +835,22 @@ size_t AsyncWebSocketClient::printf_P(PGM_P formatP, ...) {
 }
 #endif
 
-void AsyncWebSocketClient::text(const char * message, size_t len){
-  _queueMessage(new AsyncWebSocketBasicMessage(message, len));
+bool AsyncWebSocketClient::text(const char * message, size_t len){
+  return _queueMessage(new AsyncWebSocketBasicMessage(message, len));
 }
-void AsyncWebSocketClient::text(const char * message){
-  text(message, strlen(message));
+bool AsyncWebSocketClient::text(const char * message){
+  return text(message, strlen(message));
 }
-void AsyncWebSocketClient::text(uint8_t * message, size_t len){
-  text((const char *)message, len);
+bool AsyncWebSocketClient::text(uint8_t * message, size_t len){
+  return text((const char *)message, len);
 }
-void AsyncWebSocketClient::text(char * message){
-  text(message, strlen(message));
+bool AsyncWebSocketClient::text(char * message){
+  return text(message, strlen(message));
 }
-void AsyncWebSocketClient::text(const String &message){
-  text(message.c_str(), message.length());
+bool AsyncWebSocketClient::text(const String &message){
+  return text(message.c_str(), message.length());
 }
-void AsyncWebSocketClient::text(const __FlashStringHelper *data){
+bool AsyncWebSocketClient::text(const __FlashStringHelper *data){
   PGM_P p = reinterpret_cast<PGM_P>(data);
   size_t n = 0;
   while (1) {
@@ -788,17 +858,19 @@ void AsyncWebSocketClient::text(const __FlashStringHelper *data){
       n += 1;
   }
   char * message = (char*) malloc(n+1);
+  bool queued = false;
   if(message){
     for(size_t b=0; b<n; b++)
       message[b] = pgm_read_byte(p++);
     message[n] = 0;
-    text(message, n);
+    queued = text(message, n);
     free(message);
   }
+  return queued;
 }
-void AsyncWebSocketClient::text(AsyncWebSocketMessageBuffer * buffer)
+bool AsyncWebSocketClient::text(AsyncWebSocketMessageBuffer * buffer)
 {
-  _queueMessage(new AsyncWebSocketMultiMessage(buffer));
+  return _queueMessage(new AsyncWebSocketMultiMessage(buffer));
 }
 
 void AsyncWebSocketClient::binary(const char * message, size_t len){
@@ -854,9 +926,12 @@ uint16_t AsyncWebSocketClient::remotePort() {
 
 AsyncWebSocket::AsyncWebSocket(const String& url)
   :_url(url)
-  ,_clients(LinkedList<AsyncWebSocketClient *>([](AsyncWebSocketClient *c){ delete c; }))
+  ,_clients(IntrusiveList<AsyncWebSocketClient>([](AsyncWebSocketClient *c){ delete c; }))
   ,_cNextId(1)
   ,_enabled(true)
+  ,_batching(true)
+  ,_batchDepth(0)
+  ,_droppedMessages(0)
   ,_buffers(LinkedList<AsyncWebSocketMessageBuffer *>([](AsyncWebSocketMessageBuffer *b){ delete b; }))
 {
   _eventHandler = NULL;
@@ -871,11 +946,22 @@ void AsyncWebSocket::_handleEvent(AsyncWebSocketClient * client, AwsEventType ty
 }
 
 void AsyncWebSocket::_addClient(AsyncWebSocketClient * client){
+  AsyncWebLockGuard l(_clientsLock);
   _clients.add(client);
 }
 
+void AsyncWebSocket::endBatch(){
+  if(!_batchDepth || --_batchDepth)
+    return;
+  AsyncWebLockGuard l(_clientsLock);
+  for(const auto& c: _clients){
+    if(c->status() == WS_CONNECTED && c->client() && c->client()->canSend())
+      c->_runQueue();
+  }
+}
+
 void AsyncWebSocket::_handleDisconnect(AsyncWebSocketClient * client){
-  
+  AsyncWebLockGuard l(_clientsLock);
   _clients.remove_first([=](AsyncWebSocketClient * c){
     return c->id() == client->id();
   });
@@ -910,6 +996,14 @@ AsyncWebSocketClient * AsyncWebSocket::client(uint32_t id){
   return nullptr;
 }
 
+void AsyncWebSocket::forEachClient(AwsClientFunction f){
+  AsyncWebLockGuard l(_clientsLock);
+  for(const auto &c: _clients){
+    if(c->status() == WS_CONNECTED)
+      f(c);
+  }
+}
+
 
 void AsyncWebSocket::close(uint32_t id, uint16_t code, const char * message){
   AsyncWebSocketClient * c = client(id);
@@ -951,11 +1045,19 @@ void AsyncWebSocket::text(uint32_t id, const char * message, size_t len){
 }
 
 void AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer * buffer){
+  textAll(buffer, nullptr);
+}
+
+void AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer * buffer, AwsClientFilter filter, AwsClientFunction onFull){
   if (!buffer) return;
   buffer->lock(); 
-  for(const auto& c: _clients){
-    if(c->status() == WS_CONNECTED){
-        c->text(buffer);
+  {
+    AsyncWebLockGuard l(_clientsLock);
+    for(const auto& c: _clients){
+      if(c->status() != WS_CONNECTED || (filter && !filter(c)))
+        continue;
+      if(!c->text(buffer) && onFull)
+        onFull(c);
     }
   }
   buffer->unlock();
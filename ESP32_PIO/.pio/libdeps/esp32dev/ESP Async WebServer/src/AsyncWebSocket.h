@@ -22,6 +22,7 @@
 #define ASYNCWEBSOCKET_H_
 
 #include <Arduino.h>
+#include <atomic>
 #ifdef ESP32
 #include <AsyncTCP.h>
 #define WS_MAX_QUEUED_MESSAGES 32
@@ -29,10 +30,18 @@
 #include <ESPAsyncTCP.h>
 #define WS_MAX_QUEUED_MESSAGES 8
 #endif
+#ifndef WS_MAX_QUEUED_CONTROLS
+#define WS_MAX_QUEUED_CONTROLS 8
+#endif
 #include <ESPAsyncWebServer.h>
 
 #include "AsyncWebSynchronization.h"
 
+// Tracing: when the application defines this it is called after every message
+// is queued for a client, with micros() from before queueing and the queue
+// length after it
+void async_websocket_trace_hook(uint32_t start, size_t queued) __attribute__((weak));
+
 #ifdef ESP8266
 #include <Hash.h>
 #ifdef CRYPTO_HASH_h // include Hash.h from espressif framework if the first include was from the crypto library
@@ -120,6 +129,10 @@ class AsyncWebSocketMessage {
     virtual size_t send(AsyncClient *client __attribute__((unused))){ return 0; }
     virtual bool finished(){ return _status != WS_MSG_SENDING; }
     virtual bool betweenFrames() const { return false; }
+    //all bytes were handed to TCP, the next message may go out before this one is acked
+    virtual bool queued() const { return false; }
+    //bytes handed to TCP and not acked yet, used to split acks over pipelined messages
+    virtual size_t inFlight() const { return 0; }
 };
 
 class AsyncWebSocketBasicMessage: public AsyncWebSocketMessage {
@@ -134,6 +147,8 @@ public:
     AsyncWebSocketBasicMessage(uint8_t opcode=WS_TEXT, bool mask=false);
     virtual ~AsyncWebSocketBasicMessage() override;
     virtual bool betweenFrames() const override { return _acked == _ack; }
+    virtual bool queued() const override { return _status == WS_MSG_SENDING && _sent == _len; }
+    virtual size_t inFlight() const override { return _ack - _acked; }
     virtual void ack(size_t len, uint32_t time) override ;
     virtual size_t send(AsyncClient *client) override ;
 };
@@ -150,19 +165,22 @@ public:
     AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode=WS_TEXT, bool mask=false); 
     virtual ~AsyncWebSocketMultiMessage() override;
     virtual bool betweenFrames() const override { return _acked == _ack; }
+    virtual bool queued() const override { return _status == WS_MSG_SENDING && _sent >= _len; }
+    virtual size_t inFlight() const override { return (_ack > _acked) ? _ack - _acked : 0; }
     virtual void ack(size_t len, uint32_t time) override ;
     virtual size_t send(AsyncClient *client) override ;
 };
 
-class AsyncWebSocketClient {
+class AsyncWebSocketClient : public IntrusiveListNode<AsyncWebSocketClient> {
   private:
     AsyncClient *_client;
     AsyncWebSocket *_server;
     uint32_t _clientId;
     AwsClientStatus _status;
+    AsyncWebLock _lock;//queues and the TCP cork, used from loop() and async_tcp
 
-    LinkedList<AsyncWebSocketControl *> _controlQueue;
-    LinkedList<AsyncWebSocketMessage *> _messageQueue;
+    RingQueue<AsyncWebSocketControl *, WS_MAX_QUEUED_CONTROLS> _controlQueue;
+    RingQueue<AsyncWebSocketMessage *, WS_MAX_QUEUED_MESSAGES> _messageQueue;
 
     uint8_t _pstate;
     AwsFrameInfo _pinfo;
@@ -170,9 +188,10 @@ class AsyncWebSocketClient {
     uint32_t _lastMessageTime;
     uint32_t _keepAlivePeriod;
 
-    void _queueMessage(AsyncWebSocketMessage *dataMessage);
+    bool _queueMessage(AsyncWebSocketMessage *dataMessage);
     void _queueControl(AsyncWebSocketControl *controlMessage);
     void _runQueue();
+    friend AsyncWebSocket;
 
   public:
     void *_tempObject;
@@ -210,13 +229,14 @@ class AsyncWebSocketClient {
 #ifndef ESP32
     size_t printf_P(PGM_P formatP, ...)  __attribute__ ((format (printf, 2, 3)));
 #endif
-    void text(const char * message, size_t len);
-    void text(const char * message);
-    void text(uint8_t * message, size_t len);
-    void text(char * message);
-    void text(const String &message);
-    void text(const __FlashStringHelper *data);
-    void text(AsyncWebSocketMessageBuffer *buffer); 
+    //false when the message was not queued: the queue is full or the client is not connected
+    bool text(const char * message, size_t len);
+    bool text(const char * message);
+    bool text(uint8_t * message, size_t len);
+    bool text(char * message);
+    bool text(const String &message);
+    bool text(const __FlashStringHelper *data);
+    bool text(AsyncWebSocketMessageBuffer *buffer); 
 
     void binary(const char * message, size_t len);
     void binary(const char * message);
@@ -226,7 +246,8 @@ class AsyncWebSocketClient {
     void binary(const __FlashStringHelper *data, size_t len);
     void binary(AsyncWebSocketMessageBuffer *buffer); 
 
-    bool canSend() { return _messageQueue.length() < WS_MAX_QUEUED_MESSAGES; }
+    bool canSend() { return !_messageQueue.isFull(); }
+    size_t queueLength() const { return _messageQueue.length(); }
 
     //system callbacks (do not call)
     void _onAck(size_t len, uint32_t time);
@@ -238,18 +259,24 @@ class AsyncWebSocketClient {
 };
 
 typedef std::function<void(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len)> AwsEventHandler;
+typedef std::function<void(AsyncWebSocketClient * client)> AwsClientFunction;
+typedef std::function<bool(AsyncWebSocketClient * client)> AwsClientFilter;
 
 //WebServer Handler implementation that plays the role of a socket server
 class AsyncWebSocket: public AsyncWebHandler {
   public:
-    typedef LinkedList<AsyncWebSocketClient *> AsyncWebSocketClientLinkedList;
+    typedef IntrusiveList<AsyncWebSocketClient> AsyncWebSocketClientLinkedList;
   private:
     String _url;
     AsyncWebSocketClientLinkedList _clients;
     uint32_t _cNextId;
     AwsEventHandler _eventHandler;
     bool _enabled;
+    bool _batching;
+    std::atomic<uint8_t> _batchDepth;
     AsyncWebLock _lock;
+    AsyncWebLock _clientsLock;//_clients, added and deleted from async_tcp while others walk it
+    std::atomic<uint32_t> _droppedMessages;
 
   public:
     AsyncWebSocket(const String& url);
@@ -257,12 +284,27 @@ class AsyncWebSocket: public AsyncWebHandler {
     const char * url() const { return _url.c_str(); }
     void enable(bool e){ _enabled = e; }
     bool enabled() const { return _enabled; }
+    //when batching (default) each client writes all frames that are ready in one TCP call,
+    //otherwise every frame is written and pushed on its own
+    void setBatching(bool batching){ _batching = batching; }
+    bool batching() const { return _batching; }
+    //frames queued between beginBatch() and endBatch() are held back and written at
+    //endBatch(), with one TCP call per client for everything a publisher tick produced;
+    //acks and polls still send in between. Call both from the same task.
+    void beginBatch(){ _batchDepth++; }
+    void endBatch();
+    bool inBatch() const { return _batchDepth.load() > 0; }
     bool availableForWriteAll();
     bool availableForWrite(uint32_t id);
 
     size_t count() const;
+    //messages thrown away because a client's queue was full
+    uint32_t droppedMessages() const { return _droppedMessages.load(std::memory_order_relaxed); }
     AsyncWebSocketClient * client(uint32_t id);
     bool hasClient(uint32_t id){ return client(id) != NULL; }
+    //calls f for each connected client with the client list locked, so none is
+    //added or deleted meanwhile; f may queue messages but must not keep the pointer
+    void forEachClient(AwsClientFunction f);
 
     void close(uint32_t id, uint16_t code=0, const char * message=NULL);
     void closeAll(uint16_t code=0, const char * message=NULL);
@@ -285,6 +327,8 @@ class AsyncWebSocket: public AsyncWebHandler {
     void textAll(const String &message);
     void textAll(const __FlashStringHelper *message); //  need to convert
     void textAll(AsyncWebSocketMessageBuffer * buffer); 
+    //sends buffer to the connected clients filter accepts, onFull gets those whose queue had no room
+    void textAll(AsyncWebSocketMessageBuffer * buffer, AwsClientFilter filter, AwsClientFunction onFull = nullptr);
 
     void binary(uint32_t id, const char * message, size_t len);
     void binary(uint32_t id, const char * message);
@@ -320,9 +364,11 @@ class AsyncWebSocket: public AsyncWebHandler {
     uint32_t _getNextId(){ return _cNextId++; }
     void _addClient(AsyncWebSocketClient * client);
     void _handleDisconnect(AsyncWebSocketClient * client);
+    void _messageDropped(){ _droppedMessages.fetch_add(1, std::memory_order_relaxed); }
     void _handleEvent(AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len);
     virtual bool canHandle(AsyncWebServerRequest *request) override final;
     virtual void handleRequest(AsyncWebServerRequest *request) override final;
+    virtual WebRouteKind route(String& uri) override final { uri = _url; return ROUTE_EXACT; }
 
 
     //  messagebuffer functions/objects. 
@@ -24,9 +24,12 @@
 #include "Arduino.h"
 
 #include <functional>
+#include <memory>
+#include <vector>
 #include "FS.h"
 
 #include "StringArray.h"
+#include "WebRouteTable.h"
 
 #ifdef ESP32
 #include <WiFi.h>
@@ -46,6 +49,25 @@
 
 #define DEBUGF(...) //Serial.printf(__VA_ARGS__)
 
+// Request line and headers are tokenized in place inside a per-request
+// buffer; a head that does not fit is answered with 431. Browsers send 1-2 KB
+// with cookies and a WebSocket upgrade, so leave room above that
+#ifndef ASYNCWEBSERVER_MAX_HEAD_LENGTH
+#define ASYNCWEBSERVER_MAX_HEAD_LENGTH 3072
+#endif
+
+// The head buffer is allocated with this many bytes when the request line
+// arrives and doubled up to ASYNCWEBSERVER_MAX_HEAD_LENGTH as the head grows,
+// so a short GET does not hold the whole limit
+#ifndef ASYNCWEBSERVER_HEAD_CHUNK
+#define ASYNCWEBSERVER_HEAD_CHUNK 512
+#endif
+
+// A request with more headers is answered with 431 instead of losing some
+#ifndef ASYNCWEBSERVER_MAX_HEADERS
+#define ASYNCWEBSERVER_MAX_HEADERS 32
+#endif
+
 class AsyncWebServer;
 class AsyncWebServerRequest;
 class AsyncWebServerResponse;
@@ -80,7 +102,7 @@ typedef std::function<void(void)> ArDisconnectHandler;
  * PARAMETER :: Chainable object to hold GET/POST and FILE parameters
  * */
 
-class AsyncWebParameter {
+class AsyncWebParameter : public IntrusiveListNode<AsyncWebParameter> {
   private:
     String _name;
     String _value;
@@ -102,7 +124,7 @@ class AsyncWebParameter {
  * HEADER :: Chainable object to hold the headers
  * */
 
-class AsyncWebHeader {
+class AsyncWebHeader : public IntrusiveListNode<AsyncWebHeader> {
   private:
     String _name;
     String _value;
@@ -126,9 +148,19 @@ class AsyncWebHeader {
  * REQUEST :: Each incoming Client is wrapped inside a Request and both live together until disconnect
  * */
 
+// Location of one request header inside the request head buffer. The
+// AsyncWebHeader object is only created when a handler asks for it.
+typedef struct {
+  uint16_t name;
+  uint16_t value;
+  AsyncWebHeader *header;
+} AsyncWebHeaderSpan;
+
 typedef enum { RCT_NOT_USED = -1, RCT_DEFAULT = 0, RCT_HTTP, RCT_WS, RCT_EVENT, RCT_MAX } RequestedConnectionType;
 
 typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
+// Immutable response body that can be served to any number of requests without copying it
+typedef std::shared_ptr<const std::vector<uint8_t>> AwsSharedBuffer;
 typedef std::function<String(const String&)> AwsTemplateProcessor;
 
 class AsyncWebServerRequest {
@@ -147,6 +179,14 @@ class AsyncWebServerRequest {
     String _temp;
     uint8_t _parseState;
 
+    char *_head;
+    size_t _headCapacity;
+    size_t _headLength;
+    size_t _lineStart;
+    mutable AsyncWebHeaderSpan *_headerSpans;
+    size_t _headerCapacity;
+    size_t _headerCount;
+
     uint8_t _version;
     WebRequestMethodComposite _method;
     String _url;
@@ -163,8 +203,8 @@ class AsyncWebServerRequest {
     size_t _contentLength;
     size_t _parsedLength;
 
-    LinkedList<AsyncWebHeader *> _headers;
-    LinkedList<AsyncWebParameter *> _params;
+    mutable IntrusiveList<AsyncWebHeader> _headers;
+    IntrusiveList<AsyncWebParameter> _params;
     LinkedList<String *> _pathParams;
 
     uint8_t _multiParseState;
@@ -189,12 +229,18 @@ class AsyncWebServerRequest {
     void _addParam(AsyncWebParameter*);
     void _addPathParam(const char *param);
 
-    bool _parseReqHead();
-    bool _parseReqHeader();
-    void _parseLine();
+    bool _parseReqHead(char *line, size_t len);
+    bool _parseReqHeader(char *line, size_t len);
+    bool _growHead(size_t length);
+    bool _growHeaderSpans();
+    void _parseLine(char *line, size_t len);
     void _parsePlainPostChar(uint8_t data);
     void _parseMultipartPostByte(uint8_t data, bool last);
     void _addGetParams(const String& params);
+    void _addGetParams(const char *params, size_t len);
+    String _urlDecode(const char *text, size_t len) const;
+    int _findHeader(const char *name) const;
+    AsyncWebHeader* _materializeHeader(size_t index) const;
 
     void _handleUploadStart();
     void _handleUploadByte(uint8_t data, bool last);
@@ -242,6 +288,7 @@ class AsyncWebServerRequest {
     void sendChunked(const String& contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback=nullptr);
     void send_P(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback=nullptr);
     void send_P(int code, const String& contentType, PGM_P content, AwsTemplateProcessor callback=nullptr);
+    void send(int code, const String& contentType, AwsSharedBuffer content);
 
     AsyncWebServerResponse *beginResponse(int code, const String& contentType=String(), const String& content=String());
     AsyncWebServerResponse *beginResponse(FS &fs, const String& path, const String& contentType=String(), bool download=false, AwsTemplateProcessor callback=nullptr);
@@ -252,6 +299,7 @@ class AsyncWebServerRequest {
     AsyncResponseStream *beginResponseStream(const String& contentType, size_t bufferSize=1460);
     AsyncWebServerResponse *beginResponse_P(int code, const String& contentType, const uint8_t * content, size_t len, AwsTemplateProcessor callback=nullptr);
     AsyncWebServerResponse *beginResponse_P(int code, const String& contentType, PGM_P content, AwsTemplateProcessor callback=nullptr);
+    AsyncWebServerResponse *beginResponse(int code, const String& contentType, AwsSharedBuffer content);
 
     size_t headers() const;                     // get header count
     bool hasHeader(const String& name) const;   // check if header exists
@@ -300,7 +348,7 @@ bool ON_AP_FILTER(AsyncWebServerRequest *request);
  * REWRITE :: One instance can be handle any Request (done by the Server)
  * */
 
-class AsyncWebRewrite {
+class AsyncWebRewrite : public IntrusiveListNode<AsyncWebRewrite> {
   protected:
     String _from;
     String _toUrl;
@@ -327,7 +375,7 @@ class AsyncWebRewrite {
  * HANDLER :: One instance can be attached to any Request (done by the Server)
  * */
 
-class AsyncWebHandler {
+class AsyncWebHandler : public IntrusiveListNode<AsyncWebHandler> {
   protected:
     ArRequestFilterFunction _filter;
     String _username;
@@ -345,6 +393,8 @@ class AsyncWebHandler {
     virtual void handleUpload(AsyncWebServerRequest *request  __attribute__((unused)), const String& filename __attribute__((unused)), size_t index __attribute__((unused)), uint8_t *data __attribute__((unused)), size_t len __attribute__((unused)), bool final  __attribute__((unused))){}
     virtual void handleBody(AsyncWebServerRequest *request __attribute__((unused)), uint8_t *data __attribute__((unused)), size_t len __attribute__((unused)), size_t index __attribute__((unused)), size_t total __attribute__((unused))){}
     virtual bool isRequestHandlerTrivial(){return true;}
+    // Lets the server index the handler by uri; ROUTE_ANY handlers are asked for every request
+    virtual WebRouteKind route(String& uri __attribute__((unused))){ return ROUTE_ANY; }
 };
 
 /*
@@ -358,7 +408,7 @@ typedef enum {
 class AsyncWebServerResponse {
   protected:
     int _code;
-    LinkedList<AsyncWebHeader *> _headers;
+    IntrusiveList<AsyncWebHeader> _headers;
     String _contentType;
     size_t _contentLength;
     bool _sendContentLength;
@@ -397,17 +447,31 @@ typedef std::function<void(AsyncWebServerRequest *request, uint8_t *data, size_t
 class AsyncWebServer {
   protected:
     AsyncServer _server;
-    LinkedList<AsyncWebRewrite*> _rewrites;
-    LinkedList<AsyncWebHandler*> _handlers;
+    IntrusiveList<AsyncWebRewrite> _rewrites;
+    IntrusiveList<AsyncWebHandler> _handlers;
     AsyncCallbackWebHandler* _catchAllHandler;
+    bool _noDelay;
+    AsyncWebRouteTable _routes;
+    AsyncWebRouteStats _routeStats;
+    bool _routesDirty;
+    bool _useRouteTable;
+
+    AsyncWebHandler* _findHandler(AsyncWebServerRequest *request);
 
   public:
     AsyncWebServer(uint16_t port);
     ~AsyncWebServer();
 
     void begin();
+    //TCP_NODELAY for accepted connections, on by default; disable to let Nagle merge small writes
+    void setNoDelay(bool nodelay);
     void end();
 
+    //route requests through the table built at begin() instead of asking every handler, on by default
+    void useRouteTable(bool enable);
+    const AsyncWebRouteStats& routeStats() const { return _routeStats; }
+    void resetRouteStats();
+
 #if ASYNC_TCP_SSL_ENABLED
     void onSslFileRequest(AcSSlFileHandler cb, void* arg);
     void beginSecure(const char *cert, const char *private_key_file, const char *password);
@@ -439,7 +503,7 @@ class AsyncWebServer {
 };
 
 class DefaultHeaders {
-  using headers_t = LinkedList<AsyncWebHeader *>;
+  using headers_t = IntrusiveList<AsyncWebHeader>;
   headers_t _headers;
   
   DefaultHeaders()
@@ -23,6 +23,7 @@
 
 #include "stddef.h"
 #include "WString.h"
+#include <utility>
 
 template <typename T>
 class LinkedListNode {
@@ -43,35 +44,52 @@ class LinkedList {
     typedef std::function<bool(const T&)> Predicate;
   private:
     ItemType* _root;
+    ItemType* _tail;
+    size_t _count;
     OnRemove _onRemove;
 
+    // next is fetched before the current node is handed out, so the current
+    // element may be removed while iterating
     class Iterator {
       ItemType* _node;
+      ItemType* _next;
     public:
-      Iterator(ItemType* current = nullptr) : _node(current) {}
-      Iterator(const Iterator& i) : _node(i._node) {}
-      Iterator& operator ++() { _node = _node->next; return *this; }
+      Iterator(ItemType* current = nullptr) : _node(current), _next(current ? current->next : nullptr) {}
+      Iterator(const Iterator& i) : _node(i._node), _next(i._next) {}
+      Iterator& operator ++() { _node = _next; _next = _node ? _node->next : nullptr; return *this; }
       bool operator != (const Iterator& i) const { return _node != i._node; }
       const T& operator * () const { return _node->value(); }
       const T* operator -> () const { return &_node->value(); }
     };
-    
+
+    void _unlink(ItemType* it, ItemType* pit){
+      if(it == _root){
+        _root = _root->next;
+      } else {
+        pit->next = it->next;
+      }
+      if(it == _tail){
+        _tail = (it == pit) ? nullptr : pit;
+      }
+      _count--;
+    }
+
   public:
     typedef const Iterator ConstIterator;
     ConstIterator begin() const { return ConstIterator(_root); }
     ConstIterator end() const { return ConstIterator(nullptr); }
 
-    LinkedList(OnRemove onRemove) : _root(nullptr), _onRemove(onRemove) {}
+    LinkedList(OnRemove onRemove) : _root(nullptr), _tail(nullptr), _count(0), _onRemove(std::move(onRemove)) {}
     ~LinkedList(){}
     void add(const T& t){
       auto it = new ItemType(t);
       if(!_root){
         _root = it;
       } else {
-        auto i = _root;
-        while(i->next) i = i->next;
-        i->next = it;
+        _tail->next = it;
       }
+      _tail = it;
+      _count++;
     }
     T& front() const {
       return _root->value();
@@ -81,13 +99,7 @@ class LinkedList {
       return _root == nullptr;
     }
     size_t length() const {
-      size_t i = 0;
-      auto it = _root;
-      while(it){
-        i++;
-        it = it->next;
-      }
-      return i;
+      return _count;
     }
     size_t count_if(Predicate predicate) const {
       size_t i = 0;
@@ -118,11 +130,7 @@ class LinkedList {
       auto pit = _root;
       while(it){
         if(it->value() == t){
-          if(it == _root){
-            _root = _root->next;
-          } else {
-            pit->next = it->next;
-          }
+          _unlink(it, pit);
           
           if (_onRemove) {
             _onRemove(it->value());
@@ -141,11 +149,7 @@ class LinkedList {
       auto pit = _root;
       while(it){
         if(predicate(it->value())){
-          if(it == _root){
-            _root = _root->next;
-          } else {
-            pit->next = it->next;
-          }
+          _unlink(it, pit);
           if (_onRemove) {
             _onRemove(it->value());
           }
@@ -168,6 +172,162 @@ class LinkedList {
         delete it;
       }
       _root = nullptr;
+      _tail = nullptr;
+      _count = 0;
+    }
+};
+
+/*
+ * Intrusive doubly linked list. Elements derive from IntrusiveListNode<T> and
+ * carry their own links, so adding an element does not allocate. An element
+ * can be in one IntrusiveList at a time.
+ */
+template <typename T>
+class IntrusiveListNode {
+    template <typename> friend class IntrusiveList;
+    T* _listPrev = nullptr;
+    T* _listNext = nullptr;
+  public:
+    IntrusiveListNode(){}
+    // copies start out unlinked
+    IntrusiveListNode(const IntrusiveListNode&){}
+    IntrusiveListNode& operator=(const IntrusiveListNode&){ return *this; }
+};
+
+template <typename T>
+class IntrusiveList {
+  public:
+    typedef std::function<void(T*)> OnRemove;
+    typedef std::function<bool(T*)> Predicate;
+  private:
+    T* _root;
+    T* _tail;
+    size_t _count;
+    OnRemove _onRemove;
+
+    static IntrusiveListNode<T>* _node(T* t){ return static_cast<IntrusiveListNode<T>*>(t); }
+
+    class Iterator {
+      T* _item;
+      T* _next;
+    public:
+      Iterator(T* current = nullptr) : _item(current), _next(current ? _node(current)->_listNext : nullptr) {}
+      Iterator(const Iterator& i) : _item(i._item), _next(i._next) {}
+      Iterator& operator ++() { _item = _next; _next = _item ? _node(_item)->_listNext : nullptr; return *this; }
+      bool operator != (const Iterator& i) const { return _item != i._item; }
+      T* operator * () const { return _item; }
+      T* operator -> () const { return _item; }
+    };
+
+    void _unlink(T* t){
+      auto n = _node(t);
+      if(n->_listPrev) _node(n->_listPrev)->_listNext = n->_listNext; else _root = n->_listNext;
+      if(n->_listNext) _node(n->_listNext)->_listPrev = n->_listPrev; else _tail = n->_listPrev;
+      n->_listPrev = nullptr;
+      n->_listNext = nullptr;
+      _count--;
+    }
+
+  public:
+    typedef const Iterator ConstIterator;
+    ConstIterator begin() const { return ConstIterator(_root); }
+    ConstIterator end() const { return ConstIterator(nullptr); }
+
+    IntrusiveList(OnRemove onRemove) : _root(nullptr), _tail(nullptr), _count(0), _onRemove(std::move(onRemove)) {}
+    ~IntrusiveList(){}
+    void add(T* t){
+      auto n = _node(t);
+      n->_listPrev = _tail;
+      n->_listNext = nullptr;
+      if(_tail) _node(_tail)->_listNext = t; else _root = t;
+      _tail = t;
+      _count++;
+    }
+    T* front() const { return _root; }
+    bool isEmpty() const { return _root == nullptr; }
+    size_t length() const { return _count; }
+    size_t count_if(Predicate predicate) const {
+      size_t i = 0;
+      for(T* it = _root; it; it = _node(it)->_listNext){
+        if(!predicate || predicate(it))
+          i++;
+      }
+      return i;
+    }
+    T* nth(size_t N) const {
+      T* it = _root;
+      while(it && N--)
+        it = _node(it)->_listNext;
+      return it;
+    }
+    // t must be an element of this list
+    bool remove(T* t){
+      if(t == nullptr || (_node(t)->_listPrev == nullptr && _root != t))
+        return false;
+      _unlink(t);
+      if(_onRemove)
+        _onRemove(t);
+      return true;
+    }
+    bool remove_first(Predicate predicate){
+      for(T* it = _root; it; it = _node(it)->_listNext){
+        if(predicate(it))
+          return remove(it);
+      }
+      return false;
+    }
+    void free(){
+      while(_root != nullptr)
+        remove(_root);
+    }
+};
+
+/*
+ * Fixed capacity FIFO. Storage is inline, push/pop/length are O(1) and
+ * nothing is allocated after construction. push() fails when full.
+ */
+template <typename T, size_t N>
+class RingQueue {
+  public:
+    typedef std::function<void(const T&)> OnRemove;
+  private:
+    T _items[N];
+    size_t _head;
+    size_t _count;
+    OnRemove _onRemove;
+  public:
+    RingQueue(OnRemove onRemove) : _items(), _head(0), _count(0), _onRemove(std::move(onRemove)) {}
+    ~RingQueue(){}
+    static constexpr size_t capacity() { return N; }
+    size_t length() const { return _count; }
+    bool isEmpty() const { return _count == 0; }
+    bool isFull() const { return _count == N; }
+    T& front() { return _items[_head]; }
+    const T& front() const { return _items[_head]; }
+    // i counts from the front
+    T& operator[](size_t i) { return _items[(_head + i) % N]; }
+    bool push(const T& t){
+      if(_count == N)
+        return false;
+      _items[(_head + _count) % N] = t;
+      _count++;
+      return true;
+    }
+    // removes the front element, calling OnRemove on it
+    void pop(){
+      if(_count == 0)
+        return;
+      T t = _items[_head];
+      _items[_head] = T();
+      _head = (_head + 1) % N;
+      _count--;
+      if(_onRemove)
+        _onRemove(t);
+    }
+    void free(){
+      while(_count)
+        pop();
+      _head = 0;
     }
 };
 
@@ -185,6 +345,15 @@ public:
     }
     return false;
   }
+
+  bool containsIgnoreCase(const char *str){
+    for (const auto& s : *this) {
+      if (strcasecmp(s.c_str(), str) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
 };
 
 
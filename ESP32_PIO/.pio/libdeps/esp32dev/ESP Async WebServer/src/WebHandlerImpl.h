@@ -51,6 +51,7 @@ class AsyncStaticWebHandler: public AsyncWebHandler {
     AsyncStaticWebHandler(const char* uri, FS& fs, const char* path, const char* cache_control);
     virtual bool canHandle(AsyncWebServerRequest *request) override final;
     virtual void handleRequest(AsyncWebServerRequest *request) override final;
+    virtual WebRouteKind route(String& uri) override final { uri = _uri; return ROUTE_PREFIX; }
     AsyncStaticWebHandler& setIsDir(bool isDir);
     AsyncStaticWebHandler& setDefaultFile(const char* filename);
     AsyncStaticWebHandler& setCacheControl(const char* cache_control);
@@ -105,20 +106,19 @@ class AsyncCallbackWebHandler: public AsyncWebHandler {
         }
       } else 
 #endif
-      if (_uri.length() && _uri.startsWith("/*.")) {
-         String uriTemplate = String (_uri);
-         uriTemplate = uriTemplate.substring(uriTemplate.lastIndexOf("."));
-         if (!request->url().endsWith(uriTemplate))
+      if (_uri.length() && !strncmp(_uri.c_str(), "/*.", 3)) {
+         const char *ext = strrchr(_uri.c_str(), '.');
+         size_t extLength = strlen(ext);
+         const String& url = request->url();
+         if (url.length() < extLength || strcmp(url.c_str() + url.length() - extLength, ext))
            return false;
       }
       else
-      if (_uri.length() && _uri.endsWith("*")) {
-        String uriTemplate = String(_uri);
-	uriTemplate = uriTemplate.substring(0, uriTemplate.length() - 1);
-        if (!request->url().startsWith(uriTemplate))
+      if (_uri.length() && _uri[_uri.length() - 1] == '*') {
+        if (strncmp(request->url().c_str(), _uri.c_str(), _uri.length() - 1))
           return false;
       }
-      else if(_uri.length() && (_uri != request->url() && !request->url().startsWith(_uri+"/")))
+      else if(_uri.length() && !webRouteMatchesPath(request->url(), _uri))
         return false;
 
       request->addInterestingHeader("ANY");
@@ -146,6 +146,17 @@ class AsyncCallbackWebHandler: public AsyncWebHandler {
         _onBody(request, data, len, index, total);
     }
     virtual bool isRequestHandlerTrivial() override final {return _onRequest ? false : true;}
+
+    virtual WebRouteKind route(String& uri) override final {
+      if(_isRegex || !_uri.length() || !strncmp(_uri.c_str(), "/*.", 3))
+        return ROUTE_ANY;
+      if(_uri[_uri.length() - 1] == '*'){
+        uri = _uri.substring(0, _uri.length() - 1);
+        return ROUTE_PREFIX;
+      }
+      uri = _uri;
+      return ROUTE_PATH;
+    }
 };
 
 #endif /* ASYNCWEBSERVERHANDLERIMPL_H_ */
@@ -32,6 +32,33 @@ static const String SharedEmptyString = String();
 
 enum { PARSE_REQ_START, PARSE_REQ_HEADERS, PARSE_REQ_BODY, PARSE_REQ_END, PARSE_REQ_FAIL };
 
+static_assert(ASYNCWEBSERVER_MAX_HEAD_LENGTH <= 0xFFFF, "header spans hold 16 bit offsets");
+
+// Header spans first allocated, doubled up to ASYNCWEBSERVER_MAX_HEADERS
+static const size_t __header_spans_chunk = 8;
+
+static const struct {
+  const char *name;
+  WebRequestMethodComposite method;
+} __request_methods[] = {
+  { "GET", HTTP_GET },
+  { "POST", HTTP_POST },
+  { "DELETE", HTTP_DELETE },
+  { "PUT", HTTP_PUT },
+  { "PATCH", HTTP_PATCH },
+  { "HEAD", HTTP_HEAD },
+  { "OPTIONS", HTTP_OPTIONS },
+};
+
+// String copy of a span that is not NUL terminated in the head buffer
+static String __span_string(char *str, size_t len){
+  char c = str[len];
+  str[len] = 0;
+  String s(str);
+  str[len] = c;
+  return s;
+}
+
 AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   : _client(c)
   , _server(s)
@@ -39,6 +66,13 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   , _response(NULL)
   , _temp()
   , _parseState(0)
+  , _head(NULL)
+  , _headCapacity(0)
+  , _headLength(0)
+  , _lineStart(0)
+  , _headerSpans(NULL)
+  , _headerCapacity(0)
+  , _headerCount(0)
   , _version(0)
   , _method(HTTP_ANY)
   , _url()
@@ -53,8 +87,8 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   , _expectingContinue(false)
   , _contentLength(0)
   , _parsedLength(0)
-  , _headers(LinkedList<AsyncWebHeader *>([](AsyncWebHeader *h){ delete h; }))
-  , _params(LinkedList<AsyncWebParameter *>([](AsyncWebParameter *p){ delete p; }))
+  , _headers(IntrusiveList<AsyncWebHeader>([](AsyncWebHeader *h){ delete h; }))
+  , _params(IntrusiveList<AsyncWebParameter>([](AsyncWebParameter *p){ delete p; }))
   , _pathParams(LinkedList<String *>([](String *p){ delete p; }))
   , _multiParseState(0)
   , _boundaryPosition(0)
@@ -96,6 +130,9 @@ AsyncWebServerRequest::~AsyncWebServerRequest(){
   if(_tempFile){
     _tempFile.close();
   }
+
+  free(_head);
+  free(_headerSpans);
 }
 
 void AsyncWebServerRequest::_onData(void *buf, size_t len){
@@ -103,24 +140,28 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len){
   while (true) {
 
   if(_parseState < PARSE_REQ_BODY){
-    // Find new line in buf
+    // Append up to the end of the line to the head buffer, lines are tokenized in place there
     char *str = (char*)buf;
-    for (i = 0; i < len; i++) {
-      if (str[i] == '\n') {
-        break;
-      }
+    char *eol = (char*)memchr(str, '\n', len);
+    i = eol ? (size_t)(eol - str) : len;
+    if (_headLength + i >= ASYNCWEBSERVER_MAX_HEAD_LENGTH) {
+      _parseState = PARSE_REQ_FAIL;
+      send(431);
+      return;
     }
-    if (i == len) { // No new line, just add the buffer in _temp
-      char ch = str[len-1];
-      str[len-1] = 0;
-      _temp.reserve(_temp.length()+len);
-      _temp.concat(str);
-      _temp.concat(ch);
-    } else { // Found new line - extract it and parse
-      str[i] = 0; // Terminate the string at the end of the line.
-      _temp.concat(str);
-      _temp.trim();
-      _parseLine();
+    if (!_growHead(_headLength + i + 1)) {
+      _parseState = PARSE_REQ_FAIL;
+      send(503);
+      return;
+    }
+    memcpy(_head + _headLength, str, i);
+    _headLength += i;
+    if (eol) { // Found new line - terminate it and parse
+      char *line = _head + _lineStart;
+      size_t lineLength = _headLength - _lineStart;
+      _head[_headLength++] = 0;
+      _lineStart = _headLength;
+      _parseLine(line, lineLength);
       if (++i < len) {
         // Still have more buffer to process
         buf = str+i;
@@ -180,11 +221,14 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len){
 
 void AsyncWebServerRequest::_removeNotInterestingHeaders(){
   if (_interestingHeaders.containsIgnoreCase("ANY")) return; // nothing to do
-  for(const auto& header: _headers){
-      if(!_interestingHeaders.containsIgnoreCase(header->name().c_str())){
-        _headers.remove(header);
-      }
+  // Nothing is materialized yet, dropping a header only compacts the span table
+  size_t kept = 0;
+  for(size_t i = 0; i < _headerCount; i++){
+    if(_interestingHeaders.containsIgnoreCase(_head + _headerSpans[i].name)){
+      _headerSpans[kept++] = _headerSpans[i];
+    }
   }
+  _headerCount = kept;
 }
 
 void AsyncWebServerRequest::_onPoll(){
@@ -238,116 +282,148 @@ void AsyncWebServerRequest::_addPathParam(const char *p){
 }
 
 void AsyncWebServerRequest::_addGetParams(const String& params){
-  size_t start = 0;
-  while (start < params.length()){
-    int end = params.indexOf('&', start);
-    if (end < 0) end = params.length();
-    int equal = params.indexOf('=', start);
-    if (equal < 0 || equal > end) equal = end;
-    String name = params.substring(start, equal);
-    String value = equal + 1 < end ? params.substring(equal + 1, end) : String();
-    _addParam(new AsyncWebParameter(urlDecode(name), urlDecode(value)));
-    start = end + 1;
-  }
-}
-
-bool AsyncWebServerRequest::_parseReqHead(){
-  // Split the head into method, url and version
-  int index = _temp.indexOf(' ');
-  String m = _temp.substring(0, index);
-  index = _temp.indexOf(' ', index+1);
-  String u = _temp.substring(m.length()+1, index);
-  _temp = _temp.substring(index+1);
-
-  if(m == "GET"){
-    _method = HTTP_GET;
-  } else if(m == "POST"){
-    _method = HTTP_POST;
-  } else if(m == "DELETE"){
-    _method = HTTP_DELETE;
-  } else if(m == "PUT"){
-    _method = HTTP_PUT;
-  } else if(m == "PATCH"){
-    _method = HTTP_PATCH;
-  } else if(m == "HEAD"){
-    _method = HTTP_HEAD;
-  } else if(m == "OPTIONS"){
-    _method = HTTP_OPTIONS;
-  }
-
-  String g = String();
-  index = u.indexOf('?');
-  if(index > 0){
-    g = u.substring(index +1);
-    u = u.substring(0, index);
-  }
-  _url = urlDecode(u);
-  _addGetParams(g);
-
-  if(!_temp.startsWith("HTTP/1.0"))
+  _addGetParams(params.c_str(), params.length());
+}
+
+void AsyncWebServerRequest::_addGetParams(const char *params, size_t len){
+  const char *end = params + len;
+  while (params < end){
+    const char *amp = (const char*)memchr(params, '&', end - params);
+    if (!amp) amp = end;
+    const char *equal = (const char*)memchr(params, '=', amp - params);
+    if (!equal) equal = amp;
+    String value = equal + 1 < amp ? _urlDecode(equal + 1, amp - equal - 1) : String();
+    _addParam(new AsyncWebParameter(_urlDecode(params, equal - params), value));
+    params = amp + 1;
+  }
+}
+
+bool AsyncWebServerRequest::_parseReqHead(char *line, size_t len){
+  // Split the head into method, url and version without copying it
+  char *end = line + len;
+  char *url = (char*)memchr(line, ' ', len);
+  if(!url) return false;
+  size_t methodLength = url - line;
+  url++;
+  char *version = (char*)memchr(url, ' ', end - url);
+  size_t urlLength = version ? version - url : end - url;
+
+  for(const auto& m: __request_methods){
+    if(strlen(m.name) == methodLength && !memcmp(m.name, line, methodLength)){
+      _method = m.method;
+      break;
+    }
+  }
+
+  char *query = (char*)memchr(url, '?', urlLength);
+  if(query && query > url){
+    _url = _urlDecode(url, query - url);
+    _addGetParams(query + 1, url + urlLength - query - 1);
+  } else {
+    _url = _urlDecode(url, urlLength);
+  }
+
+  if(!version || strncmp(version + 1, "HTTP/1.0", 8))
     _version = 1;
 
-  _temp = String();
   return true;
 }
 
-bool strContains(String src, String find, bool mindcase = true) {
-  int pos=0, i=0;
-  const int slen = src.length();
-  const int flen = find.length();
+bool strContains(const char *src, const char *find, bool mindcase = true) {
+  const size_t slen = strlen(src);
+  const size_t flen = strlen(find);
 
   if (slen < flen) return false;
-  while (pos <= (slen - flen)) {
-    for (i=0; i < flen; i++) {
+  for (size_t pos = 0; pos <= slen - flen; pos++) {
+    size_t i;
+    for (i = 0; i < flen; i++) {
       if (mindcase) {
-        if (src[pos+i] != find[i]) i = flen + 1; // no match
-      } else if (tolower(src[pos+i]) != tolower(find[i])) i = flen + 1; // no match
+        if (src[pos+i] != find[i]) break; // no match
+      } else if (tolower(src[pos+i]) != tolower(find[i])) break; // no match
     }
     if (i == flen) return true;
-    pos++;
   }
   return false;
 }
 
-bool AsyncWebServerRequest::_parseReqHeader(){
-  int index = _temp.indexOf(':');
-  if(index){
-    String name = _temp.substring(0, index);
-    String value = _temp.substring(index + 2);
-    if(name.equalsIgnoreCase("Host")){
-      _host = value;
-    } else if(name.equalsIgnoreCase("Content-Type")){
-	  _contentType = value.substring(0, value.indexOf(';'));
-      if (value.startsWith("multipart/")){
-        _boundary = value.substring(value.indexOf('=')+1);
-        _boundary.replace("\"","");
-        _isMultipart = true;
-      }
-    } else if(name.equalsIgnoreCase("Content-Length")){
-      _contentLength = atoi(value.c_str());
-    } else if(name.equalsIgnoreCase("Expect") && value == "100-continue"){
-      _expectingContinue = true;
-    } else if(name.equalsIgnoreCase("Authorization")){
-      if(value.length() > 5 && value.substring(0,5).equalsIgnoreCase("Basic")){
-        _authorization = value.substring(6);
-      } else if(value.length() > 6 && value.substring(0,6).equalsIgnoreCase("Digest")){
-        _isDigest = true;
-        _authorization = value.substring(7);
-      }
+// Makes the head buffer hold at least length bytes; spans are offsets, so
+// moving it keeps them valid
+bool AsyncWebServerRequest::_growHead(size_t length){
+  if(length <= _headCapacity) return true;
+  size_t capacity = _headCapacity ? _headCapacity : ASYNCWEBSERVER_HEAD_CHUNK;
+  while(capacity < length) capacity *= 2;
+  if(capacity > ASYNCWEBSERVER_MAX_HEAD_LENGTH) capacity = ASYNCWEBSERVER_MAX_HEAD_LENGTH;
+  char *head = (char*)realloc(_head, capacity);
+  if(!head) return false;
+  _head = head;
+  _headCapacity = capacity;
+  return true;
+}
+
+// Makes room for one more header span; false only when out of memory, the
+// header limit is left to _parseReqHeader()
+bool AsyncWebServerRequest::_growHeaderSpans(){
+  if(_headerCount < _headerCapacity || _headerCapacity == ASYNCWEBSERVER_MAX_HEADERS) return true;
+  size_t capacity = _headerCapacity ? _headerCapacity * 2 : __header_spans_chunk;
+  if(capacity > ASYNCWEBSERVER_MAX_HEADERS) capacity = ASYNCWEBSERVER_MAX_HEADERS;
+  AsyncWebHeaderSpan *spans = (AsyncWebHeaderSpan*)realloc(_headerSpans, capacity * sizeof(AsyncWebHeaderSpan));
+  if(!spans) return false;
+  _headerSpans = spans;
+  _headerCapacity = capacity;
+  return true;
+}
+
+bool AsyncWebServerRequest::_parseReqHeader(char *line, size_t len){
+  // The line is already NUL terminated in the head buffer; terminating the
+  // name at the colon turns both into C strings without copying them
+  char *colon = (char*)memchr(line, ':', len);
+  if(!colon || colon == line) return true;
+  if(_headerCount == ASYNCWEBSERVER_MAX_HEADERS) return false;
+  *colon = 0;
+  const char *name = line;
+  char *value = colon + 1;
+  while(*value == ' ' || *value == '\t') value++;
+  size_t valueLength = line + len - value;
+
+  if(!strcasecmp(name, "Host")){
+    _host = value;
+  } else if(!strcasecmp(name, "Content-Type")){
+    const char *semicolon = strchr(value, ';');
+    _contentType = semicolon ? __span_string(value, semicolon - value) : String(value);
+    if (!strncmp(value, "multipart/", 10)){
+      const char *equal = strchr(value, '=');
+      _boundary = equal ? equal + 1 : value;
+      _boundary.replace("\"","");
+      _isMultipart = true;
+    }
+  } else if(!strcasecmp(name, "Content-Length")){
+    _contentLength = atoi(value);
+  } else if(!strcasecmp(name, "Expect") && !strcmp(value, "100-continue")){
+    _expectingContinue = true;
+  } else if(!strcasecmp(name, "Authorization")){
+    if(valueLength > 5 && !strncasecmp(value, "Basic", 5)){
+      _authorization = value + 6;
+    } else if(valueLength > 6 && !strncasecmp(value, "Digest", 6)){
+      _isDigest = true;
+      _authorization = value + 7;
+    }
+  } else {
+    if(!strcasecmp(name, "Upgrade") && !strcasecmp(value, "websocket")){
+      // WebSocket request can be uniquely identified by header: [Upgrade: websocket]
+      _reqconntype = RCT_WS;
     } else {
-      if(name.equalsIgnoreCase("Upgrade") && value.equalsIgnoreCase("websocket")){
-        // WebSocket request can be uniquely identified by header: [Upgrade: websocket]
-        _reqconntype = RCT_WS;
-      } else {
-        if(name.equalsIgnoreCase("Accept") && strContains(value, "text/event-stream", false)){
-          // WebEvent request can be uniquely identified by header:  [Accept: text/event-stream]
-          _reqconntype = RCT_EVENT;
-        }
+      if(!strcasecmp(name, "Accept") && strContains(value, "text/event-stream", false)){
+        // WebEvent request can be uniquely identified by header:  [Accept: text/event-stream]
+        _reqconntype = RCT_EVENT;
       }
     }
-    _headers.add(new AsyncWebHeader(name, value));
   }
-  _temp = String();
+
+  // Only the location is recorded; AsyncWebHeader objects are created on first lookup
+  AsyncWebHeaderSpan &span = _headerSpans[_headerCount++];
+  span.name = name - _head;
+  span.value = value - _head;
+  span.header = NULL;
   return true;
 }
 
@@ -551,20 +627,22 @@ void AsyncWebServerRequest::_parseMultipartPostByte(uint8_t data, bool last){
   }
 }
 
-void AsyncWebServerRequest::_parseLine(){
+void AsyncWebServerRequest::_parseLine(char *line, size_t len){
+  while(len && isspace((unsigned char)line[len - 1])) line[--len] = 0;
+  while(len && isspace((unsigned char)*line)){ line++; len--; }
+
   if(_parseState == PARSE_REQ_START){
-    if(!_temp.length()){
+    if(!len || !_parseReqHead(line, len)){
       _parseState = PARSE_REQ_FAIL;
       _client->close();
     } else {
-      _parseReqHead();
       _parseState = PARSE_REQ_HEADERS;
     }
     return;
   }
 
   if(_parseState == PARSE_REQ_HEADERS){
-    if(!_temp.length()){
+    if(!len){
       //end of headers
       _server->_rewriteRequest(this);
       _server->_attachHandler(this);
@@ -581,21 +659,43 @@ void AsyncWebServerRequest::_parseLine(){
         if(_handler) _handler->handleRequest(this);
         else send(501);
       }
-    } else _parseReqHeader();
+    } else if(!_growHeaderSpans()){
+      _parseState = PARSE_REQ_FAIL;
+      send(503);
+    } else if(!_parseReqHeader(line, len)){
+      _parseState = PARSE_REQ_FAIL;
+      send(431);
+    }
+  }
+}
+
+int AsyncWebServerRequest::_findHeader(const char *name) const {
+  for(size_t i = 0; i < _headerCount; i++){
+    if(!strcasecmp(_head + _headerSpans[i].name, name)){
+      return i;
+    }
+  }
+  return -1;
+}
+
+AsyncWebHeader* AsyncWebServerRequest::_materializeHeader(size_t index) const {
+  if(index >= _headerCount){
+    return nullptr;
+  }
+  AsyncWebHeaderSpan &span = _headerSpans[index];
+  if(span.header == NULL){
+    span.header = new AsyncWebHeader(String(_head + span.name), String(_head + span.value));
+    _headers.add(span.header);
   }
+  return span.header;
 }
 
 size_t AsyncWebServerRequest::headers() const{
-  return _headers.length();
+  return _headerCount;
 }
 
 bool AsyncWebServerRequest::hasHeader(const String& name) const {
-  for(const auto& h: _headers){
-    if(h->name().equalsIgnoreCase(name)){
-      return true;
-    }
-  }
-  return false;
+  return _findHeader(name.c_str()) >= 0;
 }
 
 bool AsyncWebServerRequest::hasHeader(const __FlashStringHelper * data) const {
@@ -619,12 +719,8 @@ bool AsyncWebServerRequest::hasHeader(const __FlashStringHelper * data) const {
 }
 
 AsyncWebHeader* AsyncWebServerRequest::getHeader(const String& name) const {
-  for(const auto& h: _headers){
-    if(h->name().equalsIgnoreCase(name)){
-      return h;
-    }
-  }
-  return nullptr;
+  int index = _findHeader(name.c_str());
+  return index < 0 ? nullptr : _materializeHeader(index);
 }
 
 AsyncWebHeader* AsyncWebServerRequest::getHeader(const __FlashStringHelper * data) const {
@@ -642,8 +738,7 @@ AsyncWebHeader* AsyncWebServerRequest::getHeader(const __FlashStringHelper * dat
 }
 
 AsyncWebHeader* AsyncWebServerRequest::getHeader(size_t num) const {
-  auto header = _headers.nth(num);
-  return header ? *header : nullptr;
+  return _materializeHeader(num);
 }
 
 size_t AsyncWebServerRequest::params() const {
@@ -699,8 +794,7 @@ AsyncWebParameter* AsyncWebServerRequest::getParam(const __FlashStringHelper * d
 }
 
 AsyncWebParameter* AsyncWebServerRequest::getParam(size_t num) const {
-  auto param = _params.nth(num);
-  return param ? *param : nullptr;
+  return _params.nth(num);
 }
 
 void AsyncWebServerRequest::addInterestingHeader(const String& name){
@@ -768,6 +862,10 @@ AsyncWebServerResponse * AsyncWebServerRequest::beginResponse_P(int code, const
   return beginResponse_P(code, contentType, (const uint8_t *)content, strlen_P(content), callback);
 }
 
+AsyncWebServerResponse * AsyncWebServerRequest::beginResponse(int code, const String& contentType, AwsSharedBuffer content){
+  return new AsyncSharedBufferResponse(code, contentType, content);
+}
+
 void AsyncWebServerRequest::send(int code, const String& contentType, const String& content){
   send(beginResponse(code, contentType, content));
 }
@@ -804,6 +902,10 @@ void AsyncWebServerRequest::send_P(int code, const String& contentType, PGM_P co
   send(beginResponse_P(code, contentType, content, callback));
 }
 
+void AsyncWebServerRequest::send(int code, const String& contentType, AwsSharedBuffer content){
+  send(beginResponse(code, contentType, content));
+}
+
 void AsyncWebServerRequest::redirect(const String& url){
   AsyncWebServerResponse * response = beginResponse(302);
   response->addHeader("Location",url);
@@ -923,7 +1025,8 @@ const String& AsyncWebServerRequest::pathArg(size_t i) const {
 }
 
 const String& AsyncWebServerRequest::header(const char* name) const {
-  AsyncWebHeader* h = getHeader(String(name));
+  int index = _findHeader(name);
+  AsyncWebHeader* h = index < 0 ? nullptr : _materializeHeader(index);
   return h ? h->value() : SharedEmptyString;
 }
 
@@ -953,17 +1056,20 @@ const String& AsyncWebServerRequest::headerName(size_t i) const {
 }
 
 String AsyncWebServerRequest::urlDecode(const String& text) const {
+  return _urlDecode(text.c_str(), text.length());
+}
+
+String AsyncWebServerRequest::_urlDecode(const char *text, size_t len) const {
   char temp[] = "0x00";
-  unsigned int len = text.length();
-  unsigned int i = 0;
+  size_t i = 0;
   String decoded = String();
   decoded.reserve(len); // Allocate the string internal buffer - never longer from source text
   while (i < len){
     char decodedChar;
-    char encodedChar = text.charAt(i++);
+    char encodedChar = text[i++];
     if ((encodedChar == '%') && (i + 1 < len)){
-      temp[2] = text.charAt(i++);
-      temp[3] = text.charAt(i++);
+      temp[2] = text[i++];
+      temp[3] = text[i++];
       decodedChar = strtol(temp, NULL, 16);
     } else if (encodedChar == '+') {
       decodedChar = ' ';
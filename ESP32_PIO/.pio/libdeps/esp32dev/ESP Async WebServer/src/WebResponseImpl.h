@@ -39,6 +39,17 @@ class AsyncBasicResponse: public AsyncWebServerResponse {
     bool _sourceValid() const { return true; }
 };
 
+class AsyncSharedBufferResponse: public AsyncWebServerResponse {
+  private:
+    AwsSharedBuffer _content;
+    String _head;
+  public:
+    AsyncSharedBufferResponse(int code, const String& contentType, AwsSharedBuffer content);
+    void _respond(AsyncWebServerRequest *request);
+    size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time);
+    bool _sourceValid() const { return !!_content; }
+};
+
 class AsyncAbstractResponse: public AsyncWebServerResponse {
   private:
     String _head;
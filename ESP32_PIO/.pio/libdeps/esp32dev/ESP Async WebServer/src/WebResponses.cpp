@@ -33,6 +33,68 @@ void* memchr(void* ptr, int ch, size_t count)
 }
 
 
+/*
+ * Shared Buffer Response
+ * */
+AsyncSharedBufferResponse::AsyncSharedBufferResponse(int code, const String& contentType, AwsSharedBuffer content)
+  : _content(content)
+{
+  _code = code;
+  _contentType = contentType;
+  if(_content){
+    _contentLength = _content->size();
+    if(!_contentType.length())
+      _contentType = "application/octet-stream";
+  }
+  addHeader("Connection","close");
+}
+
+void AsyncSharedBufferResponse::_respond(AsyncWebServerRequest *request){
+  _head = _assembleHead(request->version());
+  _state = RESPONSE_HEADERS;
+  _ack(request, 0, 0);
+}
+
+size_t AsyncSharedBufferResponse::_ack(AsyncWebServerRequest *request, size_t len, uint32_t time){
+  (void)time;
+  _ackedLength += len;
+  if(_state == RESPONSE_HEADERS || _state == RESPONSE_CONTENT){
+    // Head and body go out straight from their buffers, in one lwIP call when they fit.
+    // lwIP references them instead of copying: this response lives until they are acked.
+    size_t headLen = _head.length();
+    size_t total = headLen + _contentLength;
+    size_t space = request->client()->space();
+    async_tcp_segment_t segments[2];
+    size_t count = 0;
+    size_t offset = _sentLength;
+    while(offset < total && space){
+      const char *data;
+      size_t avail;
+      if(offset < headLen){
+        data = _head.c_str() + offset;
+        avail = headLen - offset;
+      } else {
+        data = (const char *)_content->data() + (offset - headLen);
+        avail = total - offset;
+      }
+      size_t n = avail < space ? avail : space;
+      segments[count++] = { data, n, 0 };
+      offset += n;
+      space -= n;
+    }
+    size_t written = count ? request->client()->add(segments, count) : 0;
+    _sentLength += written;
+    _writtenLength += written;
+    _state = _sentLength == total ? RESPONSE_WAIT_ACK : RESPONSE_CONTENT;
+    return written;
+  } else if(_state == RESPONSE_WAIT_ACK){
+    if(_ackedLength >= _writtenLength){
+      _state = RESPONSE_END;
+    }
+  }
+  return 0;
+}
+
 /*
  * Abstract Response
  * */
@@ -72,6 +134,7 @@ const char* AsyncWebServerResponse::_responseCodeToString(int code) {
     case 415: return "Unsupported Media Type";
     case 416: return "Requested range not satisfiable";
     case 417: return "Expectation Failed";
+    case 431: return "Request Header Fields Too Large";
     case 500: return "Internal Server Error";
     case 501: return "Not Implemented";
     case 502: return "Bad Gateway";
@@ -84,7 +147,7 @@ const char* AsyncWebServerResponse::_responseCodeToString(int code) {
 
 AsyncWebServerResponse::AsyncWebServerResponse()
   : _code(0)
-  , _headers(LinkedList<AsyncWebHeader *>([](AsyncWebHeader *h){ delete h; }))
+  , _headers(IntrusiveList<AsyncWebHeader>([](AsyncWebHeader *h){ delete h; }))
   , _contentType()
   , _contentLength(0)
   , _sendContentLength(true)
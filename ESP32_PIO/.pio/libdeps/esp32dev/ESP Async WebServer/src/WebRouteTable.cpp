@@ -0,0 +1,194 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "ESPAsyncWebServer.h"
+#include "WebRouteTable.h"
+
+bool webRouteMatchesPath(const String& url, const String& uri){
+  size_t len = uri.length();
+  if(url.length() < len || strncmp(url.c_str(), uri.c_str(), len) != 0)
+    return false;
+  return url.length() == len || url.c_str()[len] == '/';
+}
+
+AsyncWebRouteTable::AsyncWebRouteTable()
+  : _any(NONE)
+{}
+
+void AsyncWebRouteTable::clear(){
+  _routes.clear();
+  _slots.clear();
+  _nodes.clear();
+  _keys.clear();
+  _any = NONE;
+}
+
+uint32_t AsyncWebRouteTable::_hash(const char *key, size_t len){
+  // FNV-1a
+  uint32_t hash = 2166136261UL;
+  while(len--){
+    hash ^= (uint8_t)*key++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+AsyncWebRouteTable::Slot* AsyncWebRouteTable::_slot(const char *key, size_t len, uint32_t hash) const {
+  // Open addressing, the table is kept at most half full so there is always an empty slot
+  size_t mask = _slots.size() - 1;
+  for(size_t i = hash & mask; ; i = (i + 1) & mask){
+    const Slot& s = _slots[i];
+    if(s.first == NONE || (s.hash == hash && s.length == len && memcmp(&_keys[s.key], key, len) == 0))
+      return const_cast<Slot*>(&s);
+  }
+}
+
+void AsyncWebRouteTable::_link(std::vector<Route>& routes, uint16_t& first, uint16_t index){
+  // Chains are kept in registration order
+  uint16_t *p = &first;
+  while(*p != NONE)
+    p = &routes[*p].next;
+  *p = index;
+}
+
+void AsyncWebRouteTable::_addExact(uint16_t index, const char *uri){
+  size_t len = strlen(uri);
+  uint32_t hash = _hash(uri, len);
+  Slot *s = _slot(uri, len, hash);
+  if(s->first == NONE){
+    s->hash = hash;
+    s->key = _keys.size();
+    s->length = len;
+    _keys.insert(_keys.end(), uri, uri + len);
+  }
+  _link(_routes, s->first, index);
+}
+
+void AsyncWebRouteTable::_addPrefix(uint16_t index, const char *uri){
+  uint16_t node = 0;
+  for(const char *c = uri; *c; c++){
+    uint16_t child = _nodes[node].child;
+    while(child != NONE && _nodes[child].c != *c)
+      child = _nodes[child].sibling;
+    if(child == NONE){
+      child = _nodes.size();
+      _nodes.push_back({ *c, NONE, _nodes[node].child, NONE });
+      _nodes[node].child = child;
+    }
+    node = child;
+  }
+  _link(_routes, _nodes[node].first, index);
+}
+
+void AsyncWebRouteTable::build(const IntrusiveList<AsyncWebHandler>& handlers){
+  clear();
+
+  std::vector<String> uris;
+  size_t exact = 0;
+  for(const auto& h: handlers){
+    if(_routes.size() == NONE)
+      break;
+    String uri;
+    WebRouteKind kind = h->route(uri);
+    if(kind == ROUTE_EXACT || kind == ROUTE_PATH)
+      exact++;
+    _routes.push_back({ h, kind, NONE });
+    uris.push_back(uri);
+  }
+
+  size_t size = 8;
+  while(size < exact * 2)
+    size <<= 1;
+  _slots.assign(size, Slot{ 0, 0, 0, NONE });
+  _nodes.push_back({ 0, NONE, NONE, NONE });
+
+  for(uint16_t i = 0; i < _routes.size(); i++){
+    switch(_routes[i].kind){
+      case ROUTE_EXACT:
+      case ROUTE_PATH:
+        _addExact(i, uris[i].c_str());
+        break;
+      case ROUTE_PREFIX:
+        _addPrefix(i, uris[i].c_str());
+        break;
+      default:
+        _link(_routes, _any, i);
+        break;
+    }
+  }
+}
+
+int AsyncWebRouteTable::candidates(const String& url, uint16_t *out, size_t max) const {
+  if(_slots.empty())
+    return -1;
+
+  size_t count = 0;
+  auto collect = [&](uint16_t index, bool pathOnly) -> bool {
+    for(; index != NONE; index = _routes[index].next){
+      if(pathOnly && _routes[index].kind != ROUTE_PATH)
+        continue;
+      if(count == max)
+        return false;
+      out[count++] = index;
+    }
+    return true;
+  };
+
+  const char *u = url.c_str();
+  size_t len = url.length();
+
+  // The url itself, then every ancestor path for ROUTE_PATH handlers
+  for(size_t end = len; end > 0; end--){
+    if(end != len && u[end] != '/')
+      continue;
+    Slot *s = _slot(u, end, _hash(u, end));
+    if(!collect(s->first, end != len))
+      return -1;
+  }
+
+  uint16_t node = 0;
+  if(!collect(_nodes[0].first, false))
+    return -1;
+  for(size_t i = 0; i < len; i++){
+    uint16_t child = _nodes[node].child;
+    while(child != NONE && _nodes[child].c != u[i])
+      child = _nodes[child].sibling;
+    if(child == NONE)
+      break;
+    node = child;
+    if(!collect(_nodes[node].first, false))
+      return -1;
+  }
+
+  if(!collect(_any, false))
+    return -1;
+
+  // Few candidates per request, insertion sort back into registration order
+  for(size_t i = 1; i < count; i++){
+    uint16_t v = out[i];
+    size_t j = i;
+    while(j > 0 && out[j - 1] > v){
+      out[j] = out[j - 1];
+      j--;
+    }
+    out[j] = v;
+  }
+  return count;
+}
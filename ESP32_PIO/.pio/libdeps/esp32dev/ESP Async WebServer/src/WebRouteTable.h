@@ -0,0 +1,114 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef ASYNCWEBSERVERROUTETABLE_H_
+#define ASYNCWEBSERVERROUTETABLE_H_
+
+#include "Arduino.h"
+#include <vector>
+
+#include "StringArray.h"
+
+// Handlers considered for a single request; more than this falls back to the linear scan
+#ifndef ASYNCWEBSERVER_ROUTE_CANDIDATES
+#define ASYNCWEBSERVER_ROUTE_CANDIDATES 16
+#endif
+
+class AsyncWebHandler;
+
+/*
+ * ROUTE :: How a handler can be found from the request url without asking it
+ * */
+
+typedef enum {
+  ROUTE_ANY,     // asked for every request (regex, suffix match, custom canHandle)
+  ROUTE_EXACT,   // url equals the uri
+  ROUTE_PATH,    // url equals the uri or is a path below it
+  ROUTE_PREFIX   // url starts with the uri
+} WebRouteKind;
+
+// url == uri || url.startsWith(uri + "/") without building the temporary String
+bool webRouteMatchesPath(const String& url, const String& uri);
+
+typedef struct {
+  uint32_t requests;    // requests routed
+  uint32_t evaluated;   // filter()/canHandle() calls made while routing
+  uint32_t linear;      // requests that went through the linear handler scan
+  uint32_t micros;      // total time spent picking a handler
+  uint32_t maxMicros;   // slowest single request
+} AsyncWebRouteStats;
+
+/*
+ * ROUTE TABLE :: Exact and path routes hashed by uri, prefix routes in a trie.
+ * Candidates come out in registration order, so the first handler whose
+ * filter() and canHandle() accept the request is the same one the linear
+ * scan would have picked.
+ * */
+
+class AsyncWebRouteTable {
+  private:
+    enum { NONE = 0xFFFF };
+
+    struct Route {
+      AsyncWebHandler *handler;
+      WebRouteKind kind;
+      uint16_t next;      // next route with the same key, or next ROUTE_ANY route
+    };
+
+    struct Slot {
+      uint32_t hash;
+      uint16_t key;       // offset of the uri in _keys
+      uint16_t length;
+      uint16_t first;
+    };
+
+    struct Node {
+      char c;
+      uint16_t child;
+      uint16_t sibling;
+      uint16_t first;
+    };
+
+    std::vector<Route> _routes;
+    std::vector<Slot> _slots;
+    std::vector<Node> _nodes;
+    std::vector<char> _keys;
+    uint16_t _any;
+
+    static uint32_t _hash(const char *key, size_t len);
+    Slot* _slot(const char *key, size_t len, uint32_t hash) const;
+    void _addExact(uint16_t index, const char *uri);
+    void _addPrefix(uint16_t index, const char *uri);
+    static void _link(std::vector<Route>& routes, uint16_t& first, uint16_t index);
+
+  public:
+    AsyncWebRouteTable();
+
+    void build(const IntrusiveList<AsyncWebHandler>& handlers);
+    void clear();
+    size_t routes() const { return _routes.size(); }
+    AsyncWebHandler* handler(uint16_t index) const { return _routes[index].handler; }
+
+    // Fills out with the indexes of the handlers that may accept url, in
+    // registration order. Returns -1 when more than max would be needed.
+    int candidates(const String& url, uint16_t *out, size_t max) const;
+};
+
+#endif /* ASYNCWEBSERVERROUTETABLE_H_ */
@@ -32,8 +32,13 @@ bool ON_AP_FILTER(AsyncWebServerRequest *request) {
 
 AsyncWebServer::AsyncWebServer(uint16_t port)
   : _server(port)
-  , _rewrites(LinkedList<AsyncWebRewrite*>([](AsyncWebRewrite* r){ delete r; }))
-  , _handlers(LinkedList<AsyncWebHandler*>([](AsyncWebHandler* h){ delete h; }))
+  , _rewrites(IntrusiveList<AsyncWebRewrite>([](AsyncWebRewrite* r){ delete r; }))
+  , _handlers(IntrusiveList<AsyncWebHandler>([](AsyncWebHandler* h){ delete h; }))
+  , _noDelay(true)
+  , _routes()
+  , _routeStats()
+  , _routesDirty(true)
+  , _useRouteTable(true)
 {
   _catchAllHandler = new AsyncCallbackWebHandler();
   if(_catchAllHandler == NULL)
@@ -72,22 +77,39 @@ AsyncWebRewrite& AsyncWebServer::rewrite(const char* from, const char* to){
 
 AsyncWebHandler& AsyncWebServer::addHandler(AsyncWebHandler* handler){
   _handlers.add(handler);
+  _routesDirty = true;
   return *handler;
 }
 
 bool AsyncWebServer::removeHandler(AsyncWebHandler *handler){
+  _routesDirty = true;
   return _handlers.remove(handler);
 }
 
 void AsyncWebServer::begin(){
-  _server.setNoDelay(true);
+  _routes.build(_handlers);
+  _routesDirty = false;
+  _server.setNoDelay(_noDelay);
   _server.begin();
 }
 
+void AsyncWebServer::setNoDelay(bool nodelay){
+  _noDelay = nodelay;
+  _server.setNoDelay(nodelay);
+}
+
 void AsyncWebServer::end(){
   _server.end();
 }
 
+void AsyncWebServer::useRouteTable(bool enable){
+  _useRouteTable = enable;
+}
+
+void AsyncWebServer::resetRouteStats(){
+  memset(&_routeStats, 0, sizeof(_routeStats));
+}
+
 #if ASYNC_TCP_SSL_ENABLED
 void AsyncWebServer::onSslFileRequest(AcSSlFileHandler cb, void* arg){
   _server.onSslFileRequest(cb, arg);
@@ -111,14 +133,49 @@ void AsyncWebServer::_rewriteRequest(AsyncWebServerRequest *request){
   }
 }
 
-void AsyncWebServer::_attachHandler(AsyncWebServerRequest *request){
-  for(const auto& h: _handlers){
-    if (h->filter(request) && h->canHandle(request)){
-      request->setHandler(h);
-      return;
+AsyncWebHandler* AsyncWebServer::_findHandler(AsyncWebServerRequest *request){
+  if(_useRouteTable){
+    if(_routesDirty){
+      // handlers changed after begin()
+      _routes.build(_handlers);
+      _routesDirty = false;
+    }
+    uint16_t found[ASYNCWEBSERVER_ROUTE_CANDIDATES];
+    int count = _routes.candidates(request->url(), found, ASYNCWEBSERVER_ROUTE_CANDIDATES);
+    if(count >= 0){
+      for(int i = 0; i < count; i++){
+        AsyncWebHandler *h = _routes.handler(found[i]);
+        _routeStats.evaluated++;
+        if (h->filter(request) && h->canHandle(request))
+          return h;
+      }
+      return NULL;
     }
   }
-  
+
+  _routeStats.linear++;
+  for(const auto& h: _handlers){
+    _routeStats.evaluated++;
+    if (h->filter(request) && h->canHandle(request))
+      return h;
+  }
+  return NULL;
+}
+
+void AsyncWebServer::_attachHandler(AsyncWebServerRequest *request){
+  uint32_t start = micros();
+  AsyncWebHandler *h = _findHandler(request);
+  uint32_t elapsed = micros() - start;
+  _routeStats.requests++;
+  _routeStats.micros += elapsed;
+  if(elapsed > _routeStats.maxMicros)
+    _routeStats.maxMicros = elapsed;
+
+  if(h){
+    request->setHandler(h);
+    return;
+  }
+
   request->addInterestingHeader("ANY");
   request->setHandler(_catchAllHandler);
 }
@@ -183,6 +240,8 @@ void AsyncWebServer::onRequestBody(ArBodyHandlerFunction fn){
 void AsyncWebServer::reset(){
   _rewrites.free();
   _handlers.free();
+  _routes.clear();
+  _routesDirty = true;
   
   if (_catchAllHandler != NULL){
     _catchAllHandler->onRequest(NULL);
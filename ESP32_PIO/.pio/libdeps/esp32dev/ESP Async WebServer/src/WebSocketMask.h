@@ -0,0 +1,68 @@
+/*
+  Asynchronous WebServer library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef ASYNCWEBSOCKETMASK_H_
+#define ASYNCWEBSOCKETMASK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint32_t __attribute__((__may_alias__)) ws_mask_word_t;
+
+/*
+ * XOR data with the 4 byte frame mask. offset is the position of data[0]
+ * inside the frame payload, so fragments that arrive in several TCP segments
+ * stay in phase with the key. The aligned middle is processed a word at a time
+ * with the key rotated to match, the unaligned head and tail byte by byte.
+ */
+inline void webSocketMaskPayload(uint8_t *data, size_t len, const uint8_t *mask, size_t offset){
+  size_t i = 0;
+  while(i < len && ((uintptr_t)(data + i) & 3)){
+    data[i] ^= mask[(offset + i) & 3];
+    i++;
+  }
+  if(len - i >= 4){
+    uint8_t rotated[4];
+    for(uint8_t k = 0; k < 4; k++)
+      rotated[k] = mask[(offset + i + k) & 3];
+    ws_mask_word_t key;
+    memcpy(&key, rotated, 4);
+    ws_mask_word_t *words = (ws_mask_word_t *)(data + i);
+    size_t n = (len - i) >> 2;
+    i += n << 2;
+    while(n >= 4){
+      words[0] ^= key;
+      words[1] ^= key;
+      words[2] ^= key;
+      words[3] ^= key;
+      words += 4;
+      n -= 4;
+    }
+    while(n--)
+      *words++ ^= key;
+  }
+  while(i < len){
+    data[i] ^= mask[(offset + i) & 3];
+    i++;
+  }
+}
+
+#endif /* ASYNCWEBSOCKETMASK_H_ */
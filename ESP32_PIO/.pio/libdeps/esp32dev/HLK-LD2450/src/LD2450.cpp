@@ -26,7 +26,6 @@ LD2450::~LD2450() // Destructor function
 void LD2450::begin(Stream &radarStream)
 {
     LD2450::radar_uart = &radarStream;
-    LD2450::last_target_data = "";
 }
 
 void LD2450::begin(HardwareSerial &radarStream, bool already_initialized)
@@ -37,8 +36,6 @@ void LD2450::begin(HardwareSerial &radarStream, bool already_initialized)
     }
 
     LD2450::radar_uart = &radarStream;
-
-    LD2450::last_target_data = "";
 }
 
 #ifdef ENABLE_SOFTWARESERIAL_SUPPORT
@@ -50,11 +47,487 @@ void LD2450::begin(HardwareSerial &radarStream, bool already_initialized)
         }
     
         LD2450::radar_uart = &radarStream;
-    
-        LD2450::last_target_data = "";
     }
 #endif
 
+#ifdef ESP32
+bool LD2450::beginEventDriven(HardwareSerial &radarStream, bool already_initialized)
+{
+    if (LD2450::frame_queue == NULL)
+    {
+        LD2450::frame_queue = xQueueCreate(LD2450_FRAME_QUEUE, sizeof(Frame_t));
+        if (LD2450::frame_queue == NULL)
+        {
+            return false;
+        }
+    }
+    if (LD2450::ack_queue == NULL)
+    {
+        // One command is out at a time, the second slot takes a stray ACK
+        LD2450::ack_queue = xQueueCreate(2, sizeof(Ack_t));
+        if (LD2450::ack_queue == NULL)
+        {
+            return false;
+        }
+    }
+    // A frame cut off by a restart of the UART is dropped by the parser
+    xQueueReset(LD2450::frame_queue);
+    xQueueReset(LD2450::ack_queue);
+
+    if (!already_initialized)
+    {
+        radarStream.begin(LD2450::serial_speed);
+    }
+    radarStream.setRxFIFOFull(LD2450::wire_timing ? 1 : LD2450_RX_FIFO_FULL);
+    radarStream.setRxTimeout(LD2450_RX_TIMEOUT);
+    radarStream.onReceive([this]() { LD2450::onUartReceive(); });
+
+    LD2450::radar_uart = &radarStream;
+    LD2450::radar_serial = &radarStream;
+    return true;
+}
+
+// Runs in the UART driver's event task
+void LD2450::onUartReceive()
+{
+    uint32_t now = micros();
+    LD2450::rx_handover = now;
+    size_t received = 0;
+    if (LD2450::rx_reset.exchange(false))
+    {
+        LD2450::rx_length = 0;
+    }
+    // 10 bits a byte in 1/16 us; the bytes still in the driver behind one
+    // arrived after it
+    uint32_t byte_time = 160000000UL / LD2450::serial_speed;
+    byte buffer[64];
+    int available;
+    while ((available = LD2450::radar_uart->available()) > 0)
+    {
+        size_t len = LD2450::radar_uart->readBytes(buffer, min((size_t)available, sizeof(buffer)));
+        received += len;
+        for (size_t i = 0; i < len; i++)
+        {
+            Frame_t frame;
+            Ack_t ack;
+            LD2450::rx_behind = ((uint32_t)(available - 1 - i) * byte_time) >> 4;
+            Parsed parsed = LD2450::feed(buffer[i], frame, ack);
+            if (parsed == PARSED_ACK)
+            {
+                // read() matches it to the command that waits
+                xQueueSend(LD2450::ack_queue, &ack, 0);
+                continue;
+            }
+            if (parsed != PARSED_REPORT)
+            {
+                continue;
+            }
+            // The newest frame matters most, make room by dropping the oldest
+            if (xQueueSend(LD2450::frame_queue, &frame, 0) != pdTRUE)
+            {
+                Frame_t oldest;
+                xQueueReceive(LD2450::frame_queue, &oldest, 0);
+                xQueueSend(LD2450::frame_queue, &frame, 0);
+                LD2450::stats.overruns++;
+            }
+        }
+    }
+    if (ld2450_receive_hook)
+    {
+        ld2450_receive_hook(now, received);
+    }
+}
+
+uint32_t LD2450::getLastFrameTime() const
+{
+    return LD2450::last_frame_time;
+}
+
+uint32_t LD2450::getLastFrameWireTime() const
+{
+    return LD2450::last_frame_wire_time;
+}
+
+void LD2450::setWireTiming(bool on)
+{
+    LD2450::wire_timing = on;
+    if (LD2450::radar_serial != nullptr)
+    {
+        LD2450::radar_serial->setRxFIFOFull(on ? 1 : LD2450_RX_FIFO_FULL);
+    }
+}
+
+bool LD2450::setTrackingMode(bool multi_target)
+{
+    return LD2450::queueSession(multi_target ? LD2450_CMD_MULTI_TARGET : LD2450_CMD_SINGLE_TARGET);
+}
+
+bool LD2450::requestTrackingMode()
+{
+    return LD2450::queueSession(LD2450_CMD_QUERY_TRACKING);
+}
+
+bool LD2450::requestFirmwareVersion()
+{
+    return LD2450::queueSession(LD2450_CMD_FIRMWARE_VERSION);
+}
+
+bool LD2450::requestMacAddress()
+{
+    static const byte value[2] = {0x01, 0x00};
+    return LD2450::queueSession(LD2450_CMD_MAC_ADDRESS, value, sizeof(value));
+}
+
+// The sensor takes the index into this list, counting from 1; 0 for a
+// rate it cannot do
+uint8_t LD2450::baudRateIndex(uint32_t baud)
+{
+    static const uint32_t rates[] = {9600, 19200, 38400, 57600, 115200, 230400, 256000, 460800};
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        if (rates[i] == baud)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+bool LD2450::setBaudRate(uint32_t baud)
+{
+    const byte value[2] = {LD2450::baudRateIndex(baud), 0x00};
+    return value[0] != 0 && LD2450::queueSession(LD2450_CMD_SET_BAUD_RATE, value, sizeof(value));
+}
+
+bool LD2450::switchBaudRate(uint32_t baud)
+{
+    static const byte enable[2] = {0x01, 0x00};
+    const byte value[2] = {LD2450::baudRateIndex(baud), 0x00};
+    if (value[0] == 0 || LD2450::radar_serial == nullptr || LD2450::baud_state != BAUD_IDLE || LD2450::command_count != 0)
+    {
+        return false;
+    }
+    // One session, so a refused rate skips the restart. Nothing is queued
+    // before it, every ACK and END_CONFIG until the restart is its own.
+    LD2450::queueCommand(LD2450_CMD_ENABLE_CONFIG, enable, sizeof(enable));
+    LD2450::queueCommand(LD2450_CMD_SET_BAUD_RATE, value, sizeof(value));
+    LD2450::queueCommand(LD2450_CMD_RESTART, nullptr, 0);
+    LD2450::baud_previous = LD2450::serial_speed;
+    LD2450::baud_target = baud;
+    LD2450::baud_state = BAUD_COMMANDS;
+    return true;
+}
+
+uint32_t LD2450::getBaudRate() const
+{
+    return LD2450::serial_speed;
+}
+
+bool LD2450::isSupportedBaudRate(uint32_t baud)
+{
+    return LD2450::baudRateIndex(baud) != 0;
+}
+
+void LD2450::reopenUart(uint32_t baud)
+{
+    LD2450::serial_speed = baud;
+    LD2450::radar_serial->updateBaudRate(baud);
+    // Whatever was received around the switch is garbage
+    LD2450::rx_reset.store(true);
+    LD2450::baud_frames = LD2450::stats.frames;
+    LD2450::baud_deadline = millis() + LD2450_BAUD_VERIFY;
+}
+
+// Runs in read() while switchBaudRate() waits for frames
+void LD2450::checkBaudRate()
+{
+    if (LD2450::baud_state != BAUD_VERIFY_NEW && LD2450::baud_state != BAUD_VERIFY_OLD)
+    {
+        return;
+    }
+    if (LD2450::stats.frames != LD2450::baud_frames)
+    {
+        int result = LD2450::baud_state == BAUD_VERIFY_NEW ? LD2450_COMMAND_OK : LD2450_COMMAND_FAILED;
+        LD2450::baud_state = BAUD_IDLE;
+        LD2450::commandEnded(LD2450_BAUD_SWITCHED, result);
+    }
+    else if ((int32_t)(millis() - LD2450::baud_deadline) >= 0)
+    {
+        if (LD2450::baud_state == BAUD_VERIFY_NEW)
+        {
+            LD2450::baud_state = BAUD_VERIFY_OLD;
+            LD2450::reopenUart(LD2450::baud_previous);
+            return;
+        }
+        LD2450::baud_state = BAUD_IDLE;
+        LD2450::commandEnded(LD2450_BAUD_SWITCHED, LD2450_COMMAND_TIMEOUT);
+    }
+}
+
+bool LD2450::factoryReset()
+{
+    return LD2450::queueSession(LD2450_CMD_FACTORY_RESET);
+}
+
+bool LD2450::restart()
+{
+    // The sensor leaves the configuration mode by restarting
+    return LD2450::queueSession(LD2450_CMD_RESTART, nullptr, 0, false);
+}
+
+bool LD2450::endConfigMode()
+{
+    if (LD2450::frame_queue == NULL || LD2450::command_count == LD2450_COMMAND_QUEUE)
+    {
+        return false;
+    }
+    LD2450::queueCommand(LD2450_CMD_END_CONFIG, nullptr, 0);
+    return true;
+}
+
+bool LD2450::setRegions(uint8_t type, const int16_t regions[LD2450_MAX_REGIONS][4])
+{
+    byte value[2 + LD2450_MAX_REGIONS * 8] = {type, 0x00};
+    for (int i = 0; i < LD2450_MAX_REGIONS; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            value[2 + i * 8 + j * 2] = (uint16_t)regions[i][j] & 0xFF;
+            value[3 + i * 8 + j * 2] = (uint16_t)regions[i][j] >> 8;
+        }
+    }
+    return LD2450::queueSession(LD2450_CMD_SET_REGIONS, value, sizeof(value));
+}
+
+bool LD2450::requestRegions()
+{
+    return LD2450::queueSession(LD2450_CMD_QUERY_REGIONS);
+}
+
+// The type word and the corners as the region commands carry them, plain
+// little endian int16 unlike the report frames
+void LD2450::decodeRegions(const byte *data)
+{
+    SensorInfo_t &info = LD2450::sensor_info;
+    info.region_type = data[0];
+    for (int i = 0; i < LD2450_MAX_REGIONS; i++)
+    {
+        const byte *corners = data + 2 + i * 8;
+        info.regions[i].x1 = (int16_t)(corners[0] | (corners[1] << 8));
+        info.regions[i].y1 = (int16_t)(corners[2] | (corners[3] << 8));
+        info.regions[i].x2 = (int16_t)(corners[4] | (corners[5] << 8));
+        info.regions[i].y2 = (int16_t)(corners[6] | (corners[7] << 8));
+    }
+    info.regions_valid = true;
+}
+
+void LD2450::onCommandResult(CommandCallback callback)
+{
+    LD2450::command_callback = callback;
+}
+
+bool LD2450::isConfiguring() const
+{
+    return LD2450::command_count > 0 || LD2450::baud_state != BAUD_IDLE;
+}
+
+const LD2450::SensorInfo &LD2450::getSensorInfo() const
+{
+    return LD2450::sensor_info;
+}
+
+bool LD2450::queueSession(uint16_t command, const byte *value, uint8_t length, bool end_config)
+{
+    static const byte enable[2] = {0x01, 0x00};
+    uint8_t needed = end_config ? 3 : 2;
+    if (LD2450::frame_queue == NULL || LD2450_COMMAND_QUEUE - LD2450::command_count < needed)
+    {
+        return false;
+    }
+    LD2450::queueCommand(LD2450_CMD_ENABLE_CONFIG, enable, sizeof(enable));
+    LD2450::queueCommand(command, value, length);
+    if (end_config)
+    {
+        LD2450::queueCommand(LD2450_CMD_END_CONFIG, nullptr, 0);
+    }
+    return true;
+}
+
+void LD2450::queueCommand(uint16_t command, const byte *value, uint8_t length)
+{
+    Command_t &entry = LD2450::commands[(LD2450::command_head + LD2450::command_count) % LD2450_COMMAND_QUEUE];
+    entry.command = command;
+    entry.length = length;
+    if (length > 0)
+    {
+        memcpy(entry.value, value, length);
+    }
+    LD2450::command_count++;
+}
+
+// Runs in read(): takes the ACKs the UART event task parsed, gives up on a
+// command that waited too long and sends the next one
+void LD2450::processCommands()
+{
+    Ack_t ack;
+    while (xQueueReceive(LD2450::ack_queue, &ack, 0) == pdTRUE)
+    {
+        LD2450::takeAck(ack);
+    }
+    if (LD2450::command_sent && millis() - LD2450::command_time >= (uint32_t)LD2450_ACK_TIMEOUT)
+    {
+        LD2450::finishCommand(LD2450_COMMAND_TIMEOUT);
+    }
+    LD2450::checkBaudRate();
+    if (LD2450::command_sent || LD2450::command_count == 0)
+    {
+        return;
+    }
+
+    const Command_t &entry = LD2450::commands[LD2450::command_head];
+    byte frame[4 + 2 + 2 + LD2450_COMMAND_VALUE_MAX + 4] = {0xFD, 0xFC, 0xFB, 0xFA};
+    uint16_t length = 2 + entry.length;
+    frame[4] = length & 0xFF;
+    frame[5] = length >> 8;
+    frame[6] = entry.command & 0xFF;
+    frame[7] = entry.command >> 8;
+    memcpy(frame + 8, entry.value, entry.length);
+    static const byte footer[4] = {0x04, 0x03, 0x02, 0x01};
+    memcpy(frame + 8 + entry.length, footer, sizeof(footer));
+    LD2450::radar_uart->write(frame, 12 + entry.length);
+    LD2450::command_sent = true;
+    LD2450::command_time = millis();
+}
+
+void LD2450::takeAck(const Ack_t &ack)
+{
+    // A late answer to a command that timed out has nothing to match
+    if (!LD2450::command_sent || ack.command != (LD2450::commands[LD2450::command_head].command | LD2450_ACK_FLAG))
+    {
+        return;
+    }
+    if (ack.status != 0)
+    {
+        LD2450::finishCommand(LD2450_COMMAND_FAILED);
+        return;
+    }
+
+    SensorInfo_t &info = LD2450::sensor_info;
+    switch (LD2450::commands[LD2450::command_head].command)
+    {
+    case LD2450_CMD_FIRMWARE_VERSION:
+        if (ack.length >= 8)
+        {
+            info.firmware_type = ack.data[0] | (ack.data[1] << 8);
+            info.firmware_major = ack.data[2] | (ack.data[3] << 8);
+            info.firmware_minor = ack.data[4] | (ack.data[5] << 8) | ((uint32_t)ack.data[6] << 16) | ((uint32_t)ack.data[7] << 24);
+            info.firmware_valid = true;
+        }
+        break;
+    case LD2450_CMD_MAC_ADDRESS:
+        if (ack.length >= 6)
+        {
+            memcpy(info.mac, ack.data, 6);
+            info.mac_valid = true;
+        }
+        break;
+    case LD2450_CMD_QUERY_TRACKING:
+        if (ack.length >= 2)
+        {
+            info.multi_target = (ack.data[0] | (ack.data[1] << 8)) == 0x0002;
+            info.tracking_valid = true;
+        }
+        break;
+    case LD2450_CMD_QUERY_REGIONS:
+        if (ack.length >= 2 + LD2450_MAX_REGIONS * 8)
+        {
+            LD2450::decodeRegions(ack.data);
+        }
+        break;
+    case LD2450_CMD_SET_REGIONS:
+        // The ACK carries nothing, what was sent is what the sensor has now
+        LD2450::decodeRegions(LD2450::commands[LD2450::command_head].value);
+        break;
+    case LD2450_CMD_SINGLE_TARGET:
+    case LD2450_CMD_MULTI_TARGET:
+        info.multi_target = LD2450::commands[LD2450::command_head].command == LD2450_CMD_MULTI_TARGET;
+        info.tracking_valid = true;
+        break;
+    }
+    LD2450::finishCommand(LD2450_COMMAND_OK);
+}
+
+// Takes the command at the head off the queue. When it did not succeed the
+// rest of its session is skipped, but the configuration mode is still ended,
+// also for the sessions that would have left it by restarting.
+void LD2450::finishCommand(int result)
+{
+    uint16_t command = LD2450::commands[LD2450::command_head].command;
+    LD2450::command_head = (LD2450::command_head + 1) % LD2450_COMMAND_QUEUE;
+    LD2450::command_count--;
+    LD2450::command_sent = false;
+    if (result == LD2450_COMMAND_FAILED && LD2450::baud_state == BAUD_COMMANDS)
+    {
+        LD2450::baud_state = BAUD_REFUSED;
+    }
+    LD2450::commandEnded(command, result);
+    if (result == LD2450_COMMAND_OK || command == LD2450_CMD_END_CONFIG)
+    {
+        return;
+    }
+    while (LD2450::command_count > 0)
+    {
+        uint16_t next = LD2450::commands[LD2450::command_head].command;
+        if (next == LD2450_CMD_END_CONFIG || next == LD2450_CMD_ENABLE_CONFIG)
+        {
+            break;
+        }
+        LD2450::command_head = (LD2450::command_head + 1) % LD2450_COMMAND_QUEUE;
+        LD2450::command_count--;
+        LD2450::commandEnded(next, LD2450_COMMAND_ABORTED);
+    }
+    // switchBaudRate() and restart() end with RESTART instead of END_CONFIG,
+    // a restart that timed out may have happened; the slot the failed command
+    // freed takes one in front of the queue
+    bool restarted = command == LD2450_CMD_RESTART && result == LD2450_COMMAND_TIMEOUT;
+    if (!restarted && (LD2450::command_count == 0 || LD2450::commands[LD2450::command_head].command != LD2450_CMD_END_CONFIG))
+    {
+        LD2450::command_head = (LD2450::command_head + LD2450_COMMAND_QUEUE - 1) % LD2450_COMMAND_QUEUE;
+        LD2450::commands[LD2450::command_head].command = LD2450_CMD_END_CONFIG;
+        LD2450::commands[LD2450::command_head].length = 0;
+        LD2450::command_count++;
+    }
+}
+
+void LD2450::commandEnded(uint16_t command, int result)
+{
+    if (LD2450::command_callback)
+    {
+        LD2450::command_callback(command, result);
+    }
+    if (LD2450::baud_state != BAUD_COMMANDS && LD2450::baud_state != BAUD_REFUSED)
+    {
+        return;
+    }
+    // A session cut short ends with END_CONFIG, still sent at the old rate
+    bool sent_restart = command == LD2450_CMD_RESTART && result != LD2450_COMMAND_ABORTED;
+    if (!sent_restart && command != LD2450_CMD_END_CONFIG)
+    {
+        return;
+    }
+    // The sensor refused, so it never restarted and stays at the old rate
+    if (LD2450::baud_state == BAUD_REFUSED)
+    {
+        LD2450::baud_state = BAUD_IDLE;
+        LD2450::commandEnded(LD2450_BAUD_SWITCHED, LD2450_COMMAND_FAILED);
+        return;
+    }
+    // Otherwise the sensor may be at the new rate, whether it answered or not
+    LD2450::baud_state = BAUD_VERIFY_NEW;
+    LD2450::reopenUart(LD2450::baud_target);
+}
+#endif
+
 
 void LD2450::setNumberOfTargets(uint16_t _numTargets)
 {
@@ -68,13 +541,20 @@ void LD2450::setNumberOfTargets(uint16_t _numTargets)
 
 String LD2450::getLastTargetMessage()
 {
-    return LD2450::last_target_data;
+    // Built on demand so reading frames does not allocate
+    String last_target_data = "";
+    for (uint16_t i = 0; i < LD2450::getSensorSupportedTargetCount(); i++)
+    {
+        const RadarTarget_t &target = LD2450::radarTargets[i];
+        last_target_data += "TARGET ID=" + String(i + 1) + " X=" + String(target.x) + "mm, Y=" + String(target.y) + "mm, SPEED=" + String(target.speed) + "cm/s, RESOLUTION=" + String(target.resolution) + "mm, DISTANCE=" + String(target.distance) + "mm, VALID=" + String(target.valid) + "\n";
+    }
+    return last_target_data;
 }
 
 
 bool LD2450::waitForSensorMessage(bool wait_forever){
 
-    uint8_t read_result = 0;
+    int read_result = 0;
     for(long i = 0; i < LD2450_DEFAULT_RETRY_COUNT_FOR_WAIT_FOR_MSG; i++){
         read_result = LD2450::read();
         if(read_result >= 0){
@@ -92,13 +572,31 @@ bool LD2450::waitForSensorMessage(bool wait_forever){
 
 
 
-uint8_t LD2450::read()
+int LD2450::read()
 {
     if (LD2450::radar_uart == nullptr)
     {
-        return -2;
+        return LD2450_READ_NOT_STARTED;
     }
 
+#ifdef ESP32
+    if (LD2450::frame_queue != NULL)
+    {
+        LD2450::processCommands();
+        // While a command waits for its ACK come back soon to look for it
+        uint32_t wait = LD2450::command_sent ? LD2450_COMMAND_POLL : LD2450_READ_TIMEOUT;
+        Frame_t frame;
+        if (xQueueReceive(LD2450::frame_queue, &frame, pdMS_TO_TICKS(wait)) != pdTRUE)
+        {
+            return LD2450_READ_NO_FRAME;
+        }
+        memcpy(LD2450::radarTargets, frame.targets, sizeof(LD2450::radarTargets));
+        LD2450::last_frame_time = frame.time;
+        LD2450::last_frame_wire_time = frame.wire_time;
+        return frame.count;
+    }
+#endif
+
     if (LD2450::radar_uart->available())
     {   
         
@@ -107,10 +605,37 @@ uint8_t LD2450::read()
         // IF WE GOT DATA PARSE THEM
         if (len > 0)
         {
-            return LD2450::ProcessSerialDataIntoRadarData(rec_buf, len);
+            uint32_t frames = LD2450::stats.frames;
+            uint8_t targets = LD2450::ProcessSerialDataIntoRadarData(rec_buf, len);
+            if (LD2450::stats.frames != frames)
+            {
+                return targets;
+            }
         }
     }
-    return -1;
+    return LD2450_READ_NO_FRAME;
+}
+
+void LD2450::flush()
+{
+    if (LD2450::radar_uart == nullptr)
+    {
+        return;
+    }
+#ifdef ESP32
+    if (LD2450::frame_queue != NULL)
+    {
+        // The parser belongs to the UART event task, which resets it when
+        // the next bytes arrive
+        LD2450::rx_reset.store(true);
+        xQueueReset(LD2450::frame_queue);
+        return;
+    }
+#endif
+    while (LD2450::radar_uart->available() > 0)
+    {
+        LD2450::radar_uart->read();
+    }
 }
 
 uint16_t LD2450::getSensorSupportedTargetCount(){
@@ -121,6 +646,11 @@ uint16_t LD2450::getSensorSupportedTargetCount(){
     return LD2450_MAX_SENSOR_TARGETS;
 }
 
+const LD2450::Stats &LD2450::getStats() const
+{
+    return LD2450::stats;
+}
+
 LD2450::RadarTarget LD2450::getTarget(uint16_t _target_id){
     if (_target_id >= LD2450_MAX_SENSOR_TARGETS){
         LD2450::RadarTarget tmp;
@@ -129,90 +659,216 @@ LD2450::RadarTarget LD2450::getTarget(uint16_t _target_id){
     }
     return LD2450::radarTargets[_target_id];
 }
-uint8_t LD2450::ProcessSerialDataIntoRadarData(byte rec_buf[], int len)
+// Decodes the targets of a frame that starts with the header and ends with
+// the footer; targets past numTargets are marked invalid
+uint8_t LD2450::decodeFrame(const byte *frame, RadarTarget_t *targets)
 {
     uint8_t redreshed_targets = 0;
+    int index = 4; // Skip header and in-frame data length fields
 
-    for (int i = 0; i < len; i++)
+    for (uint16_t targetCounter = 0; targetCounter < LD2450_MAX_SENSOR_TARGETS; targetCounter++)
     {
-        // Checking the header and footer
-        if (rec_buf[i] == 0xAA && rec_buf[i + 1] == 0xFF && rec_buf[i + 2] == 0x03 && rec_buf[i + 3] == 0x00 && rec_buf[i + 28] == 0x55 && rec_buf[i + 29] == 0xCC)
+        if (redreshed_targets >= LD2450::numTargets)
         {
+            //SKIP IF USER ONLY REQUESTED X VALID TARGETS
+            targets[targetCounter].valid = false;
+            continue;
+        }
 
-            int index = i + 4; // Skip header and in-frame data length fields
-            LD2450::last_target_data = "";
+        LD2450::RadarTarget target;
+        target.x = (int16_t)(frame[index] | (frame[index + 1] << 8));
+        target.y = (int16_t)(frame[index + 2] | (frame[index + 3] << 8));
+        target.speed = (int16_t)(frame[index + 4] | (frame[index + 5] << 8));
+        target.resolution = (uint16_t)(frame[index + 6] | (frame[index + 7] << 8));
+
+        // Check the highest bit of x and y. Adjust the sign
+        if (frame[index + 1] & 0x80)
+            target.x -= 0x8000;
+        else
+            target.x = -target.x;
+        if (frame[index + 3] & 0x80)
+            target.y -= 0x8000;
+        else
+            target.y = -target.y;
+        if (frame[index + 5] & 0x80)
+            target.speed -= 0x8000;
+        else
+            target.speed = -target.speed;
+
+        //CALCULATE DISTANCE
+        target.distance = sqrt(pow(target.x, 2) +  pow(target.y, 2));
+
+        // IF A RESOLUTION IS PRESENT THEN WE CAN ASSUME THAT A TARGET WAS FOUND
+        target.valid = target.resolution != 0;
+
+        targets[targetCounter].id = targetCounter + 1;
+        targets[targetCounter].x = target.x;
+        targets[targetCounter].y = target.y;
+        targets[targetCounter].speed = target.speed;
+        targets[targetCounter].resolution = target.resolution;
+        targets[targetCounter].distance = target.distance;
+        targets[targetCounter].valid = target.valid;
+
+        index += 8; // Move to the start of the next target data
+        redreshed_targets++;
+    }
+    return redreshed_targets;
+}
 
-            for (uint16_t targetCounter = 0; targetCounter < LD2450_MAX_SENSOR_TARGETS; targetCounter++)
-            {
+// Takes one byte off the UART. Says what the byte completed, if anything,
+// and fills frame or ack with it.
+LD2450::Parsed LD2450::feed(byte value, Frame_t &frame, Ack_t &ack)
+{
+    static const byte report_header[4] = {0xAA, 0xFF, 0x03, 0x00};
+    static const byte ack_header[4] = {0xFD, 0xFC, 0xFB, 0xFA};
+
+    if (LD2450::rx_length == 0)
+    {
+        LD2450::rx_ack = value == ack_header[0];
+    }
+    const byte *header = LD2450::rx_ack ? ack_header : report_header;
+    if (LD2450::rx_length < 4 && value != header[LD2450::rx_length])
+    {
+        // Not a header after all, the byte may still start the next one
+        LD2450::stats.skipped += LD2450::rx_length;
+        LD2450::rx_length = 0;
+        LD2450::rx_skipping = true;
+        if (value != report_header[0] && value != ack_header[0])
+        {
+            LD2450::stats.skipped++;
+            return PARSED_NOTHING;
+        }
+        LD2450::rx_ack = value == ack_header[0];
+    }
+    if (LD2450::rx_length == 0)
+    {
+        LD2450::rx_start = LD2450::rx_handover - LD2450::rx_behind;
+    }
+    LD2450::rx_frame[LD2450::rx_length++] = value;
+    if (LD2450::rx_ack)
+    {
+        return LD2450::feedAck(frame, ack);
+    }
+    if (LD2450::rx_length < LD2450_FRAME_SIZE)
+    {
+        return PARSED_NOTHING;
+    }
+
+    if (LD2450::rx_frame[28] != 0x55 || LD2450::rx_frame[29] != 0xCC)
+    {
+        // Corrupted or cut off
+        LD2450::stats.dropped++;
+        return LD2450::replay(frame, ack);
+    }
+
+    LD2450::rx_length = 0;
+    if (LD2450::rx_skipping)
+    {
+        LD2450::stats.resyncs++;
+        LD2450::rx_skipping = false;
+    }
+    LD2450::stats.frames++;
+    frame.time = micros();
+    frame.wire_time = LD2450::rx_handover - LD2450::rx_behind - LD2450::rx_start;
+    frame.count = LD2450::decodeFrame(LD2450::rx_frame, frame.targets);
+    return PARSED_REPORT;
+}
+
+// The bytes after the command header: length, command word, status word,
+// data and footer
+LD2450::Parsed LD2450::feedAck(Frame_t &frame, Ack_t &ack)
+{
+    if (LD2450::rx_length < 6)
+    {
+        return PARSED_NOTHING;
+    }
+    uint16_t length = LD2450::rx_frame[4] | (LD2450::rx_frame[5] << 8);
+    if (length < 4 || length > 4 + LD2450_ACK_DATA_MAX)
+    {
+        // No ACK this parser can take
+        LD2450::stats.dropped++;
+        return LD2450::replay(frame, ack);
+    }
+    if (LD2450::rx_length < 10 + length)
+    {
+        return PARSED_NOTHING;
+    }
 
-                
-                
-                if (index + 7 < len)
-                {
-                    LD2450::RadarTarget target;
-                    target.x = (int16_t)(rec_buf[index] | (rec_buf[index + 1] << 8));
-                    target.y = (int16_t)(rec_buf[index + 2] | (rec_buf[index + 3] << 8));
-                    target.speed = (int16_t)(rec_buf[index + 4] | (rec_buf[index + 5] << 8));
-                    target.resolution = (uint16_t)(rec_buf[index + 6] | (rec_buf[index + 7] << 8));
-
-                    // debug_serial.println(target.x);
-                    // debug_serial.println(target.y);
-                    // debug_serial.println(target.speed);
-
-                    // Check the highest bit of x and y. Adjust the sign
-                    if (rec_buf[index + 1] & 0x80)
-                        target.x -= 0x8000;
-                    else
-                        target.x = -target.x;
-                    if (rec_buf[index + 3] & 0x80)
-                        target.y -= 0x8000;
-                    else
-                        target.y = -target.y;
-                    if (rec_buf[index + 5] & 0x80)
-                        target.speed -= 0x8000;
-                    else
-                        target.speed = -target.speed;
-
-
-                    //CALCULATE DISTANCE
-                    target.distance = sqrt(pow(target.x, 2) +  pow(target.y, 2));
-
-                    // IF A RESOLUTION IS PRESENT THEN WE CAN ASSUME THAT A TARGET WAS FOUND
-                    if(target.resolution != 0){
-                        target.valid = true;
-                    }else{
-                       target.valid = false;
-                    }
-
-
-                    LD2450::radarTargets[targetCounter].id = targetCounter + 1;
-                    LD2450::radarTargets[targetCounter].x = target.x;
-                    LD2450::radarTargets[targetCounter].y = target.y;
-                    LD2450::radarTargets[targetCounter].speed = target.speed;
-                    LD2450::radarTargets[targetCounter].resolution = target.resolution;
-                    LD2450::radarTargets[targetCounter].valid = target.valid;
-
-                    
-
-                    // Add target information to the string
-                    LD2450::last_target_data += "TARGET ID=" + String(targetCounter + 1) + " X=" + String(target.x) + "mm, Y=" + String(target.y) + "mm, SPEED=" + String(target.speed) + "cm/s, RESOLUTION=" + String(target.resolution) + "mm, DISTANCE=" + String(target.distance) + "mm, VALID=" + String(target.valid) + "\n";
-
-                    index += 8; // Move to the start of the next target data
-
-                    redreshed_targets++;
-
-                    //SKIP IF USER ONLY REQUESTED X VALID TARGETS
-                    if(redreshed_targets >= LD2450::numTargets){
-                        break;
-                    }
-                }else{
-                    LD2450::radarTargets[targetCounter].valid = false;
-                }
-                
+    const byte *footer = LD2450::rx_frame + 6 + length;
+    if (footer[0] != 0x04 || footer[1] != 0x03 || footer[2] != 0x02 || footer[3] != 0x01)
+    {
+        LD2450::stats.dropped++;
+        return LD2450::replay(frame, ack);
+    }
 
+    LD2450::rx_length = 0;
+    if (LD2450::rx_skipping)
+    {
+        LD2450::stats.resyncs++;
+        LD2450::rx_skipping = false;
+    }
+    LD2450::stats.acks++;
+    ack.command = LD2450::rx_frame[6] | (LD2450::rx_frame[7] << 8);
+    ack.status = LD2450::rx_frame[8] | (LD2450::rx_frame[9] << 8);
+    ack.length = length - 4;
+    memcpy(ack.data, LD2450::rx_frame + 10, ack.length);
+    return PARSED_ACK;
+}
 
+// Drops the frame in rx_frame and looks for a header in what came after its
+// first byte, as the buffer parser does. Fewer than two frames fit in what
+// is fed again; should two short ACKs, only the second is kept.
+LD2450::Parsed LD2450::replay(Frame_t &frame, Ack_t &ack)
+{
+    LD2450::stats.skipped++;
+    LD2450::rx_skipping = true;
+    byte rest[LD2450_COMMAND_FRAME_MAX - 1];
+    uint8_t length = LD2450::rx_length - 1;
+    memcpy(rest, LD2450::rx_frame + 1, length);
+    LD2450::rx_length = 0;
+
+    Parsed parsed = PARSED_NOTHING;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        Parsed found = LD2450::feed(rest[i], frame, ack);
+        if (found != PARSED_NOTHING)
+        {
+            parsed = found;
+        }
+    }
+    return parsed;
+}
+
+uint8_t LD2450::ProcessSerialDataIntoRadarData(byte rec_buf[], int len)
+{
+    uint8_t redreshed_targets = 0;
+    bool skipping = false;
+
+    for (int i = 0; i < len; i++)
+    {
+        // Checking the header and footer
+        bool header = i + 3 < len && rec_buf[i] == 0xAA && rec_buf[i + 1] == 0xFF && rec_buf[i + 2] == 0x03 && rec_buf[i + 3] == 0x00;
+        bool footer = header && i + 29 < len && rec_buf[i + 28] == 0x55 && rec_buf[i + 29] == 0xCC;
+        if (!footer)
+        {
+            // Not the start of a frame, or a frame that was cut off or corrupted
+            if (header)
+            {
+                LD2450::stats.dropped++;
+            }
+            LD2450::stats.skipped++;
+            skipping = true;
+        }
+        else
+        {
+            if (skipping)
+            {
+                LD2450::stats.resyncs++;
+                skipping = false;
             }
-            i = index; // Updating the index of an external loop
+            LD2450::stats.frames++;
+            redreshed_targets = LD2450::decodeFrame(rec_buf + i, LD2450::radarTargets);
+            i += LD2450_FRAME_SIZE - 1; // Continue after the footer
         }
     }
     return redreshed_targets;
@@ -30,6 +30,86 @@
 #define LD2450_SERIAL_BUFFER 256
 #define LD2450_SERIAL_SPEED 256000
 #define LD2450_DEFAULT_RETRY_COUNT_FOR_WAIT_FOR_MSG 1000
+#define LD2450_FRAME_SIZE 30
+
+// What read() returns when it has no frame: a count of targets is >= 0
+#define LD2450_READ_NO_FRAME -1    // no complete frame arrived, try again
+#define LD2450_READ_NOT_STARTED -2 // begin() was not called
+
+// Command protocol: FD FC FB FA, a little endian length, the command word and
+// its value, 04 03 02 01. The sensor answers with the command word | 0x0100,
+// a status word (0 for success) and the data asked for.
+#define LD2450_CMD_ENABLE_CONFIG 0x00FF
+#define LD2450_CMD_END_CONFIG 0x00FE
+#define LD2450_CMD_SINGLE_TARGET 0x0080
+#define LD2450_CMD_MULTI_TARGET 0x0090
+#define LD2450_CMD_QUERY_TRACKING 0x0091
+#define LD2450_CMD_FIRMWARE_VERSION 0x00A0
+#define LD2450_CMD_SET_BAUD_RATE 0x00A1
+#define LD2450_CMD_FACTORY_RESET 0x00A2
+#define LD2450_CMD_RESTART 0x00A3
+#define LD2450_CMD_MAC_ADDRESS 0x00A5
+#define LD2450_CMD_QUERY_REGIONS 0x00C1
+#define LD2450_CMD_SET_REGIONS 0x00C2
+#define LD2450_ACK_FLAG 0x0100
+
+// Region filter: up to three rectangles given by two opposite corners, in
+// the coordinates of the report frames
+#define LD2450_MAX_REGIONS 3
+#define LD2450_REGIONS_OFF 0
+#define LD2450_REGIONS_ONLY_INSIDE 1 // targets outside every region are not reported
+#define LD2450_REGIONS_EXCLUDE 2     // targets inside a region are not reported
+
+#define LD2450_COMMAND_VALUE_MAX 26 // bytes after the command word, setting the regions needs the most
+#define LD2450_ACK_DATA_MAX 26      // bytes after the status word, the region query answers the most
+#define LD2450_COMMAND_FRAME_MAX (4 + 2 + 4 + LD2450_ACK_DATA_MAX + 4)
+
+// What a command ended with, handed to the CommandCallback
+#define LD2450_COMMAND_OK 0
+#define LD2450_COMMAND_FAILED -1  // the sensor answered with a bad status
+#define LD2450_COMMAND_TIMEOUT -2 // no answer within LD2450_ACK_TIMEOUT
+#define LD2450_COMMAND_ABORTED -3 // not sent because an earlier command of its session failed
+
+// Handed to the CommandCallback instead of a command when switchBaudRate()
+// is done
+#define LD2450_BAUD_SWITCHED 0xFFFF
+
+#ifdef ESP32
+#include "freertos/queue.h"
+#include <atomic>
+
+// Event driven reception: the UART driver hands the bytes over once the RX
+// FIFO holds a frame's worth or the line has been idle for a few symbols,
+// whichever comes first, so a frame is parsed right after its footer.
+#ifndef LD2450_RX_FIFO_FULL
+#define LD2450_RX_FIFO_FULL LD2450_FRAME_SIZE
+#endif
+#ifndef LD2450_RX_TIMEOUT
+#define LD2450_RX_TIMEOUT 2 // symbols, about 80us at 256000 baud
+#endif
+#ifndef LD2450_FRAME_QUEUE
+#define LD2450_FRAME_QUEUE 4 // decoded frames waiting for read()
+#endif
+#ifndef LD2450_READ_TIMEOUT
+#define LD2450_READ_TIMEOUT 50 // ms read() waits for a frame
+#endif
+#ifndef LD2450_COMMAND_QUEUE
+#define LD2450_COMMAND_QUEUE 12 // commands waiting to be sent, a session takes three
+#endif
+#ifndef LD2450_ACK_TIMEOUT
+#define LD2450_ACK_TIMEOUT 200 // ms to wait for the answer to a command
+#endif
+#ifndef LD2450_COMMAND_POLL
+#define LD2450_COMMAND_POLL 2 // ms read() waits for a frame while a command is out
+#endif
+#ifndef LD2450_BAUD_VERIFY
+#define LD2450_BAUD_VERIFY 3000 // ms to wait for a frame after changing the baud rate, the sensor restarts in between
+#endif
+
+// Tracing: when the application defines this it is called from the UART
+// event task with micros() when bytes were handed over and how many
+void ld2450_receive_hook(uint32_t time, size_t bytes) __attribute__((weak));
+#endif
 
 
 
@@ -50,6 +130,38 @@ public:
         bool valid;
     } RadarTarget_t;
 
+    typedef struct Stats
+    {
+        uint32_t frames;  // frames decoded
+        uint32_t dropped; // frames with a header but a bad footer or cut off
+        uint32_t resyncs; // times bytes had to be skipped to reach a header
+        uint32_t skipped; // bytes skipped while looking for a header
+        uint32_t overruns; // decoded frames thrown away because read() fell behind
+        uint32_t acks;     // command ACK frames parsed
+    } Stats_t;
+
+    // What the sensor told about itself, filled in as the ACKs arrive
+    typedef struct SensorInfo
+    {
+        bool firmware_valid;
+        uint16_t firmware_type;
+        uint16_t firmware_major; // V<high byte>.<low byte>
+        uint32_t firmware_minor; // printed as 8 hex digits
+        bool mac_valid;
+        uint8_t mac[6];
+        bool tracking_valid;
+        bool multi_target;
+        bool regions_valid;
+        uint8_t region_type; // LD2450_REGIONS_*
+        struct
+        {
+            int16_t x1, y1, x2, y2; // mm
+        } regions[LD2450_MAX_REGIONS];
+    } SensorInfo_t;
+
+    // command is the LD2450_CMD_* that ended, result an LD2450_COMMAND_*
+    typedef void (*CommandCallback)(uint16_t command, int result);
+
     LD2450();
     // Constructor function
     ~LD2450();
@@ -61,20 +173,176 @@ public:
     void begin(SoftwareSerial &radarStream, bool already_initialized = false);
 #endif
 
+#ifdef ESP32
+    // Parses the bytes in the UART driver's event task as they arrive; read()
+    // then waits up to LD2450_READ_TIMEOUT for the next frame instead of
+    // polling the UART. Returns false when the frame queue cannot be created.
+    bool beginEventDriven(HardwareSerial &radarStream, bool already_initialized = false);
+    // micros() when the frame read() returned last was complete
+    uint32_t getLastFrameTime() const;
+    // micros() from the first byte of that frame to the last on the wire.
+    // The time a byte arrived is taken back from its handover by the bytes
+    // behind it at the current baud rate. With the default RX FIFO threshold
+    // the driver hands a whole frame over at once, so this is only the baud
+    // rate's figure; setWireTiming() makes it a measurement.
+    uint32_t getLastFrameWireTime() const;
+    // Lowers the RX FIFO threshold to one byte, so every byte is handed over
+    // as it arrives and getLastFrameWireTime() comes from the handovers.
+    // Costs a UART event per byte. Also kept by a later beginEventDriven().
+    void setWireTiming(bool on);
+
+    // Configuration commands, they need beginEventDriven(). Each queues a
+    // session that enables the configuration mode, sends the command and
+    // ends the mode again, and returns false when the queue has no room.
+    // read() sends the commands and matches the ACKs without blocking;
+    // report frames keep being parsed around them.
+    bool setTrackingMode(bool multi_target);
+    bool requestTrackingMode();
+    bool requestFirmwareVersion();
+    bool requestMacAddress();
+    // Takes effect after restart(). False for a rate the sensor cannot do.
+    bool setBaudRate(uint32_t baud);
+    // Sets the sensor's baud rate, restarts it and reopens the UART at the
+    // new rate. When no frame arrives within LD2450_BAUD_VERIFY the UART goes
+    // back to the old rate. The UART is switched even when the restart is not
+    // answered, the sensor may be at the new rate already; when the rate is
+    // refused the restart is skipped and the configuration mode ended. The
+    // CommandCallback then gets LD2450_BAUD_SWITCHED with LD2450_COMMAND_OK
+    // for frames at the new rate, LD2450_COMMAND_FAILED for frames at the old
+    // one only or no restart and LD2450_COMMAND_TIMEOUT for none at either.
+    // False while other commands are queued or a switch is under way.
+    bool switchBaudRate(uint32_t baud);
+    // What the UART runs at
+    uint32_t getBaudRate() const;
+    // One of the rates setBaudRate() and switchBaudRate() take
+    static bool isSupportedBaudRate(uint32_t baud);
+    bool factoryReset();
+    bool restart();
+    // Sends END_CONFIG on its own, for a sensor that may have been left in
+    // the configuration mode, where it reports no frames
+    bool endConfigMode();
+    // type is an LD2450_REGIONS_*; the sensor keeps the regions over a restart
+    bool setRegions(uint8_t type, const int16_t regions[LD2450_MAX_REGIONS][4]);
+    bool requestRegions();
+    // Called from read() for every command that ended
+    void onCommandResult(CommandCallback callback);
+    // Commands are queued or waiting for their ACK, or a new baud rate is
+    // being tried
+    bool isConfiguring() const;
+    const SensorInfo &getSensorInfo() const;
+#endif
     bool waitForSensorMessage(bool wait_forever = false);
     void setNumberOfTargets(uint16_t _numTargets);
     uint8_t ProcessSerialDataIntoRadarData(byte rec_buf[], int len);
     RadarTarget getTarget(uint16_t _target_id);
     uint16_t getSensorSupportedTargetCount();
     String getLastTargetMessage();
-    uint8_t read();
+    // Targets refreshed by the next frame, or LD2450_READ_NO_FRAME or
+    // LD2450_READ_NOT_STARTED
+    int read();
+    // Throws away frames not read yet and any partial frame, the parser
+    // then waits for the next header
+    void flush();
+    const Stats &getStats() const;
 
 protected:
 
 private:
+    typedef struct Frame
+    {
+        uint32_t time;      // micros() when the footer was parsed
+        uint32_t wire_time; // micros() from the first byte on the wire to the last
+        uint8_t count;
+        RadarTarget_t targets[LD2450_MAX_SENSOR_TARGETS];
+    } Frame_t;
+
+    typedef struct Ack
+    {
+        uint16_t command; // with LD2450_ACK_FLAG
+        uint16_t status;
+        uint8_t length;
+        byte data[LD2450_ACK_DATA_MAX];
+    } Ack_t;
+
+    // What feed() completed
+    enum Parsed : uint8_t
+    {
+        PARSED_NOTHING,
+        PARSED_REPORT,
+        PARSED_ACK,
+    };
+
+    uint8_t decodeFrame(const byte *frame, RadarTarget_t *targets);
+    Parsed feed(byte value, Frame_t &frame, Ack_t &ack);
+    Parsed feedAck(Frame_t &frame, Ack_t &ack);
+    Parsed replay(Frame_t &frame, Ack_t &ack);
+
     Stream *radar_uart = nullptr;
     RadarTarget_t radarTargets[LD2450_MAX_SENSOR_TARGETS]; // Stores the target of the current frame
     uint16_t numTargets = LD2450_MAX_SENSOR_TARGETS;
-    String last_target_data = "";
+    Stats_t stats = {};
+
+    // Incremental parser state, only touched by feed()
+    byte rx_frame[LD2450_COMMAND_FRAME_MAX];
+    uint8_t rx_length = 0;
+    bool rx_skipping = false;
+    bool rx_ack = false; // rx_frame started with the command header
+    uint32_t rx_handover = 0; // micros() the bytes being fed were handed over
+    uint32_t rx_behind = 0;   // micros() the byte being fed arrived before rx_handover
+    uint32_t rx_start = 0;    // when rx_frame[0] arrived
+
+#ifdef ESP32
+    void onUartReceive();
+
+    typedef struct Command
+    {
+        uint16_t command;
+        uint8_t length;
+        byte value[LD2450_COMMAND_VALUE_MAX];
+    } Command_t;
+
+    bool queueSession(uint16_t command, const byte *value = nullptr, uint8_t length = 0, bool end_config = true);
+    void queueCommand(uint16_t command, const byte *value, uint8_t length);
+    void processCommands();
+    void finishCommand(int result);
+    void takeAck(const Ack_t &ack);
+    void decodeRegions(const byte *data);
+    void commandEnded(uint16_t command, int result);
+    void reopenUart(uint32_t baud);
+    void checkBaudRate();
+    static uint8_t baudRateIndex(uint32_t baud);
+
+    enum BaudState : uint8_t
+    {
+        BAUD_IDLE,
+        BAUD_COMMANDS,   // switchBaudRate() commands queued
+        BAUD_REFUSED,    // the sensor refused one of them, the restart is skipped
+        BAUD_VERIFY_NEW, // waiting for a frame at the new rate
+        BAUD_VERIFY_OLD, // none came, waiting for one at the old rate again
+    };
+
+    QueueHandle_t frame_queue = NULL;
+    QueueHandle_t ack_queue = NULL;
+    std::atomic<bool> rx_reset{false}; // set by flush(), handled in the UART event task
+    uint32_t last_frame_time = 0;
+    uint32_t last_frame_wire_time = 0;
+    bool wire_timing = false;
+    HardwareSerial *radar_serial = nullptr;
+    uint32_t serial_speed = LD2450_SERIAL_SPEED;
+
+    // Only touched by the task that calls read() and the command methods
+    Command_t commands[LD2450_COMMAND_QUEUE];
+    uint8_t command_head = 0;
+    uint8_t command_count = 0;
+    bool command_sent = false; // commands[command_head] waits for its ACK
+    uint32_t command_time = 0; // millis() it was sent
+    CommandCallback command_callback = nullptr;
+    SensorInfo_t sensor_info = {};
+    BaudState baud_state = BAUD_IDLE;
+    uint32_t baud_previous = 0;
+    uint32_t baud_target = 0;
+    uint32_t baud_frames = 0;   // stats.frames when the UART was switched
+    uint32_t baud_deadline = 0; // millis()
+#endif
 };
 #endif
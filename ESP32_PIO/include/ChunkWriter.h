@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Longest line a chunked endpoint writes
+#define CHUNK_LINE_MAX 160
+
+// The end of a line that did not fit into the previous chunk
+struct ChunkCarry
+{
+  char text[CHUNK_LINE_MAX];
+  size_t length;
+  size_t offset;
+};
+
+// Fills one chunk of a chunked response with whole lines. A line that does
+// not fit is cut and its end goes out first in the next chunk, so the
+// producer never has to hold more than the line it is writing.
+class ChunkWriter
+{
+public:
+  // Starts with whatever was carried over from the previous chunk
+  ChunkWriter(ChunkCarry &carry, uint8_t *out, size_t space);
+
+  // Takes the whole line even if only part of it fits
+  void write(const char *text, size_t length);
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  void vprintf(const char *format, va_list args);
+
+  // Once full, nothing else should be written into this chunk
+  bool full() const { return _length == _space; }
+  size_t length() const { return _length; }
+
+private:
+  ChunkCarry &_carry;
+  uint8_t *_out;
+  size_t _space;
+  size_t _length;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Bump allocator for ArduinoJson documents. Memory comes from a fixed buffer
+// and is handed back all at once, so parsing or building a document never
+// touches the heap. Only the block allocated last can be freed or resized in
+// place, which matches how ArduinoJson grows strings and shrinks its pools.
+// When the last live block is freed, typically because the document went out
+// of scope, the arena starts over from the beginning.
+//
+// An arena is not thread safe; give each task its own.
+class JsonArena : public ArduinoJson::Allocator
+{
+public:
+  JsonArena(const char *name, uint8_t *buffer, size_t size);
+
+  void *allocate(size_t size) override;
+  void deallocate(void *ptr) override;
+  void *reallocate(void *ptr, size_t newSize) override;
+
+  // Releases everything; documents using the arena must be gone by then
+  void reset();
+
+  const char *name() const { return _name; }
+  size_t used() const { return _used; }
+  size_t peak() const { return _peak; }
+  size_t capacity() const { return _size; }
+  uint32_t failures() const { return _failures; }
+
+  // Logs one line per arena with its peak usage
+  static void logStats();
+
+  // Walks all arenas: for (JsonArena *a = JsonArena::first(); a; a = a->next())
+  static JsonArena *first();
+  JsonArena *next() const { return _next; }
+
+private:
+  const char *_name;
+  uint8_t *_buffer;
+  size_t _size;
+  size_t _used;
+  size_t _last;   // offset of the most recent block, or _size if none
+  size_t _blocks; // blocks not yet freed
+  size_t _peak;
+  uint32_t _failures;
+  JsonArena *_next;
+};
+
+template <size_t N>
+class StaticJsonArena : public JsonArena
+{
+public:
+  explicit StaticJsonArena(const char *name) : JsonArena(name, _storage, N) {}
+
+private:
+  alignas(8) uint8_t _storage[N];
+};
+
+// Sizes include the first 1 KB variant pool ArduinoJson allocates per document
+#ifndef JSON_LOOP_ARENA_SIZE
+#define JSON_LOOP_ARENA_SIZE 2048
+#endif
+
+#ifndef JSON_WEB_ARENA_SIZE
+#define JSON_WEB_ARENA_SIZE 4096
+#endif
+
+// Arena for documents built in loop()
+extern JsonArena &loopJsonArena;
+
+// Arena for documents built in web server and WebSocket callbacks, which all
+// run on the async_tcp task
+extern JsonArena &webJsonArena;
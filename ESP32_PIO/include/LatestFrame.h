@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LD2450.h>
+
+// One target of a frame, as sent to WebSocket clients
+struct TargetSample
+{
+  int16_t x, y, speed;
+  uint16_t resolution, distance;
+  uint8_t zones; // bit n set when the target is in zone n + 1
+};
+
+struct TargetFrame
+{
+  uint32_t time; // millis() when the frame was read
+  uint8_t count;
+  TargetSample targets[LD2450_MAX_SENSOR_TARGETS];
+};
+
+// The most recent frame, written by loop() and readable from any task. The
+// copy of a few dozen bytes is made in a critical section: a reader that
+// waited for the writer instead could preempt it on the same core, spin
+// forever and trip the watchdog.
+void latestFrameStore(const TargetFrame &frame);
+
+// Copies the most recent frame. Returns false before the first one.
+bool latestFrameLoad(TargetFrame &out);
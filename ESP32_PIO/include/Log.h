@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "Metrics.h"
+
+// Logging that never waits for the UART. A record is the format string's
+// address and up to LOG_MAX_ARGS argument words, copied into a ring of
+// LOG_RING_RECORDS; a low priority task formats the records and writes them
+// to Serial, and GET /logs formats whatever is still in the ring. Nothing is
+// formatted on the caller's side.
+//
+// Arguments are integers or string literals: only the pointer of a %s
+// argument is kept, so the text must still be there when the record is
+// printed. Records that arrive faster than the ring is drained overwrite
+// the oldest ones, which are then reported as lost.
+//
+// Each category has a level, records above it are dropped right away, and
+// a token bucket that limits how many records per second it may add.
+#ifndef LOG_RING_RECORDS
+#define LOG_RING_RECORDS 128
+#endif
+#define LOG_MAX_ARGS 7
+
+enum LogCategory : uint8_t
+{
+  LOG_SENSOR,
+  LOG_ZONES,
+  LOG_WEB,
+  LOG_WIFI,
+  LOG_SYSTEM,
+  LOG_CATEGORY_COUNT
+};
+
+enum LogLevel : uint8_t
+{
+  LOG_ERROR,
+  LOG_WARN,
+  LOG_INFO,
+  LOG_DEBUG
+};
+
+// Starts the task that writes the records to Serial. Records logged before
+// are kept in the ring.
+void logBegin();
+
+// Records above level are dropped, LOG_INFO by default
+void logSetLevel(LogCategory category, LogLevel level);
+// At most perSecond records on average and burst at once, 0 for no limit
+void logSetRate(LogCategory category, uint16_t perSecond, uint16_t burst);
+
+void logWrite(LogCategory category, LogLevel level, const char *format, const uintptr_t *args, uint8_t count);
+
+// logPrint(LOG_SENSOR, LOG_DEBUG, "TARGET ID=%d X=%dmm", id, x), no newline
+template <typename... Args>
+inline void logPrint(LogCategory category, LogLevel level, const char *format, Args... args)
+{
+  static_assert(sizeof...(args) <= LOG_MAX_ARGS, "Too many log arguments");
+  const uintptr_t words[] = {0, (uintptr_t)args...};
+  logWrite(category, level, format, words + 1, sizeof...(args));
+}
+
+// GET /logs: the records still in the ring as text, oldest first
+void onLogsRequest(AsyncWebServerRequest *request);
+
+// Metrics source: records written, dropped by the rate limits and lost
+void logWriteMetrics(MetricsWriter &out);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "ChunkWriter.h"
+#include <atomic>
+
+// Counters and latency histograms served by GET /metrics in the Prometheus
+// text format. Updating one is a relaxed atomic add to a slot owned by the
+// calling core, so the cores never contend and nothing takes a lock; the
+// slots are summed when /metrics is rendered.
+//
+// Metrics must be globals or statics so their slots start at zero.
+class MetricCounter
+{
+public:
+  void inc(uint32_t n = 1)
+  {
+    _cores[xPortGetCoreID()].fetch_add(n, std::memory_order_relaxed);
+  }
+  uint32_t value() const;
+
+private:
+  std::atomic<uint32_t> _cores[portNUM_PROCESSORS];
+};
+
+// Buckets from 100 us to 1 s plus +Inf
+#define METRIC_HISTOGRAM_BUCKETS 12
+
+class MetricHistogram
+{
+public:
+  void observe(uint32_t micros);
+
+  // Upper bound of bucket i in microseconds
+  static uint32_t bound(size_t i);
+  // Observations that fell in bucket i, i == METRIC_HISTOGRAM_BUCKETS for +Inf
+  uint32_t bucket(size_t i) const;
+  uint64_t sum() const; // microseconds
+
+private:
+  struct Core
+  {
+    std::atomic<uint32_t> buckets[METRIC_HISTOGRAM_BUCKETS + 1];
+    std::atomic<uint32_t> sumLow;
+    std::atomic<uint32_t> sumHigh;
+  };
+  Core _cores[portNUM_PROCESSORS];
+};
+
+struct MetricsCursor;
+
+// Writes metrics one line at a time into the response. Every chunk runs all
+// sources again and only formats the lines not sent yet, so a source has to
+// emit the same lines in the same order every time it runs.
+class MetricsWriter
+{
+public:
+  // # HELP and # TYPE lines; type is counter, gauge or histogram
+  void family(const char *name, const char *type, const char *help);
+  // name{labels} value, labels like zone="1" or NULL
+  void sample(const char *name, const char *labels, uint32_t value);
+
+  void counter(const char *name, const char *help, uint32_t value);
+  void gauge(const char *name, const char *help, uint32_t value);
+  // In seconds, as Prometheus expects
+  void histogram(const char *name, const char *help, const MetricHistogram &histogram);
+
+  bool full() const { return _chunk.full(); }
+
+private:
+  friend size_t metricsFill(MetricsCursor &cursor, uint8_t *buffer, size_t maxLen);
+  MetricsWriter(MetricsCursor &cursor, ChunkWriter &chunk);
+
+  void _line(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  MetricsCursor &_cursor;
+  ChunkWriter &_chunk;
+  size_t _index; // lines emitted by the sources so far, sent or not
+};
+
+// Adds metrics to every /metrics response. Returns false when all
+// METRICS_MAX_SOURCES are taken.
+#ifndef METRICS_MAX_SOURCES
+#define METRICS_MAX_SOURCES 8
+#endif
+typedef void (*MetricsSource)(MetricsWriter &out);
+bool metricsAddSource(MetricsSource source);
+
+// GET /metrics: heap, AsyncTCP and JSON arena metrics plus every source,
+// streamed as a chunked response
+void onMetricsRequest(AsyncWebServerRequest *request);
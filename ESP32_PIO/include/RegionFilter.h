@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LD2450.h>
+#include "Metrics.h"
+
+// Lets the sensor drop targets outside the zones itself, so they are never
+// decoded, tested or published. Set SENSOR_REGION_FILTER to 1 in build_flags
+// to program the zones as the sensor's "only inside" regions; they are
+// programmed again whenever the zone generation changes, at most once per
+// REGION_FILTER_INTERVAL so dragging a zone does not keep the sensor in its
+// configuration mode. With the filter on, targets outside every zone no
+// longer show up in the web interface.
+//
+// With 0 the sensor's regions are left as they are, so a filter programmed
+// before stays in the sensor until it is turned off there.
+#ifndef SENSOR_REGION_FILTER
+#define SENSOR_REGION_FILTER 0
+#endif
+#define REGION_FILTER_INTERVAL 1000 // ms between two programmings
+#define REGION_FILTER_RETRY 5000    // ms before trying again after a failure
+
+// Call from loop(), the task that reads the sensor
+void regionFilterUpdate(LD2450 &sensor, uint32_t now);
+
+// Pass on the results of LD2450_CMD_SET_REGIONS
+void regionFilterResult(int result, uint32_t now);
+
+// Metrics source: the generation the sensor has, updates and failures
+void regionFilterWriteMetrics(MetricsWriter &out);
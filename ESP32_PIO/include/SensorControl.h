@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LD2450.h>
+#include <ESPAsyncWebServer.h>
+
+// Sensor settings that can change at runtime. POST /sensor with
+// baud=<rate> and/or tracking=single|multi only records the change;
+// loop() sends it over the LD2450 command channel, which belongs to the
+// task that reads the sensor.
+//
+// A higher baud rate shortens the time a frame spends on the wire, 30
+// bytes take 1.17 ms at 256000 and 0.65 ms at 460800. Single target
+// tracking is enough when only presence matters: the sensor then reports
+// one target and the other two are not decoded or published.
+//
+// The sensor keeps its baud rate over a restart, so SENSOR_BAUD_RATE is
+// tried at boot whatever rate it was left at; switchBaudRate() falls back
+// to the old rate when no frames come at the new one.
+#ifndef SENSOR_BAUD_RATE
+#define SENSOR_BAUD_RATE LD2450_SERIAL_SPEED
+#endif
+
+// Measures how long each frame takes on the wire, exported as
+// ld2450_frame_wire_seconds. The UART then hands every byte over on its
+// own, an event per byte instead of one per frame, so it is off unless
+// rates are being compared.
+#ifndef SENSOR_WIRE_TIMING
+#define SENSOR_WIRE_TIMING 0
+#endif
+
+// Reads the firmware version, MAC address and tracking mode and moves the
+// sensor to SENSOR_BAUD_RATE. Call once beginEventDriven() succeeded.
+void sensorControlBegin(LD2450 &sensor);
+
+// Call from loop(): sends changes asked for over HTTP and keeps what
+// GET /sensor reports up to date
+void sensorControlUpdate(LD2450 &sensor);
+
+// Pass on what the sensor answered to everything but the region commands
+void sensorControlResult(LD2450 &sensor, uint16_t command, int result);
+
+// GET /sensor: baud rate, tracking mode, firmware, MAC and regions as JSON
+void onSensorRequest(AsyncWebServerRequest *request);
+
+// POST /sensor: baud and tracking as form parameters, 202 once queued
+void onSensorUpdateRequest(AsyncWebServerRequest *request);
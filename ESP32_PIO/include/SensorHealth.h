@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Metrics.h"
+
+// Notices when the radar stops sending and decides how to get it back
+// without stalling loop(). It learns the usual time between frames; once a
+// frame is SENSOR_LATE_FACTOR intervals overdue an outage starts and the
+// receiver is flushed so the parser resyncs on the next header. Only if the
+// sensor stays silent for SENSOR_REINIT_AFTER is the UART set up again,
+// then again after twice as long each time up to SENSOR_REINIT_MAX.
+#define SENSOR_LATE_FACTOR 5
+#define SENSOR_LATE_MIN 250      // ms, however fast the frames came
+#define SENSOR_REINIT_AFTER 2000 // ms
+#define SENSOR_REINIT_MAX 30000  // ms
+
+enum SensorState : uint8_t
+{
+  SENSOR_STARTING, // no frame since boot
+  SENSOR_OK,
+  SENSOR_LATE,   // frames overdue, the receiver was flushed
+  SENSOR_SILENT, // the UART was set up again and is waited on
+};
+
+enum SensorAction : uint8_t
+{
+  SENSOR_NONE,
+  SENSOR_FLUSH,  // call LD2450::flush()
+  SENSOR_REINIT, // end the UART, begin it again and end a configuration mode
+};
+
+class SensorHealth
+{
+public:
+  // Call after every LD2450::read() with whether it returned a frame.
+  // Returns what the caller should do about the sensor.
+  SensorAction update(bool frame, uint32_t now);
+
+  SensorState state() const { return _state; }
+  // Writes the sensor_* metrics
+  void writeMetrics(MetricsWriter &out) const;
+
+private:
+  SensorState _state = SENSOR_STARTING;
+  uint32_t _lastFrame = 0;       // millis()
+  uint32_t _interval = 100;      // usual ms between frames, the LD2450 sends about 10 per second
+  uint32_t _outageStart = 0;     // millis() of the last frame before the outage
+  uint32_t _nextReinit = 0;      // millis()
+  uint32_t _reinitDelay = SENSOR_REINIT_AFTER;
+  uint32_t _outages = 0;
+  uint32_t _flushes = 0;
+  uint32_t _reinits = 0;
+  uint32_t _outageMillis = 0;    // sum over all recovered outages
+  uint32_t _lastRecovery = 0;    // ms the last outage lasted
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <AsyncWebSocket.h>
+#include "LatestFrame.h"
+#include "Metrics.h"
+
+// What a WebSocket client receives. A client that never subscribes gets the
+// target positions of every frame, which is what the UI expects.
+//
+// {"type":"subscribe","streams":["targets","presence"],"zones":[2],
+//  "fields":["position","speed"],"rate":5}
+//
+// streams: targets (positions every frame) and/or presence (a message when a
+//          zone becomes occupied or empty)
+// zones:   zone ids whose presence changes are sent, all if missing
+// fields:  what a target message carries besides its id: position, speed,
+//          resolution, distance, zones
+// rate:    most target frames per second up to 1000, 0 or missing for every frame
+#define STREAM_TARGETS 0x01
+#define STREAM_PRESENCE 0x02
+
+#define FIELD_POSITION 0x01
+#define FIELD_SPEED 0x02
+#define FIELD_RESOLUTION 0x04
+#define FIELD_DISTANCE 0x08
+#define FIELD_ZONES 0x10
+
+// Clients that can hold a subscription other than the default
+#ifndef SUBSCRIPTION_SLOTS
+#define SUBSCRIPTION_SLOTS DEFAULT_MAX_WS_CLIENTS
+#endif
+
+// Applies a subscribe message from the client. Returns false and sets
+// message when it is invalid. Runs on the web server task.
+bool subscriptionsApply(AsyncWebSocketClient *client, JsonObjectConst request, const char **message);
+
+// Frees the client's slot when it disconnects
+void subscriptionsRemove(AsyncWebSocketClient *client);
+
+// Sends each target to the clients that want this frame, with their fields.
+// Called from loop().
+void subscriptionsPublishTargets(AsyncWebSocket &ws, const TargetSample *targets, size_t count);
+
+// Sends the zones in changed whose presence flipped; bit n of occupied is zone n + 1
+void subscriptionsPublishPresence(AsyncWebSocket &ws, uint8_t occupied, uint8_t changed);
+
+// Metrics source: target frames skipped for clients that fell behind
+void subscriptionsWriteMetrics(MetricsWriter &out);
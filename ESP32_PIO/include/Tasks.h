@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// What every FreeRTOS task costs: its share of a core over the last 1, 10
+// and 60 seconds, the least stack it ever had left, its priority and the
+// core it is pinned to. Served by GET /tasks.
+//
+// tasksSample() reads the run time counters at most once per
+// TASKS_SAMPLE_INTERVAL and keeps enough of them for the three windows;
+// /tasks reports the latest sample, so it is up to one interval old.
+//
+// {"sample_interval_ms":1000,"windows_ms":[1000,10000,60000],"tasks":[
+//  {"name":"async_tcp","priority":3,"base_priority":3,"core":-1,
+//   "state":"blocked","stack_free_min":12345,"cpu":[4.2,3.9,4.0]}]}
+//
+// cpu is the percentage of one core in each window, so the tasks add up to
+// 200 including the two IDLE tasks. core is -1 for a task that may run on
+// either core. windows_ms says how long the windows really were, they are
+// shorter in the first minute.
+//
+// The task list needs configUSE_TRACE_FACILITY, without it /tasks answers
+// 501. The CPU shares also need configGENERATE_RUN_TIME_STATS and are null
+// without it.
+#ifndef TASKS_MAX
+#define TASKS_MAX 32 // more tasks than this and sampling stops
+#endif
+#define TASKS_SAMPLE_INTERVAL 1000
+
+// Called from loop()
+void tasksSample();
+
+// GET /tasks
+void onTasksRequest(AsyncWebServerRequest *request);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Where the time goes between the sensor, loop() and the WebSocket clients.
+// Every task that records gets its own ring of the last TRACE_RING_EVENTS
+// events, so recording is a few stores and never waits for another task.
+// GET /trace returns the rings in the Chrome trace format, which
+// chrome://tracing and ui.perfetto.dev open.
+//
+// Times are micros(): the cycle counters of the two cores are not in step
+// and the async_tcp task is not pinned to either of them.
+//
+// Do not record from an interrupt, it would write into the ring of the task
+// it interrupted.
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 128 // a power of two
+#endif
+#ifndef TRACE_MAX_TASKS
+#define TRACE_MAX_TASKS 4 // loop, async_tcp, the UART event task and one spare
+#endif
+
+enum TracePoint : uint8_t
+{
+  TRACE_LOOP,
+  TRACE_UART,     // instant on the UART event task, arg is the bytes handed over
+  TRACE_READ,     // waiting for a frame in LD2450::read(), arg is what it returned
+  TRACE_ZONES,
+  TRACE_PUBLISH,
+  TRACE_WS_CLEANUP,
+  TRACE_WIFI,
+  TRACE_WS_QUEUE, // arg is the client's queue length afterwards
+  TRACE_TCP_EVENT, // arg is the lwIP event
+  TRACE_TCP_WRITE, // arg is the bytes written
+  TRACE_POINT_COUNT
+};
+
+// Records point from start (micros()) until now
+void traceRecord(TracePoint point, uint32_t start, uint32_t arg = 0);
+// Records something that has no duration
+void traceInstant(TracePoint point, uint32_t arg = 0);
+
+// Records point from construction until the end of the scope
+class TraceScope
+{
+public:
+  explicit TraceScope(TracePoint point, uint32_t arg = 0) : _start(micros()), _arg(arg), _point(point) {}
+  ~TraceScope() { traceRecord(_point, _start, _arg); }
+  void setArg(uint32_t arg) { _arg = arg; }
+
+private:
+  uint32_t _start;
+  uint32_t _arg;
+  TracePoint _point;
+};
+
+// GET /trace: every ring as Chrome trace JSON, streamed as a chunked response
+void onTraceRequest(AsyncWebServerRequest *request);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+#define ZONE_COUNT 3
+
+// Accepted coordinate range in mm, generous around the sensor's field of view
+#define ZONE_X_LIMIT 8000
+#define ZONE_Y_LIMIT 8000
+
+// Largest POST /updateZones body that is buffered and parsed
+#ifndef ZONE_BODY_MAX_SIZE
+#define ZONE_BODY_MAX_SIZE 1024
+#endif
+
+// Define zones as rectangles with (x1, y1)LeftDownCorner and (x2, y2)RightUpCorner
+struct Zone
+{
+  int x1, y1, x2, y2;
+};
+
+// Copies the current zones, safe to call from any task. Returns the
+// generation they belong to, which changes with every zonesSet().
+uint32_t zonesGet(Zone *out);
+
+// Replaces all zones at once and returns their new generation
+uint32_t zonesSet(const Zone *next);
+
+// Returns the zones changed since the last call, bit n for zone n + 1, and
+// copies the current zones. Several updates in between are merged into one.
+uint8_t zonesTakeChanges(Zone *out, uint32_t *generation);
+
+// Parses a JSON zone array and validates it on top of base. Missing zones
+// and fields keep their value from base. Returns an HTTP status: 200 when
+// out holds the new zones, otherwise message says what was wrong.
+int zonesParse(const char *json, size_t len, const Zone *base, Zone *out, const char **message);
+
+// Changes one zone from a {"id","x1","y1","x2","y2"} object, missing corners
+// keep their value. Checked like POST /updateZones; returns false and sets
+// message if the zone is invalid, otherwise the new generation.
+bool zonesEdit(JsonObjectConst edit, uint32_t *generation, const char **message);
+
+// Appends one {"x1","y1","x2","y2"} object per zone, the format of GET /zones
+void zonesToJson(const Zone *zones, JsonArray out);
+
+// GET /zones: the JSON is serialized once per generation and served with
+// an ETag, so a client that already has it gets a 304
+void onGetZonesRequest(AsyncWebServerRequest *request);
+
+// POST /updateZones: the body callback buffers the chunks, the request
+// callback validates and applies them once the whole body is in
+void onUpdateZonesBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void onUpdateZonesRequest(AsyncWebServerRequest *request);
@@ -0,0 +1,51 @@
+#include "ChunkWriter.h"
+
+ChunkWriter::ChunkWriter(ChunkCarry &carry, uint8_t *out, size_t space)
+    : _carry(carry), _out(out), _space(space), _length(0)
+{
+  if (_carry.offset < _carry.length)
+  {
+    _length = min(_space, _carry.length - _carry.offset);
+    memcpy(_out, _carry.text + _carry.offset, _length);
+    _carry.offset += _length;
+  }
+}
+
+void ChunkWriter::write(const char *text, size_t length)
+{
+  size_t fits = min(length, _space - _length);
+  memcpy(_out + _length, text, fits);
+  _length += fits;
+  if (fits < length)
+  {
+    length = min(length - fits, sizeof(_carry.text));
+    memcpy(_carry.text, text + fits, length);
+    _carry.length = length;
+    _carry.offset = 0;
+  }
+}
+
+void ChunkWriter::printf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+void ChunkWriter::vprintf(const char *format, va_list args)
+{
+  char text[CHUNK_LINE_MAX];
+  int length = vsnprintf(text, sizeof(text), format, args);
+  if (length < 0)
+  {
+    return;
+  }
+  if ((size_t)length >= sizeof(text))
+  {
+    // Cut lines still end where they should
+    length = sizeof(text) - 1;
+    text[length - 1] = '\n';
+  }
+  write(text, length);
+}
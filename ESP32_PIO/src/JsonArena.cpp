@@ -0,0 +1,127 @@
+#include "JsonArena.h"
+#include "Log.h"
+
+// Every block starts with its size so reallocate() knows how much to copy
+static const size_t blockHeader = 8;
+
+static size_t alignBlock(size_t size)
+{
+  return (size + 7) & ~(size_t)7;
+}
+
+// All arenas, for logStats(); they are created before setup() runs
+static JsonArena *arenas = nullptr;
+
+static StaticJsonArena<JSON_LOOP_ARENA_SIZE> loopArena("loop");
+static StaticJsonArena<JSON_WEB_ARENA_SIZE> webArena("web");
+
+JsonArena &loopJsonArena = loopArena;
+JsonArena &webJsonArena = webArena;
+
+JsonArena::JsonArena(const char *name, uint8_t *buffer, size_t size)
+    : _name(name), _buffer(buffer), _size(size), _used(0), _last(size), _blocks(0), _peak(0), _failures(0), _next(arenas)
+{
+  arenas = this;
+}
+
+void *JsonArena::allocate(size_t size)
+{
+  size_t need = blockHeader + alignBlock(size);
+  if (need > _size - _used)
+  {
+    _failures++;
+    return nullptr;
+  }
+  _last = _used;
+  *(size_t *)(_buffer + _last) = size;
+  _used += need;
+  _blocks++;
+  if (_used > _peak)
+  {
+    _peak = _used;
+  }
+  return _buffer + _last + blockHeader;
+}
+
+void JsonArena::deallocate(void *ptr)
+{
+  if (!ptr)
+  {
+    return;
+  }
+  if (--_blocks == 0)
+  {
+    reset();
+  }
+  else if ((uint8_t *)ptr == _buffer + _last + blockHeader)
+  {
+    // Only the last block can be given back early, the rest waits for the others
+    _used = _last;
+    _last = _size;
+  }
+}
+
+void *JsonArena::reallocate(void *ptr, size_t newSize)
+{
+  if (!ptr)
+  {
+    return allocate(newSize);
+  }
+
+  uint8_t *block = (uint8_t *)ptr - blockHeader;
+  size_t oldSize = *(size_t *)block;
+
+  if ((uint8_t *)ptr == _buffer + _last + blockHeader)
+  {
+    size_t need = blockHeader + alignBlock(newSize);
+    if (need > _size - _last)
+    {
+      _failures++;
+      return nullptr;
+    }
+    *(size_t *)block = newSize;
+    _used = _last + need;
+    if (_used > _peak)
+    {
+      _peak = _used;
+    }
+    return ptr;
+  }
+
+  if (newSize <= oldSize)
+  {
+    // Shrinking in the middle keeps the block where it is
+    *(size_t *)block = newSize;
+    return ptr;
+  }
+
+  void *moved = allocate(newSize);
+  if (moved)
+  {
+    memcpy(moved, ptr, oldSize);
+    _blocks--; // the old block is dead, its space comes back with the rest
+  }
+  return moved;
+}
+
+void JsonArena::reset()
+{
+  _used = 0;
+  _last = _size;
+  _blocks = 0;
+}
+
+JsonArena *JsonArena::first()
+{
+  return arenas;
+}
+
+void JsonArena::logStats()
+{
+  // The names are literals, the log only keeps their pointers
+  for (JsonArena *arena = arenas; arena; arena = arena->_next)
+  {
+    logPrint(LOG_SYSTEM, LOG_INFO, "JSON arena %s: peak %u of %u bytes, %u failed allocations",
+             arena->_name, (unsigned)arena->_peak, (unsigned)arena->_size, (unsigned)arena->_failures);
+  }
+}
@@ -0,0 +1,22 @@
+#include "LatestFrame.h"
+
+static TargetFrame latestFrame;
+static bool latestValid = false;
+static portMUX_TYPE latestMux = portMUX_INITIALIZER_UNLOCKED;
+
+void latestFrameStore(const TargetFrame &frame)
+{
+  portENTER_CRITICAL(&latestMux);
+  latestFrame = frame;
+  latestValid = true;
+  portEXIT_CRITICAL(&latestMux);
+}
+
+bool latestFrameLoad(TargetFrame &out)
+{
+  portENTER_CRITICAL(&latestMux);
+  out = latestFrame;
+  bool valid = latestValid;
+  portEXIT_CRITICAL(&latestMux);
+  return valid;
+}
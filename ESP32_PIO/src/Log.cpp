@@ -0,0 +1,258 @@
+#include "Log.h"
+#include "ChunkWriter.h"
+#include <atomic>
+#include <memory>
+
+// Below loop() so printing only uses time nothing else wants
+#ifndef LOG_TASK_PRIORITY
+#define LOG_TASK_PRIORITY tskIDLE_PRIORITY
+#endif
+#define LOG_TASK_STACK 3072
+#define LOG_DRAIN_INTERVAL 20 // ms between looks at an empty ring
+
+// What every category may log until logSetRate() says otherwise
+#ifndef LOG_DEFAULT_RATE
+#define LOG_DEFAULT_RATE 20
+#endif
+#ifndef LOG_DEFAULT_BURST
+#define LOG_DEFAULT_BURST 40
+#endif
+
+struct LogRecord
+{
+  uint32_t time; // millis()
+  const char *format;
+  uint8_t category;
+  uint8_t level;
+  uint8_t count;
+  uintptr_t args[LOG_MAX_ARGS];
+};
+
+struct TokenBucket
+{
+  uint16_t perSecond; // 0 for no limit
+  uint16_t burst;
+  uint32_t tokens; // in thousandths of a record
+  uint32_t refilled; // millis()
+};
+
+// Where a /logs response is
+struct LogsCursor
+{
+  uint32_t next;
+  uint32_t end;
+  ChunkCarry carry;
+};
+
+static const char *const categoryNames[LOG_CATEGORY_COUNT] = {"sensor", "zones", "web", "wifi", "system"};
+static const char levelLetters[] = "EWID";
+
+// Every field below except levels is guarded by logMux
+static LogRecord ring[LOG_RING_RECORDS];
+static uint32_t head = 0; // records ever written, the newest is at (head - 1) % LOG_RING_RECORDS
+#define DEFAULT_BUCKET {LOG_DEFAULT_RATE, LOG_DEFAULT_BURST, LOG_DEFAULT_BURST * 1000, 0}
+static TokenBucket buckets[LOG_CATEGORY_COUNT] = {DEFAULT_BUCKET, DEFAULT_BUCKET, DEFAULT_BUCKET, DEFAULT_BUCKET, DEFAULT_BUCKET};
+static portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Checked before taking the lock so filtered records cost next to nothing
+static std::atomic<uint8_t> levels[LOG_CATEGORY_COUNT];
+
+static MetricCounter writtenRecords;
+static MetricCounter suppressedRecords[LOG_CATEGORY_COUNT];
+static MetricCounter lostRecords;
+
+static TaskHandle_t drainTaskHandle = NULL;
+
+void logSetLevel(LogCategory category, LogLevel level)
+{
+  // Stored one above the level so the zeroed array means LOG_INFO
+  levels[category].store(level + 1, std::memory_order_relaxed);
+}
+
+static LogLevel levelOf(uint8_t category)
+{
+  uint8_t stored = levels[category].load(std::memory_order_relaxed);
+  return stored == 0 ? LOG_INFO : (LogLevel)(stored - 1);
+}
+
+void logSetRate(LogCategory category, uint16_t perSecond, uint16_t burst)
+{
+  portENTER_CRITICAL(&logMux);
+  TokenBucket &bucket = buckets[category];
+  bucket.perSecond = perSecond;
+  bucket.burst = burst;
+  bucket.tokens = burst * 1000;
+  bucket.refilled = millis();
+  portEXIT_CRITICAL(&logMux);
+}
+
+// Must be called with logMux held
+static bool takeToken(TokenBucket &bucket, uint32_t now)
+{
+  if (bucket.perSecond == 0)
+  {
+    return true;
+  }
+  // Capped so the refill cannot overflow; a minute fills any bucket
+  uint32_t elapsed = min(now - bucket.refilled, (uint32_t)60000);
+  bucket.refilled = now;
+  bucket.tokens = min(bucket.tokens + elapsed * bucket.perSecond, (uint32_t)bucket.burst * 1000);
+  if (bucket.tokens < 1000)
+  {
+    return false;
+  }
+  bucket.tokens -= 1000;
+  return true;
+}
+
+void logWrite(LogCategory category, LogLevel level, const char *format, const uintptr_t *args, uint8_t count)
+{
+  if (level > levelOf(category))
+  {
+    return;
+  }
+  uint32_t now = millis();
+  bool allowed;
+  portENTER_CRITICAL(&logMux);
+  allowed = takeToken(buckets[category], now);
+  if (allowed)
+  {
+    LogRecord &record = ring[head % LOG_RING_RECORDS];
+    record.time = now;
+    record.format = format;
+    record.category = category;
+    record.level = level;
+    record.count = count;
+    memcpy(record.args, args, count * sizeof(uintptr_t));
+    head++;
+  }
+  portEXIT_CRITICAL(&logMux);
+
+  if (allowed)
+  {
+    writtenRecords.inc();
+  }
+  else
+  {
+    suppressedRecords[category].inc();
+  }
+}
+
+// Copies record seq. Returns false once it has been overwritten.
+static bool copyRecord(uint32_t seq, LogRecord &record)
+{
+  bool present;
+  portENTER_CRITICAL(&logMux);
+  present = head - seq <= LOG_RING_RECORDS;
+  if (present)
+  {
+    record = ring[seq % LOG_RING_RECORDS];
+  }
+  portEXIT_CRITICAL(&logMux);
+  return present;
+}
+
+static uint32_t currentHead()
+{
+  portENTER_CRITICAL(&logMux);
+  uint32_t current = head;
+  portEXIT_CRITICAL(&logMux);
+  return current;
+}
+
+// "  12.345 I sensor: text\n", cut to fit but always ending in a newline
+static size_t formatRecord(const LogRecord &record, char *out, size_t size)
+{
+  int length = snprintf(out, size, "%4u.%03u %c %s: ", (unsigned)(record.time / 1000), (unsigned)(record.time % 1000),
+                        levelLetters[record.level], categoryNames[record.category]);
+  uintptr_t a[LOG_MAX_ARGS] = {};
+  memcpy(a, record.args, record.count * sizeof(uintptr_t));
+  length += snprintf(out + length, size - length, record.format, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+  if ((size_t)length > size - 2)
+  {
+    length = size - 2;
+  }
+  out[length++] = '\n';
+  out[length] = '\0';
+  return length;
+}
+
+static void drainTask(void *)
+{
+  uint32_t next = 0;
+  char line[CHUNK_LINE_MAX];
+  for (;;)
+  {
+    uint32_t end = currentHead();
+    if (next == end)
+    {
+      vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+      continue;
+    }
+    if (end - next > LOG_RING_RECORDS)
+    {
+      uint32_t missed = end - next - LOG_RING_RECORDS;
+      lostRecords.inc(missed);
+      Serial.printf("%u log records lost\n", (unsigned)missed);
+      next = end - LOG_RING_RECORDS;
+    }
+    LogRecord record;
+    // Overwritten since end was taken, the next pass counts it as lost
+    if (copyRecord(next, record))
+    {
+      Serial.write((const uint8_t *)line, formatRecord(record, line, sizeof(line)));
+      next++;
+    }
+  }
+}
+
+void logBegin()
+{
+  if (drainTaskHandle == NULL)
+  {
+    xTaskCreate(drainTask, "log", LOG_TASK_STACK, NULL, LOG_TASK_PRIORITY, &drainTaskHandle);
+  }
+}
+
+static size_t logsFill(LogsCursor &cursor, uint8_t *buffer, size_t maxLen)
+{
+  ChunkWriter out(cursor.carry, buffer, maxLen);
+  char line[CHUNK_LINE_MAX];
+  while (!out.full() && cursor.next != cursor.end)
+  {
+    LogRecord record;
+    if (copyRecord(cursor.next, record))
+    {
+      out.write(line, formatRecord(record, line, sizeof(line)));
+    }
+    cursor.next++;
+  }
+  // Nothing left to write ends the response
+  return out.length();
+}
+
+void onLogsRequest(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<LogsCursor> cursor = std::make_shared<LogsCursor>();
+  cursor->end = currentHead();
+  cursor->next = cursor->end > LOG_RING_RECORDS ? cursor->end - LOG_RING_RECORDS : 0;
+  cursor->carry.length = 0;
+  cursor->carry.offset = 0;
+  AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain", [cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                                                   { return logsFill(*cursor, buffer, maxLen); });
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+void logWriteMetrics(MetricsWriter &out)
+{
+  out.counter("log_records_total", "Log records added to the ring", writtenRecords.value());
+  out.counter("log_lost_total", "Log records overwritten before they reached Serial", lostRecords.value());
+  char labels[24];
+  out.family("log_suppressed_total", "counter", "Log records dropped by the rate limit of their category");
+  for (int c = 0; c < LOG_CATEGORY_COUNT; c++)
+  {
+    snprintf(labels, sizeof(labels), "category=\"%s\"", categoryNames[c]);
+    out.sample("log_suppressed_total", labels, suppressedRecords[c].value());
+  }
+}
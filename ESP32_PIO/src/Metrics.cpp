@@ -0,0 +1,207 @@
+#include "Metrics.h"
+#include "JsonArena.h"
+#include <AsyncTCP.h>
+#include <esp_heap_caps.h>
+#include <memory>
+
+static const uint32_t histogramBounds[METRIC_HISTOGRAM_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000};
+
+static MetricsSource sources[METRICS_MAX_SOURCES];
+static size_t sourceCount = 0;
+
+// Where a /metrics response is: lines already handed out and the rest of a
+// line that did not fit into the previous chunk
+struct MetricsCursor
+{
+  size_t line;
+  ChunkCarry carry;
+};
+
+uint32_t MetricCounter::value() const
+{
+  uint32_t total = 0;
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+  {
+    total += _cores[core].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void MetricHistogram::observe(uint32_t micros)
+{
+  size_t i = 0;
+  while (i < METRIC_HISTOGRAM_BUCKETS && micros > histogramBounds[i])
+  {
+    i++;
+  }
+  Core &core = _cores[xPortGetCoreID()];
+  core.buckets[i].fetch_add(1, std::memory_order_relaxed);
+  // Only carries on this core touch sumHigh, and at most once per wrap
+  uint32_t low = core.sumLow.fetch_add(micros, std::memory_order_relaxed);
+  if (low + micros < low)
+  {
+    core.sumHigh.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+uint32_t MetricHistogram::bound(size_t i)
+{
+  return histogramBounds[i];
+}
+
+uint32_t MetricHistogram::bucket(size_t i) const
+{
+  uint32_t total = 0;
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+  {
+    total += _cores[core].buckets[i].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+uint64_t MetricHistogram::sum() const
+{
+  uint64_t total = 0;
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+  {
+    total += ((uint64_t)_cores[core].sumHigh.load(std::memory_order_relaxed) << 32) |
+             _cores[core].sumLow.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+MetricsWriter::MetricsWriter(MetricsCursor &cursor, ChunkWriter &chunk)
+    : _cursor(cursor), _chunk(chunk), _index(0)
+{
+}
+
+void MetricsWriter::_line(const char *format, ...)
+{
+  // Lines before the cursor went out in an earlier chunk
+  if (_index++ < _cursor.line || _chunk.full())
+  {
+    return;
+  }
+
+  _cursor.line++;
+  va_list args;
+  va_start(args, format);
+  _chunk.vprintf(format, args);
+  va_end(args);
+}
+
+void MetricsWriter::family(const char *name, const char *type, const char *help)
+{
+  _line("# HELP %s %s\n", name, help);
+  _line("# TYPE %s %s\n", name, type);
+}
+
+void MetricsWriter::sample(const char *name, const char *labels, uint32_t value)
+{
+  if (labels == NULL)
+  {
+    _line("%s %u\n", name, (unsigned)value);
+  }
+  else
+  {
+    _line("%s{%s} %u\n", name, labels, (unsigned)value);
+  }
+}
+
+void MetricsWriter::counter(const char *name, const char *help, uint32_t value)
+{
+  family(name, "counter", help);
+  sample(name, NULL, value);
+}
+
+void MetricsWriter::gauge(const char *name, const char *help, uint32_t value)
+{
+  family(name, "gauge", help);
+  sample(name, NULL, value);
+}
+
+void MetricsWriter::histogram(const char *name, const char *help, const MetricHistogram &histogram)
+{
+  family(name, "histogram", help);
+  uint32_t count = 0;
+  for (size_t i = 0; i < METRIC_HISTOGRAM_BUCKETS; i++)
+  {
+    count += histogram.bucket(i);
+    uint32_t bound = MetricHistogram::bound(i);
+    _line("%s_bucket{le=\"%u.%06u\"} %u\n", name, (unsigned)(bound / 1000000), (unsigned)(bound % 1000000), (unsigned)count);
+  }
+  count += histogram.bucket(METRIC_HISTOGRAM_BUCKETS);
+  _line("%s_bucket{le=\"+Inf\"} %u\n", name, (unsigned)count);
+  uint64_t sum = histogram.sum();
+  _line("%s_sum %u.%06u\n", name, (unsigned)(sum / 1000000), (unsigned)(sum % 1000000));
+  _line("%s_count %u\n", name, (unsigned)count);
+}
+
+bool metricsAddSource(MetricsSource source)
+{
+  if (sourceCount == METRICS_MAX_SOURCES)
+  {
+    return false;
+  }
+  sources[sourceCount++] = source;
+  return true;
+}
+
+static void writeSystemMetrics(MetricsWriter &out)
+{
+  out.gauge("uptime_seconds", "Seconds since boot", millis() / 1000);
+  out.gauge("heap_free_bytes", "Free heap", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+  out.gauge("heap_min_free_bytes", "Lowest free heap since boot", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+  out.gauge("heap_largest_free_block_bytes", "Largest block malloc can return", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+  async_tcp_event_stats_t tcp;
+  async_tcp_get_event_stats(&tcp);
+  out.gauge("async_tcp_queue_size", "Capacity of the AsyncTCP event queue", tcp.queue_size);
+  out.gauge("async_tcp_queue_waiting", "Events waiting in the AsyncTCP queue", tcp.queue_waiting);
+  out.gauge("async_tcp_queue_high_water", "Most events ever waiting in the AsyncTCP queue", tcp.queue_high_water);
+  out.gauge("async_tcp_pool_in_use", "AsyncTCP event packets taken from the pool", tcp.pool_in_use);
+  out.counter("async_tcp_pool_exhausted_total", "AsyncTCP event packets that had to come from the heap", tcp.pool_exhausted);
+  out.counter("async_tcp_coalesced_total", "Poll and sent events merged into a pending one", tcp.coalesced);
+  out.counter("async_tcp_dropped_total", "Poll events dropped on a full queue", tcp.dropped);
+  out.counter("async_tcp_deferred_total", "Received data refused on a full queue", tcp.deferred);
+
+  char labels[32];
+  out.family("json_arena_peak_bytes", "gauge", "Most bytes a JSON arena ever had in use");
+  for (JsonArena *arena = JsonArena::first(); arena; arena = arena->next())
+  {
+    snprintf(labels, sizeof(labels), "arena=\"%s\"", arena->name());
+    out.sample("json_arena_peak_bytes", labels, arena->peak());
+  }
+  out.family("json_arena_failures_total", "counter", "JSON allocations that did not fit into the arena");
+  for (JsonArena *arena = JsonArena::first(); arena; arena = arena->next())
+  {
+    snprintf(labels, sizeof(labels), "arena=\"%s\"", arena->name());
+    out.sample("json_arena_failures_total", labels, arena->failures());
+  }
+}
+
+size_t metricsFill(MetricsCursor &cursor, uint8_t *buffer, size_t maxLen)
+{
+  ChunkWriter chunk(cursor.carry, buffer, maxLen);
+  MetricsWriter out(cursor, chunk);
+  writeSystemMetrics(out);
+  for (size_t i = 0; i < sourceCount && !out.full(); i++)
+  {
+    sources[i](out);
+  }
+  // Nothing left to write ends the response
+  return chunk.length();
+}
+
+void onMetricsRequest(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<MetricsCursor> cursor = std::make_shared<MetricsCursor>();
+  cursor->line = 0;
+  cursor->carry.length = 0;
+  cursor->carry.offset = 0;
+  AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain; version=0.0.4", [cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                                                   { return metricsFill(*cursor, buffer, maxLen); });
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
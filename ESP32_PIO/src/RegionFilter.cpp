@@ -0,0 +1,75 @@
+#include "RegionFilter.h"
+#include "ZoneConfig.h"
+#include "Log.h"
+
+static_assert(ZONE_COUNT <= LD2450_MAX_REGIONS, "The sensor has a region for every zone");
+
+// loop() only; the metrics read them from the web server task
+static uint32_t programmedGeneration = 0; // zones the sensor filters by, 0 for none yet
+static uint32_t pendingGeneration = 0;    // sent and waiting for the result
+static uint32_t nextAttempt = 0;          // millis()
+
+static MetricCounter regionUpdates;
+static MetricCounter regionFailures;
+
+void regionFilterUpdate(LD2450 &sensor, uint32_t now)
+{
+  if (SENSOR_REGION_FILTER == 0 || pendingGeneration != 0 || (int32_t)(now - nextAttempt) < 0)
+  {
+    return;
+  }
+  Zone zones[ZONE_COUNT];
+  uint32_t generation = zonesGet(zones);
+  if (generation == programmedGeneration)
+  {
+    return;
+  }
+
+  // Regions without a zone cover nothing
+  int16_t regions[LD2450_MAX_REGIONS][4] = {};
+  for (int i = 0; i < ZONE_COUNT; i++)
+  {
+    regions[i][0] = zones[i].x1;
+    regions[i][1] = zones[i].y1;
+    regions[i][2] = zones[i].x2;
+    regions[i][3] = zones[i].y2;
+  }
+  // A full command queue is tried again on the next loop()
+  if (sensor.setRegions(LD2450_REGIONS_ONLY_INSIDE, regions))
+  {
+    pendingGeneration = generation;
+    nextAttempt = now + REGION_FILTER_INTERVAL;
+  }
+}
+
+void regionFilterResult(int result, uint32_t now)
+{
+  if (pendingGeneration == 0)
+  {
+    return;
+  }
+  if (result == LD2450_COMMAND_OK)
+  {
+    programmedGeneration = pendingGeneration;
+    regionUpdates.inc();
+    logPrint(LOG_SENSOR, LOG_INFO, "Sensor filters by the zones of generation %u", programmedGeneration);
+  }
+  else
+  {
+    regionFailures.inc();
+    nextAttempt = now + REGION_FILTER_RETRY;
+    logPrint(LOG_SENSOR, LOG_WARN, "Could not set the sensor's regions: %d", result);
+  }
+  pendingGeneration = 0;
+}
+
+void regionFilterWriteMetrics(MetricsWriter &out)
+{
+  if (SENSOR_REGION_FILTER == 0)
+  {
+    return;
+  }
+  out.gauge("sensor_region_generation", "Zone generation the sensor's region filter was set from", programmedGeneration);
+  out.counter("sensor_region_updates_total", "Times the zones were programmed into the sensor", regionUpdates.value());
+  out.counter("sensor_region_failures_total", "Times programming the zones into the sensor failed", regionFailures.value());
+}
@@ -0,0 +1,174 @@
+#include "SensorControl.h"
+#include "Log.h"
+#include <atomic>
+
+#define TRACKING_UNCHANGED 0
+#define TRACKING_SINGLE 1
+#define TRACKING_MULTI 2
+
+// Set by POST /sensor, taken by loop(); 0 for nothing to do
+static std::atomic<uint32_t> pendingBaud{0};
+static std::atomic<uint8_t> pendingTracking{TRACKING_UNCHANGED};
+
+// What GET /sensor reports, copied from loop() under snapshotMux
+struct SensorSnapshot
+{
+  LD2450::SensorInfo info;
+  uint32_t baud;
+  bool configuring;
+};
+static SensorSnapshot snapshot;
+static portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+
+void sensorControlBegin(LD2450 &sensor)
+{
+  sensor.requestFirmwareVersion();
+  sensor.requestMacAddress();
+  sensor.requestTrackingMode();
+  // Switched by sensorControlUpdate() once the queries are answered
+  if (sensor.getBaudRate() != SENSOR_BAUD_RATE)
+  {
+    pendingBaud.store(SENSOR_BAUD_RATE);
+  }
+}
+
+void sensorControlUpdate(LD2450 &sensor)
+{
+  // A baud rate waits for the commands before it, a tracking mode that does
+  // not fit in the command queue is tried on the next loop()
+  uint32_t baud = pendingBaud.load();
+  if (baud != 0 && sensor.switchBaudRate(baud))
+  {
+    pendingBaud.compare_exchange_strong(baud, 0);
+  }
+  uint8_t tracking = pendingTracking.load();
+  if (tracking != TRACKING_UNCHANGED && sensor.setTrackingMode(tracking == TRACKING_MULTI))
+  {
+    pendingTracking.compare_exchange_strong(tracking, TRACKING_UNCHANGED);
+  }
+
+  portENTER_CRITICAL(&snapshotMux);
+  snapshot.info = sensor.getSensorInfo();
+  snapshot.baud = sensor.getBaudRate();
+  snapshot.configuring = sensor.isConfiguring() || pendingBaud.load() != 0 || pendingTracking.load() != TRACKING_UNCHANGED;
+  portEXIT_CRITICAL(&snapshotMux);
+}
+
+void sensorControlResult(LD2450 &sensor, uint16_t command, int result)
+{
+  if (command == LD2450_BAUD_SWITCHED)
+  {
+    if (result == LD2450_COMMAND_OK)
+    {
+      logPrint(LOG_SENSOR, LOG_INFO, "Sensor UART at %u baud", (unsigned)sensor.getBaudRate());
+    }
+    else if (result == LD2450_COMMAND_FAILED)
+    {
+      logPrint(LOG_SENSOR, LOG_WARN, "Sensor kept its baud rate, UART back at %u baud", (unsigned)sensor.getBaudRate());
+    }
+    else
+    {
+      logPrint(LOG_SENSOR, LOG_ERROR, "No frames from the sensor at the new or the old baud rate");
+    }
+    return;
+  }
+  if (result != LD2450_COMMAND_OK)
+  {
+    logPrint(LOG_SENSOR, LOG_WARN, "Sensor command 0x%04x failed: %d", command, result);
+    return;
+  }
+
+  const LD2450::SensorInfo &info = sensor.getSensorInfo();
+  switch (command)
+  {
+  case LD2450_CMD_FIRMWARE_VERSION:
+    logPrint(LOG_SENSOR, LOG_INFO, "Sensor firmware V%u.%02u.%08x", info.firmware_major >> 8, info.firmware_major & 0xFF, info.firmware_minor);
+    break;
+  case LD2450_CMD_MAC_ADDRESS:
+    logPrint(LOG_SENSOR, LOG_INFO, "Sensor MAC %02x:%02x:%02x:%02x:%02x:%02x", info.mac[0], info.mac[1], info.mac[2], info.mac[3], info.mac[4], info.mac[5]);
+    break;
+  case LD2450_CMD_QUERY_TRACKING:
+  case LD2450_CMD_SINGLE_TARGET:
+  case LD2450_CMD_MULTI_TARGET:
+    // Single target frames only fill the first slot, the others are not decoded
+    sensor.setNumberOfTargets(info.multi_target ? LD2450_MAX_SENSOR_TARGETS : 1);
+    logPrint(LOG_SENSOR, LOG_INFO, "Sensor tracks %s", info.multi_target ? "several targets" : "one target");
+    break;
+  }
+}
+
+void onSensorRequest(AsyncWebServerRequest *request)
+{
+  SensorSnapshot current;
+  portENTER_CRITICAL(&snapshotMux);
+  current = snapshot;
+  portEXIT_CRITICAL(&snapshotMux);
+  const LD2450::SensorInfo &info = current.info;
+
+  char json[384];
+  int length = snprintf(json, sizeof(json), "{\"baud\":%u,\"configuring\":%s,\"tracking\":\"%s\"", (unsigned)current.baud,
+                        current.configuring ? "true" : "false", !info.tracking_valid ? "unknown" : info.multi_target ? "multi" : "single");
+  if (info.firmware_valid)
+  {
+    length += snprintf(json + length, sizeof(json) - length, ",\"firmware\":\"V%u.%02u.%08x\"", info.firmware_major >> 8,
+                       info.firmware_major & 0xFF, (unsigned)info.firmware_minor);
+  }
+  if (info.mac_valid)
+  {
+    length += snprintf(json + length, sizeof(json) - length, ",\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"", info.mac[0], info.mac[1],
+                       info.mac[2], info.mac[3], info.mac[4], info.mac[5]);
+  }
+  if (info.regions_valid)
+  {
+    length += snprintf(json + length, sizeof(json) - length, ",\"region_type\":%u,\"regions\":[", info.region_type);
+    for (int i = 0; i < LD2450_MAX_REGIONS; i++)
+    {
+      length += snprintf(json + length, sizeof(json) - length, "%s{\"x1\":%d,\"y1\":%d,\"x2\":%d,\"y2\":%d}", i ? "," : "",
+                         info.regions[i].x1, info.regions[i].y1, info.regions[i].x2, info.regions[i].y2);
+    }
+    length += snprintf(json + length, sizeof(json) - length, "]");
+  }
+  snprintf(json + length, sizeof(json) - length, "}");
+  request->send(200, "application/json", json);
+}
+
+void onSensorUpdateRequest(AsyncWebServerRequest *request)
+{
+  uint32_t baud = 0;
+  uint8_t tracking = TRACKING_UNCHANGED;
+  if (request->hasParam("baud", true))
+  {
+    baud = request->getParam("baud", true)->value().toInt();
+    if (!LD2450::isSupportedBaudRate(baud))
+    {
+      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Unsupported baud rate\"}");
+      return;
+    }
+  }
+  if (request->hasParam("tracking", true))
+  {
+    const String &mode = request->getParam("tracking", true)->value();
+    tracking = mode == "single" ? TRACKING_SINGLE : mode == "multi" ? TRACKING_MULTI : TRACKING_UNCHANGED;
+    if (tracking == TRACKING_UNCHANGED)
+    {
+      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"tracking is single or multi\"}");
+      return;
+    }
+  }
+  if (baud == 0 && tracking == TRACKING_UNCHANGED)
+  {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Nothing to change\"}");
+    return;
+  }
+
+  // A newer request replaces one loop() has not taken yet
+  if (baud != 0)
+  {
+    pendingBaud.store(baud);
+  }
+  if (tracking != TRACKING_UNCHANGED)
+  {
+    pendingTracking.store(tracking);
+  }
+  request->send(202, "application/json", "{\"status\":\"success\",\"message\":\"Queued, see GET /sensor\"}");
+}
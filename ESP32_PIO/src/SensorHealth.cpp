@@ -0,0 +1,65 @@
+#include "SensorHealth.h"
+
+SensorAction SensorHealth::update(bool frame, uint32_t now)
+{
+  if (frame)
+  {
+    if (_state == SENSOR_OK)
+    {
+      // Moving average over about eight frames, a long gap counts as 1 s
+      _interval = (_interval * 7 + min(now - _lastFrame, (uint32_t)1000)) / 8;
+    }
+    else if (_state != SENSOR_STARTING)
+    {
+      _lastRecovery = now - _outageStart;
+      _outageMillis += _lastRecovery;
+    }
+    _state = SENSOR_OK;
+    _lastFrame = now;
+    _reinitDelay = SENSOR_REINIT_AFTER;
+    return SENSOR_NONE;
+  }
+
+  if (_state == SENSOR_OK)
+  {
+    if (now - _lastFrame < max(_interval * SENSOR_LATE_FACTOR, (uint32_t)SENSOR_LATE_MIN))
+    {
+      return SENSOR_NONE;
+    }
+    // The outage is counted from the last frame that made it
+    _state = SENSOR_LATE;
+    _outageStart = _lastFrame;
+    _nextReinit = _lastFrame + SENSOR_REINIT_AFTER;
+    _outages++;
+    _flushes++;
+    return SENSOR_FLUSH;
+  }
+
+  if (_state == SENSOR_STARTING && _nextReinit == 0)
+  {
+    _nextReinit = now + SENSOR_REINIT_AFTER;
+  }
+  if ((int32_t)(now - _nextReinit) < 0)
+  {
+    return SENSOR_NONE;
+  }
+  if (_state != SENSOR_STARTING)
+  {
+    _state = SENSOR_SILENT;
+  }
+  _nextReinit = now + _reinitDelay;
+  _reinitDelay = min(_reinitDelay * 2, (uint32_t)SENSOR_REINIT_MAX);
+  _reinits++;
+  return SENSOR_REINIT;
+}
+
+void SensorHealth::writeMetrics(MetricsWriter &out) const
+{
+  out.gauge("sensor_state", "0 starting, 1 ok, 2 frames overdue, 3 silent after setting up the UART again", _state);
+  out.gauge("sensor_frame_interval_milliseconds", "Usual time between sensor frames", _interval);
+  out.counter("sensor_outages_total", "Times the sensor frames stopped", _outages);
+  out.counter("sensor_flushes_total", "Times the receiver was flushed to resync", _flushes);
+  out.counter("sensor_reinits_total", "Times the UART was set up again", _reinits);
+  out.counter("sensor_outage_milliseconds_total", "Time without frames in outages that ended", _outageMillis);
+  out.gauge("sensor_last_recovery_milliseconds", "How long the last outage lasted", _lastRecovery);
+}
@@ -0,0 +1,325 @@
+#include "Subscriptions.h"
+#include "ZoneConfig.h"
+#include "JsonArena.h"
+
+struct Subscription
+{
+  uint32_t clientId; // 0 when the slot is free, WebSocket ids start at 1
+  uint8_t streams;
+  uint8_t zones;
+  uint8_t fields;
+  uint16_t interval; // ms between target frames
+  uint32_t lastSent;
+};
+
+static const uint8_t allZones = (1 << ZONE_COUNT) - 1;
+// Above this the interval would round to 0 ms, which means every frame
+static const int maxRate = 1000;
+static const Subscription defaultSubscription = {0, STREAM_TARGETS, allZones, FIELD_POSITION, 0, 0};
+
+// Target frames a client missed because its queue was full
+static MetricCounter skippedFrames;
+
+// Written from the web server task, read and stamped from loop()
+static Subscription slots[SUBSCRIPTION_SLOTS];
+static portMUX_TYPE slotsMux = portMUX_INITIALIZER_UNLOCKED;
+
+struct NamedBit
+{
+  const char *name;
+  uint8_t bit;
+};
+
+static const NamedBit streamNames[] = {
+    {"targets", STREAM_TARGETS},
+    {"presence", STREAM_PRESENCE},
+};
+
+static const NamedBit fieldNames[] = {
+    {"position", FIELD_POSITION},
+    {"speed", FIELD_SPEED},
+    {"resolution", FIELD_RESOLUTION},
+    {"distance", FIELD_DISTANCE},
+    {"zones", FIELD_ZONES},
+};
+
+// Must be called with slotsMux held
+static Subscription *findSlot(uint32_t clientId)
+{
+  for (int i = 0; i < SUBSCRIPTION_SLOTS; i++)
+  {
+    if (slots[i].clientId == clientId)
+    {
+      return &slots[i];
+    }
+  }
+  return NULL;
+}
+
+static bool readNames(JsonVariantConst value, const NamedBit *names, size_t count, uint8_t &out)
+{
+  if (value.isNull())
+  {
+    return true;
+  }
+  JsonArrayConst array = value.as<JsonArrayConst>();
+  if (array.isNull())
+  {
+    return false;
+  }
+  out = 0;
+  for (JsonVariantConst item : array)
+  {
+    const char *name = item.as<const char *>();
+    size_t i = 0;
+    while (i < count && (name == NULL || strcmp(name, names[i].name) != 0))
+    {
+      i++;
+    }
+    if (i == count)
+    {
+      return false;
+    }
+    out |= names[i].bit;
+  }
+  return true;
+}
+
+bool subscriptionsApply(AsyncWebSocketClient *client, JsonObjectConst request, const char **message)
+{
+  Subscription next = defaultSubscription;
+  next.clientId = client->id();
+
+  if (!readNames(request["streams"], streamNames, sizeof(streamNames) / sizeof(streamNames[0]), next.streams))
+  {
+    *message = "Unknown stream";
+    return false;
+  }
+  if (!readNames(request["fields"], fieldNames, sizeof(fieldNames) / sizeof(fieldNames[0]), next.fields))
+  {
+    *message = "Unknown field";
+    return false;
+  }
+
+  JsonVariantConst zones = request["zones"];
+  if (!zones.isNull())
+  {
+    JsonArrayConst array = zones.as<JsonArrayConst>();
+    if (array.isNull())
+    {
+      *message = "zones must be an array of zone ids";
+      return false;
+    }
+    next.zones = 0;
+    for (JsonVariantConst id : array)
+    {
+      if (!id.is<int>() || id.as<int>() < 1 || id.as<int>() > ZONE_COUNT)
+      {
+        *message = "Unknown zone id";
+        return false;
+      }
+      next.zones |= 1 << (id.as<int>() - 1);
+    }
+  }
+
+  JsonVariantConst rate = request["rate"];
+  if (!rate.isNull())
+  {
+    if (!rate.is<int>() || rate.as<int>() < 0 || rate.as<int>() > maxRate)
+    {
+      *message = "rate must be a whole number of frames per second, at most 1000";
+      return false;
+    }
+    next.interval = rate.as<int>() > 0 ? 1000 / rate.as<int>() : 0;
+  }
+
+  portENTER_CRITICAL(&slotsMux);
+  Subscription *slot = findSlot(next.clientId);
+  if (slot == NULL)
+  {
+    slot = findSlot(0);
+  }
+  if (slot != NULL)
+  {
+    *slot = next;
+  }
+  portEXIT_CRITICAL(&slotsMux);
+
+  if (slot == NULL)
+  {
+    *message = "Too many subscriptions";
+    return false;
+  }
+  return true;
+}
+
+void subscriptionsRemove(AsyncWebSocketClient *client)
+{
+  portENTER_CRITICAL(&slotsMux);
+  Subscription *slot = findSlot(client->id());
+  if (slot != NULL)
+  {
+    slot->clientId = 0;
+  }
+  portEXIT_CRITICAL(&slotsMux);
+}
+
+static Subscription subscriptionOf(uint32_t clientId)
+{
+  Subscription subscription = defaultSubscription;
+  portENTER_CRITICAL(&slotsMux);
+  Subscription *slot = findSlot(clientId);
+  if (slot != NULL)
+  {
+    subscription = *slot;
+  }
+  portEXIT_CRITICAL(&slotsMux);
+  return subscription;
+}
+
+// Returns the client's subscription and whether a target frame is due; a due
+// frame restarts the client's rate interval
+static Subscription takeFrame(uint32_t clientId, uint32_t now, bool &due)
+{
+  Subscription subscription = defaultSubscription;
+  due = true;
+  portENTER_CRITICAL(&slotsMux);
+  Subscription *slot = findSlot(clientId);
+  if (slot != NULL)
+  {
+    subscription = *slot;
+    due = slot->interval == 0 || now - slot->lastSent >= slot->interval;
+    if (due)
+    {
+      slot->lastSent = now;
+    }
+  }
+  portEXIT_CRITICAL(&slotsMux);
+  return subscription;
+}
+
+static AsyncWebSocketMessageBuffer *targetMessage(AsyncWebSocket &ws, int id, const TargetSample &target, uint8_t fields)
+{
+  JsonDocument doc(&loopJsonArena);
+  doc["id"] = id;
+  if (fields & FIELD_POSITION)
+  {
+    doc["x"] = target.x;
+    doc["y"] = target.y;
+  }
+  if (fields & FIELD_SPEED)
+  {
+    doc["speed"] = target.speed;
+  }
+  if (fields & FIELD_RESOLUTION)
+  {
+    doc["resolution"] = target.resolution;
+  }
+  if (fields & FIELD_DISTANCE)
+  {
+    doc["distance"] = target.distance;
+  }
+  if (fields & FIELD_ZONES)
+  {
+    JsonArray zones = doc["zones"].to<JsonArray>();
+    for (int j = 0; j < ZONE_COUNT; j++)
+    {
+      if (target.zones & (1 << j))
+      {
+        zones.add(j + 1);
+      }
+    }
+  }
+
+  char json[160];
+  size_t length = serializeJson(doc, json, sizeof(json));
+  return ws.makeBuffer((uint8_t *)json, length);
+}
+
+void subscriptionsPublishTargets(AsyncWebSocket &ws, const TargetSample *targets, size_t count)
+{
+  // Receivers of this frame and the fields they want
+  uint32_t receivers[SUBSCRIPTION_SLOTS * 2];
+  uint8_t receiverFields[SUBSCRIPTION_SLOTS * 2];
+  size_t receiverCount = 0;
+
+  uint32_t now = millis();
+  ws.forEachClient([&](AsyncWebSocketClient *client)
+                   {
+                     if (receiverCount == sizeof(receivers) / sizeof(receivers[0]))
+                     {
+                       return;
+                     }
+                     // A client that falls behind skips frames instead of queueing them
+                     if (!client->canSend())
+                     {
+                       skippedFrames.inc();
+                       return;
+                     }
+                     bool due;
+                     Subscription subscription = takeFrame(client->id(), now, due);
+                     if (!(subscription.streams & STREAM_TARGETS) || !due)
+                     {
+                       return;
+                     }
+                     receivers[receiverCount] = client->id();
+                     receiverFields[receiverCount] = subscription.fields;
+                     receiverCount++; });
+
+  // Each message is serialized once per distinct field set and shared by
+  // every client that wants it
+  for (size_t i = 0; i < count; i++)
+  {
+    bool done[sizeof(receivers) / sizeof(receivers[0])] = {};
+    for (size_t r = 0; r < receiverCount; r++)
+    {
+      if (done[r])
+      {
+        continue;
+      }
+      uint8_t fields = receiverFields[r];
+      for (size_t other = r; other < receiverCount; other++)
+      {
+        done[other] = done[other] || receiverFields[other] == fields;
+      }
+      AsyncWebSocketMessageBuffer *buffer = targetMessage(ws, i + 1, targets[i], fields);
+      if (buffer == NULL)
+      {
+        break;
+      }
+      ws.textAll(buffer, [&](AsyncWebSocketClient *client)
+                 {
+                   for (size_t other = r; other < receiverCount; other++)
+                   {
+                     if (receivers[other] == client->id())
+                     {
+                       return receiverFields[other] == fields;
+                     }
+                   }
+                   return false; });
+    }
+  }
+}
+
+void subscriptionsPublishPresence(AsyncWebSocket &ws, uint8_t occupied, uint8_t changed)
+{
+  for (int j = 0; j < ZONE_COUNT; j++)
+  {
+    uint8_t bit = 1 << j;
+    if (!(changed & bit))
+    {
+      continue;
+    }
+    char json[64];
+    size_t length = snprintf(json, sizeof(json), "{\"type\":\"presence\",\"zone\":%d,\"occupied\":%s}", j + 1, (occupied & bit) ? "true" : "false");
+    ws.textAll(ws.makeBuffer((uint8_t *)json, length), [bit](AsyncWebSocketClient *client)
+               {
+                 Subscription subscription = subscriptionOf(client->id());
+                 return (subscription.streams & STREAM_PRESENCE) && (subscription.zones & bit); });
+  }
+}
+
+void subscriptionsWriteMetrics(MetricsWriter &out)
+{
+  out.counter("websocket_skipped_frames_total", "Target frames not sent to a client whose queue was full", skippedFrames.value());
+}
@@ -0,0 +1,277 @@
+#include "Tasks.h"
+#include "ChunkWriter.h"
+#include <memory>
+
+// Run time counters are kept once a second for the last 10 seconds and
+// once every 10 seconds for the last minute
+#define RECENT_SAMPLES 11
+#define MINUTE_SAMPLES 7
+#define MINUTE_EVERY 10
+
+static const uint8_t windowSeconds[] = {1, 10, 60};
+#define WINDOW_COUNT (sizeof(windowSeconds) / sizeof(windowSeconds[0]))
+
+// A value taken at each sample: the run time counter of a task, the total
+// of all tasks or the time of the sample
+struct RunTimes
+{
+  uint32_t recent[RECENT_SAMPLES];
+  uint32_t minute[MINUTE_SAMPLES];
+};
+
+struct TaskEntry
+{
+  TaskHandle_t handle; // NULL when the entry is free
+  char name[16];
+  uint8_t priority;
+  uint8_t basePriority;
+  uint8_t state;
+  int8_t core; // -1 when the task runs on either core
+  uint32_t stackFree; // least stack ever left, in bytes
+  RunTimes runTimes;
+};
+
+// One row of a /tasks response, the CPU shares in tenths of a percent of
+// one core or -1 when they are not known
+struct TaskRow
+{
+  char name[16];
+  uint8_t priority;
+  uint8_t basePriority;
+  uint8_t state;
+  int8_t core;
+  uint32_t stackFree;
+  int16_t cpu[WINDOW_COUNT];
+};
+
+struct TasksCursor
+{
+  size_t count;
+  size_t next;
+  uint32_t windowMillis[WINDOW_COUNT]; // how long each window really was
+  bool done;
+  ChunkCarry carry;
+  TaskRow rows[TASKS_MAX];
+};
+
+// Written by tasksSample() in loop(), copied by /tasks
+static TaskEntry entries[TASKS_MAX];
+static RunTimes totals;
+static RunTimes sampledAt; // millis()
+static uint32_t samples = 0;
+static bool tooManyTasks = false;
+static unsigned long lastSample = 0;
+static portMUX_TYPE entriesMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *const stateNames[] = {"running", "ready", "blocked", "suspended", "deleted", "invalid"};
+
+// Must be called with entriesMux held
+static void push(RunTimes &times, uint32_t value)
+{
+  times.recent[samples % RECENT_SAMPLES] = value;
+  if (samples % MINUTE_EVERY == 0)
+  {
+    times.minute[(samples / MINUTE_EVERY) % MINUTE_SAMPLES] = value;
+  }
+}
+
+// The sample taken about seconds before the newest one, or the oldest kept
+// when there are not that many yet. Must be called with entriesMux held.
+static uint32_t before(const RunTimes &times, uint8_t seconds)
+{
+  uint32_t newest = samples - 1;
+  if (seconds < RECENT_SAMPLES)
+  {
+    uint32_t back = min((uint32_t)seconds, newest);
+    return times.recent[(newest - back) % RECENT_SAMPLES];
+  }
+  uint32_t newestMinute = newest / MINUTE_EVERY;
+  uint32_t back = min((uint32_t)(seconds / MINUTE_EVERY), newestMinute);
+  return times.minute[(newestMinute - back) % MINUTE_SAMPLES];
+}
+
+#if configUSE_TRACE_FACILITY
+void tasksSample()
+{
+  if (samples > 0 && millis() - lastSample < TASKS_SAMPLE_INTERVAL)
+  {
+    return;
+  }
+  lastSample = millis();
+
+  // Only loop() samples, so one buffer is enough
+  static TaskStatus_t status[TASKS_MAX];
+  uint32_t total = 0;
+  UBaseType_t count = uxTaskGetSystemState(status, TASKS_MAX, &total);
+  // 0 means the buffer is too small for all tasks
+  tooManyTasks = count == 0;
+  if (count == 0)
+  {
+    return;
+  }
+
+  // Match the tasks to their entries. Only loop() changes the entries, so
+  // this needs no lock.
+  int entryOf[TASKS_MAX];
+  bool seen[TASKS_MAX] = {};
+  for (UBaseType_t i = 0; i < count; i++)
+  {
+    entryOf[i] = -1;
+    for (int e = 0; e < TASKS_MAX && entryOf[i] < 0; e++)
+    {
+      if (entries[e].handle == status[i].xHandle)
+      {
+        entryOf[i] = e;
+        seen[e] = true;
+      }
+    }
+  }
+
+  portENTER_CRITICAL(&entriesMux);
+  // Tasks that are gone free their entries for the new ones
+  for (int e = 0; e < TASKS_MAX; e++)
+  {
+    if (!seen[e])
+    {
+      entries[e].handle = NULL;
+    }
+  }
+  int unused = 0;
+  for (UBaseType_t i = 0; i < count; i++)
+  {
+    if (entryOf[i] < 0)
+    {
+      while (entries[unused].handle != NULL)
+      {
+        unused++;
+      }
+      entryOf[i] = unused;
+      // A new task started with a run time of 0
+      memset(&entries[unused].runTimes, 0, sizeof(RunTimes));
+      entries[unused].handle = status[i].xHandle;
+    }
+
+    TaskEntry &task = entries[entryOf[i]];
+    strlcpy(task.name, status[i].pcTaskName, sizeof(task.name));
+    task.priority = status[i].uxCurrentPriority;
+    task.basePriority = status[i].uxBasePriority;
+    task.state = min((int)status[i].eCurrentState, (int)(sizeof(stateNames) / sizeof(stateNames[0]) - 1));
+    BaseType_t affinity = xTaskGetAffinity(status[i].xHandle);
+    task.core = affinity == tskNO_AFFINITY ? -1 : affinity;
+    task.stackFree = status[i].usStackHighWaterMark * sizeof(StackType_t);
+    push(task.runTimes, status[i].ulRunTimeCounter);
+  }
+  push(totals, total);
+  push(sampledAt, lastSample);
+  samples++;
+  portEXIT_CRITICAL(&entriesMux);
+}
+#else
+void tasksSample()
+{
+}
+#endif
+
+// Copies the latest sample into the cursor
+static void takeRows(TasksCursor &cursor)
+{
+  cursor.count = 0;
+  portENTER_CRITICAL(&entriesMux);
+  uint32_t totalSpan[WINDOW_COUNT];
+  for (size_t w = 0; w < WINDOW_COUNT; w++)
+  {
+    totalSpan[w] = samples > 0 ? before(totals, 0) - before(totals, windowSeconds[w]) : 0;
+    cursor.windowMillis[w] = samples > 0 ? before(sampledAt, 0) - before(sampledAt, windowSeconds[w]) : 0;
+  }
+  for (int e = 0; e < TASKS_MAX && samples > 0; e++)
+  {
+    const TaskEntry &task = entries[e];
+    if (task.handle == NULL)
+    {
+      continue;
+    }
+    TaskRow &row = cursor.rows[cursor.count++];
+    memcpy(row.name, task.name, sizeof(row.name));
+    row.priority = task.priority;
+    row.basePriority = task.basePriority;
+    row.state = task.state;
+    row.core = task.core;
+    row.stackFree = task.stackFree;
+    for (size_t w = 0; w < WINDOW_COUNT; w++)
+    {
+      uint32_t span = before(task.runTimes, 0) - before(task.runTimes, windowSeconds[w]);
+      row.cpu[w] = (configGENERATE_RUN_TIME_STATS && totalSpan[w] > 0) ? (int16_t)((uint64_t)span * 1000 / totalSpan[w]) : -1;
+    }
+  }
+  portEXIT_CRITICAL(&entriesMux);
+}
+
+static void writeShare(char *out, size_t size, int16_t share)
+{
+  if (share < 0)
+  {
+    snprintf(out, size, "null");
+  }
+  else
+  {
+    snprintf(out, size, "%d.%d", share / 10, share % 10);
+  }
+}
+
+static size_t tasksFill(TasksCursor &cursor, uint8_t *buffer, size_t maxLen)
+{
+  ChunkWriter out(cursor.carry, buffer, maxLen);
+  while (!out.full() && !cursor.done)
+  {
+    if (cursor.next == 0)
+    {
+      out.printf("{\"sample_interval_ms\":%u,\"windows_ms\":[%u,%u,%u],\"tasks\":[",
+                 (unsigned)TASKS_SAMPLE_INTERVAL, (unsigned)cursor.windowMillis[0], (unsigned)cursor.windowMillis[1], (unsigned)cursor.windowMillis[2]);
+    }
+    else if (cursor.next <= cursor.count)
+    {
+      const TaskRow &row = cursor.rows[cursor.next - 1];
+      char cpu[WINDOW_COUNT][8];
+      for (size_t w = 0; w < WINDOW_COUNT; w++)
+      {
+        writeShare(cpu[w], sizeof(cpu[w]), row.cpu[w]);
+      }
+      out.printf("%s\n{\"name\":\"%s\",\"priority\":%u,\"base_priority\":%u,\"core\":%d,\"state\":\"%s\",\"stack_free_min\":%u,\"cpu\":[%s,%s,%s]}",
+                 cursor.next == 1 ? "" : ",", row.name, row.priority, row.basePriority, row.core, stateNames[row.state],
+                 (unsigned)row.stackFree, cpu[0], cpu[1], cpu[2]);
+    }
+    else
+    {
+      out.printf("\n]}\n");
+      cursor.done = true;
+    }
+    cursor.next++;
+  }
+  // Nothing left to write ends the response
+  return out.length();
+}
+
+void onTasksRequest(AsyncWebServerRequest *request)
+{
+  if (!configUSE_TRACE_FACILITY)
+  {
+    request->send(501, "application/json", "{\"status\":\"error\",\"message\":\"Built without configUSE_TRACE_FACILITY\"}");
+    return;
+  }
+  if (tooManyTasks)
+  {
+    request->send(500, "application/json", "{\"status\":\"error\",\"message\":\"More tasks than TASKS_MAX\"}");
+    return;
+  }
+
+  std::shared_ptr<TasksCursor> cursor = std::make_shared<TasksCursor>();
+  cursor->next = 0;
+  cursor->done = false;
+  cursor->carry.length = 0;
+  cursor->carry.offset = 0;
+  takeRows(*cursor);
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", [cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                                                   { return tasksFill(*cursor, buffer, maxLen); });
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
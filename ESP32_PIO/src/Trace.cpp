@@ -0,0 +1,243 @@
+#include "Trace.h"
+#include "ChunkWriter.h"
+#include <AsyncTCP.h>
+#include <AsyncWebSocket.h>
+#include <LD2450.h>
+#include <esp_timer.h>
+#include <atomic>
+#include <memory>
+
+static const char *const pointNames[TRACE_POINT_COUNT] = {
+    "loop", "uart", "sensor read", "zones", "publish", "ws cleanup", "wifi", "ws queue", "tcp event", "tcp write"};
+
+struct TraceEvent
+{
+  uint32_t start; // micros()
+  uint32_t duration;
+  uint32_t arg;
+  uint8_t point;
+  uint8_t instant;
+  uint8_t core;
+  uint8_t reserved;
+};
+
+// Only the owning task writes into a ring. head counts every event ever
+// recorded, the newest is at (head - 1) % TRACE_RING_EVENTS.
+struct TraceRing
+{
+  std::atomic<TaskHandle_t> owner;
+  std::atomic<bool> named; // name is set, the ring can be exported
+  std::atomic<uint32_t> head;
+  char name[16];
+  TraceEvent events[TRACE_RING_EVENTS];
+};
+
+static TraceRing rings[TRACE_MAX_TASKS];
+
+// Where a /trace response is. The heads are taken when the request starts,
+// so events recorded while it streams are left for the next one.
+struct TraceCursor
+{
+  uint8_t stage;
+  uint8_t ring;
+  bool first;
+  uint32_t next;
+  uint32_t end[TRACE_MAX_TASKS];
+  uint64_t now;    // esp_timer_get_time() when the request started
+  uint32_t nowLow; // the same as micros()
+  ChunkCarry carry;
+};
+
+enum TraceStage : uint8_t
+{
+  STAGE_HEADER,
+  STAGE_THREADS,
+  STAGE_EVENTS,
+  STAGE_FOOTER,
+  STAGE_DONE
+};
+
+static TraceRing *ringOfCurrentTask()
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  for (int i = 0; i < TRACE_MAX_TASKS; i++)
+  {
+    if (rings[i].owner.load(std::memory_order_relaxed) == task)
+    {
+      return &rings[i];
+    }
+  }
+  // First event of this task, take a free ring
+  for (int i = 0; i < TRACE_MAX_TASKS; i++)
+  {
+    TaskHandle_t expected = NULL;
+    if (rings[i].owner.compare_exchange_strong(expected, task, std::memory_order_relaxed))
+    {
+      strlcpy(rings[i].name, pcTaskGetTaskName(NULL), sizeof(rings[i].name));
+      rings[i].named.store(true, std::memory_order_release);
+      return &rings[i];
+    }
+  }
+  return NULL;
+}
+
+static void record(TracePoint point, uint32_t start, uint32_t duration, uint32_t arg, bool instant)
+{
+  TraceRing *ring = ringOfCurrentTask();
+  if (ring == NULL)
+  {
+    return;
+  }
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  TraceEvent &event = ring->events[head % TRACE_RING_EVENTS];
+  event.start = start;
+  event.duration = duration;
+  event.arg = arg;
+  event.point = point;
+  event.instant = instant;
+  event.core = xPortGetCoreID();
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void traceRecord(TracePoint point, uint32_t start, uint32_t arg)
+{
+  record(point, start, micros() - start, arg, false);
+}
+
+void traceInstant(TracePoint point, uint32_t arg)
+{
+  record(point, micros(), 0, arg, true);
+}
+
+void async_tcp_trace_hook(async_tcp_trace_point_t point, uint32_t start, uint32_t arg)
+{
+  traceRecord(point == ASYNC_TCP_TRACE_WRITE ? TRACE_TCP_WRITE : TRACE_TCP_EVENT, start, arg);
+}
+
+void async_websocket_trace_hook(uint32_t start, size_t queued)
+{
+  traceRecord(TRACE_WS_QUEUE, start, queued);
+}
+
+void ld2450_receive_hook(uint32_t time, size_t bytes)
+{
+  record(TRACE_UART, time, 0, bytes, true);
+}
+
+// Oldest event of the ring that has not been overwritten yet
+static uint32_t firstEvent(uint32_t end)
+{
+  return end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+}
+
+// Copies event seq of ring r, false when the task has overwritten it. Once
+// head reaches seq + TRACE_RING_EVENTS the task may be writing into its slot.
+static bool copyEvent(int r, uint32_t seq, TraceEvent &event)
+{
+  event = rings[r].events[seq % TRACE_RING_EVENTS];
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return rings[r].head.load(std::memory_order_relaxed) - seq < TRACE_RING_EVENTS;
+}
+
+static void writeEvent(TraceCursor &cursor, ChunkWriter &out, int r, const TraceEvent &event)
+{
+  // Stretch the 32-bit start back from the time of the request, which is
+  // right as long as the event is less than 71 minutes old
+  unsigned long long ts = cursor.now - (uint32_t)(cursor.nowLow - event.start);
+  const char *separator = cursor.first ? "\n" : ",\n";
+  cursor.first = false;
+  if (event.instant)
+  {
+    out.printf("%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%u,\"core\":%u}}",
+               separator, pointNames[event.point], ts, r + 1, (unsigned)event.arg, (unsigned)event.core);
+  }
+  else
+  {
+    out.printf("%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%u,\"core\":%u}}",
+               separator, pointNames[event.point], ts, (unsigned)event.duration, r + 1, (unsigned)event.arg, (unsigned)event.core);
+  }
+}
+
+static size_t traceFill(TraceCursor &cursor, uint8_t *buffer, size_t maxLen)
+{
+  ChunkWriter out(cursor.carry, buffer, maxLen);
+  while (!out.full() && cursor.stage != STAGE_DONE)
+  {
+    if (cursor.stage == STAGE_HEADER)
+    {
+      out.printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+      cursor.stage = STAGE_THREADS;
+      cursor.ring = 0;
+    }
+    else if (cursor.stage == STAGE_THREADS)
+    {
+      if (cursor.ring == TRACE_MAX_TASKS)
+      {
+        cursor.stage = STAGE_EVENTS;
+        cursor.ring = 0;
+        cursor.next = firstEvent(cursor.end[0]);
+        continue;
+      }
+      TraceRing &ring = rings[cursor.ring];
+      if (ring.named.load(std::memory_order_acquire))
+      {
+        out.printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                   cursor.first ? "\n" : ",\n", cursor.ring + 1, ring.name);
+        cursor.first = false;
+      }
+      cursor.ring++;
+    }
+    else if (cursor.stage == STAGE_EVENTS)
+    {
+      if (cursor.ring == TRACE_MAX_TASKS)
+      {
+        cursor.stage = STAGE_FOOTER;
+        continue;
+      }
+      if (cursor.next == cursor.end[cursor.ring])
+      {
+        cursor.ring++;
+        if (cursor.ring < TRACE_MAX_TASKS)
+        {
+          cursor.next = firstEvent(cursor.end[cursor.ring]);
+        }
+        continue;
+      }
+      TraceEvent event;
+      if (copyEvent(cursor.ring, cursor.next, event))
+      {
+        writeEvent(cursor, out, cursor.ring, event);
+      }
+      cursor.next++;
+    }
+    else
+    {
+      out.printf("\n]}\n");
+      cursor.stage = STAGE_DONE;
+    }
+  }
+  // Nothing left to write ends the response
+  return out.length();
+}
+
+void onTraceRequest(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<TraceCursor> cursor = std::make_shared<TraceCursor>();
+  cursor->stage = STAGE_HEADER;
+  cursor->ring = 0;
+  cursor->first = true;
+  cursor->next = 0;
+  for (int i = 0; i < TRACE_MAX_TASKS; i++)
+  {
+    cursor->end[i] = rings[i].head.load(std::memory_order_acquire);
+  }
+  // Taken after the heads so no exported event starts later than now
+  cursor->now = esp_timer_get_time();
+  cursor->nowLow = (uint32_t)cursor->now;
+  cursor->carry.length = 0;
+  cursor->carry.offset = 0;
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", [cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                                                   { return traceFill(*cursor, buffer, maxLen); });
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
@@ -0,0 +1,321 @@
+#include "ZoneConfig.h"
+#include "JsonArena.h"
+#include "Log.h"
+
+static Zone zones[ZONE_COUNT] = {
+    {-4000, 1, -1, 4000},     // Zone 2
+    {1, 1, 4000, 4000},       // Zone 1
+    {-4001, 4001, 4001, 6000} // Zone 3
+};
+
+// Bumped by every zonesSet() so readers can tell the zones changed
+static uint32_t zonesGeneration = 1;
+
+// Zones changed since the last zonesTakeChanges(), bit n for zone n + 1
+static uint8_t zonesChanged = 0;
+
+// zones is written from the web server task and read from loop()
+static portMUX_TYPE zonesMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Serialized GET /zones body and the generation it was built from, web server task only
+static AwsSharedBuffer zonesJson;
+static uint32_t zonesJsonGeneration = 0;
+static char zonesETag[24];
+
+// Random per boot so ETags from before a restart never match
+static uint32_t zonesBootId = 0;
+
+// Request body collected in request->_tempObject, followed by the bytes
+struct ZoneBody
+{
+  size_t length;
+  bool overflow;
+};
+
+uint32_t zonesGet(Zone *out)
+{
+  portENTER_CRITICAL(&zonesMux);
+  memcpy(out, zones, sizeof(zones));
+  uint32_t generation = zonesGeneration;
+  portEXIT_CRITICAL(&zonesMux);
+  return generation;
+}
+
+uint32_t zonesSet(const Zone *next)
+{
+  portENTER_CRITICAL(&zonesMux);
+  for (int i = 0; i < ZONE_COUNT; i++)
+  {
+    if (memcmp(&zones[i], &next[i], sizeof(Zone)) != 0)
+    {
+      zonesChanged |= 1 << i;
+    }
+  }
+  memcpy(zones, next, sizeof(zones));
+  uint32_t generation = ++zonesGeneration;
+  portEXIT_CRITICAL(&zonesMux);
+  return generation;
+}
+
+uint8_t zonesTakeChanges(Zone *out, uint32_t *generation)
+{
+  portENTER_CRITICAL(&zonesMux);
+  uint8_t changed = zonesChanged;
+  zonesChanged = 0;
+  memcpy(out, zones, sizeof(zones));
+  *generation = zonesGeneration;
+  portEXIT_CRITICAL(&zonesMux);
+  return changed;
+}
+
+static bool readCoordinate(JsonVariantConst value, int limitMin, int limitMax, int &out)
+{
+  if (value.isNull())
+  {
+    return true; // Keep the current value if the field is missing
+  }
+  if (!value.is<int>())
+  {
+    return false;
+  }
+  int v = value.as<int>();
+  if (v < limitMin || v > limitMax)
+  {
+    return false;
+  }
+  out = v;
+  return true;
+}
+
+// Reads the corners of one zone on top of its current value
+static bool readZone(JsonObjectConst item, Zone &zone, const char **message)
+{
+  if (!readCoordinate(item["x1"], -ZONE_X_LIMIT, ZONE_X_LIMIT, zone.x1) ||
+      !readCoordinate(item["y1"], 0, ZONE_Y_LIMIT, zone.y1) ||
+      !readCoordinate(item["x2"], -ZONE_X_LIMIT, ZONE_X_LIMIT, zone.x2) ||
+      !readCoordinate(item["y2"], 0, ZONE_Y_LIMIT, zone.y2))
+  {
+    *message = "Zone coordinate out of range";
+    return false;
+  }
+  if (zone.x1 >= zone.x2 || zone.y1 >= zone.y2)
+  {
+    *message = "Zone corners must satisfy x1 < x2 and y1 < y2";
+    return false;
+  }
+  return true;
+}
+
+int zonesParse(const char *json, size_t len, const Zone *base, Zone *out, const char **message)
+{
+  JsonDocument doc(&webJsonArena);
+  DeserializationError error = deserializeJson(doc, json, len);
+
+  if (error == DeserializationError::NoMemory)
+  {
+    *message = "Zone data too large";
+    return 413;
+  }
+  if (error)
+  {
+    *message = "Invalid JSON";
+    return 400;
+  }
+
+  JsonArrayConst array = doc.as<JsonArrayConst>();
+  if (array.isNull())
+  {
+    *message = "Expected an array of zones";
+    return 400;
+  }
+  if (array.size() > ZONE_COUNT)
+  {
+    *message = "Too many zones";
+    return 400;
+  }
+
+  memcpy(out, base, sizeof(Zone) * ZONE_COUNT);
+  size_t i = 0;
+  for (JsonVariantConst item : array)
+  {
+    Zone &zone = out[i++];
+    if (item.isNull())
+    {
+      continue;
+    }
+    if (!item.is<JsonObjectConst>())
+    {
+      *message = "Zone must be an object";
+      return 400;
+    }
+    if (!readZone(item, zone, message))
+    {
+      return 400;
+    }
+  }
+  return 200;
+}
+
+bool zonesEdit(JsonObjectConst edit, uint32_t *generation, const char **message)
+{
+  JsonVariantConst id = edit["id"];
+  if (!id.is<int>() || id.as<int>() < 1 || id.as<int>() > ZONE_COUNT)
+  {
+    *message = "Unknown zone id";
+    return false;
+  }
+
+  // Zones are only written from the web server task, so nothing can change
+  // them between zonesGet() and zonesSet()
+  Zone next[ZONE_COUNT];
+  zonesGet(next);
+  if (!readZone(edit, next[id.as<int>() - 1], message))
+  {
+    return false;
+  }
+  *generation = zonesSet(next);
+  return true;
+}
+
+void zonesToJson(const Zone *zones, JsonArray out)
+{
+  for (int i = 0; i < ZONE_COUNT; i++)
+  {
+    JsonObject zone = out.add<JsonObject>();
+    zone["x1"] = zones[i].x1;
+    zone["y1"] = zones[i].y1;
+    zone["x2"] = zones[i].x2;
+    zone["y2"] = zones[i].y2;
+  }
+}
+
+static bool buildZonesJson()
+{
+  Zone current[ZONE_COUNT];
+  uint32_t generation = zonesGet(current);
+  if (zonesJson && generation == zonesJsonGeneration)
+  {
+    return true;
+  }
+
+  JsonDocument doc(&webJsonArena);
+  zonesToJson(current, doc.to<JsonArray>());
+  if (doc.overflowed())
+  {
+    return false;
+  }
+
+  // Requests still sending the previous buffer keep it alive until they finish
+  std::shared_ptr<std::vector<uint8_t>> json = std::make_shared<std::vector<uint8_t>>(measureJson(doc));
+  serializeJson(doc, (char *)json->data(), json->size());
+  zonesJson = json;
+  zonesJsonGeneration = generation;
+
+  if (zonesBootId == 0)
+  {
+    zonesBootId = esp_random() | 1;
+  }
+  snprintf(zonesETag, sizeof(zonesETag), "\"%08x-%x\"", (unsigned)zonesBootId, (unsigned)generation);
+  return true;
+}
+
+static bool etagMatches(const String &ifNoneMatch, const char *etag)
+{
+  // The header may list several tags or be a wildcard
+  return ifNoneMatch == "*" || strstr(ifNoneMatch.c_str(), etag) != NULL;
+}
+
+void onGetZonesRequest(AsyncWebServerRequest *request)
+{
+  if (!buildZonesJson())
+  {
+    request->send(500);
+    return;
+  }
+
+  AsyncWebServerResponse *response;
+  AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+  if (ifNoneMatch && etagMatches(ifNoneMatch->value(), zonesETag))
+  {
+    response = request->beginResponse(304);
+  }
+  else
+  {
+    response = request->beginResponse(200, "application/json", zonesJson);
+  }
+  response->addHeader("ETag", zonesETag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+void onUpdateZonesBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+  ZoneBody *body = (ZoneBody *)request->_tempObject;
+  if (index == 0 && body == NULL)
+  {
+    // Bodies over the limit are drained but not kept
+    bool overflow = total > ZONE_BODY_MAX_SIZE;
+    body = (ZoneBody *)malloc(sizeof(ZoneBody) + (overflow ? 0 : total));
+    if (body == NULL)
+    {
+      return;
+    }
+    body->length = 0;
+    body->overflow = overflow;
+    request->_tempObject = body;
+  }
+  if (body == NULL || body->overflow || index + len > total)
+  {
+    return;
+  }
+  memcpy((char *)(body + 1) + index, data, len);
+  body->length = index + len;
+}
+
+static void sendStatus(AsyncWebServerRequest *request, int code, const char *message)
+{
+  String json = code == 200 ? "{\"status\":\"success\",\"message\":\"" : "{\"status\":\"error\",\"message\":\"";
+  json += message;
+  json += "\"}";
+  request->send(code, "application/json", json);
+}
+
+void onUpdateZonesRequest(AsyncWebServerRequest *request)
+{
+  ZoneBody *body = (ZoneBody *)request->_tempObject;
+  if (request->contentLength() == 0)
+  {
+    sendStatus(request, 400, "Empty body");
+    return;
+  }
+  if (body == NULL)
+  {
+    // Form encoded bodies never reach the body callback
+    sendStatus(request, 400, "Expected a JSON body");
+    return;
+  }
+  if (body->overflow)
+  {
+    sendStatus(request, 413, "Zone data too large");
+    return;
+  }
+
+  Zone current[ZONE_COUNT];
+  Zone next[ZONE_COUNT];
+  const char *message = NULL;
+  zonesGet(current);
+  int code = zonesParse((const char *)(body + 1), body->length, current, next, &message);
+  if (code != 200)
+  {
+    logPrint(LOG_ZONES, LOG_WARN, "Zone update rejected: %s", message);
+    sendStatus(request, code, message);
+    return;
+  }
+
+  zonesSet(next);
+  for (int i = 0; i < ZONE_COUNT; i++)
+  {
+    logPrint(LOG_ZONES, LOG_INFO, "Zone %d: x1=%d, y1=%d, x2=%d, y2=%d", i + 1, next[i].x1, next[i].y1, next[i].x2, next[i].y2);
+  }
+  sendStatus(request, 200, "Zones updated");
+}
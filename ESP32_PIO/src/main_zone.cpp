@@ -4,14 +4,26 @@
 #include <ESPAsyncWebServer.h>
 #include <ArduinoJson.h>
 #include <AsyncWebSocket.h>
+#include <LittleFS.h>
 #include "WiFiCredentials.h"
+#include "ZoneConfig.h"
+#include "JsonArena.h"
+#include "Subscriptions.h"
+#include "LatestFrame.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Tasks.h"
+#include "Log.h"
+#include "SensorHealth.h"
+#include "RegionFilter.h"
+#include "SensorControl.h"
 
 const int ledPin = 2;
 
-String last_target_data = "";
-
 // SENSOR INSTANCE
 LD2450 ld2450;
+// Decides when the sensor needs a flush or its UART set up again
+SensorHealth sensorHealth;
 
 boolean zone1, zone2, zone3;
 
@@ -19,22 +31,31 @@ boolean zone1, zone2, zone3;
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws"); // Set up WebSocket on "/ws"
 
-// Define zones as rectangles with (x1, y1)LeftDownCorner and (x2, y2)RightUpCorner
-struct Zone
-{
-  int x1, y1, x2, y2;
-};
-
-Zone zones[3] = {
-    {-4000, 1, -1, 4000},     // Zone 2
-    {1, 1, 4000, 4000},       // Zone 1
-    {-4001, 4001, 4001, 6000} // Zone 3
-};
-
 bool tempZone1 = false;
 bool tempZone2 = false;
 bool tempZone3 = false;
 
+// Zones occupied in the last frame, bit n for zone n + 1
+uint8_t lastOccupied = 0;
+
+// Served by GET /metrics
+MetricHistogram loopDuration;
+MetricHistogram frameDuration;
+MetricHistogram frameWireTime;
+MetricCounter zoneTransitions[ZONE_COUNT];
+MetricCounter wifiReconnects;
+MetricCounter zoneResyncs;
+
+// Clients a zone change was dropped for because their queue was full. Later
+// changes alone would leave them with the wrong zones, so they get a
+// snapshot once there is room instead. Only touched by loop().
+uint32_t staleZoneClients[DEFAULT_MAX_WS_CLIENTS * 2];
+size_t staleZoneClientCount = 0;
+
+// How often the JSON arena peaks are printed
+const unsigned long arenaReportInterval = 60000;
+unsigned long lastArenaReport = 0;
+
 const char *ssid = WIFI_SSID;
 const char *password = WIFI_PASSWORD;
 
@@ -62,16 +83,291 @@ void setup_wifi()
   Serial.println(WiFi.localIP());
 }
 
+static void sendWebSocketError(AsyncWebSocketClient *client, const char *message)
+{
+  char json[128];
+  snprintf(json, sizeof(json), "{\"type\":\"error\",\"message\":\"%s\"}", message);
+  client->text(json);
+}
+
+// Hands what the sensor answered to a configuration command to whoever sent it
+static void onSensorCommand(uint16_t command, int result)
+{
+  if (command == LD2450_CMD_SET_REGIONS)
+  {
+    regionFilterResult(result, millis());
+    return;
+  }
+  sensorControlResult(ld2450, command, result);
+}
+
+static void writeSensorMetrics(MetricsWriter &out)
+{
+  const LD2450::Stats &stats = ld2450.getStats();
+  out.counter("ld2450_frames_total", "Frames decoded from the sensor", stats.frames);
+  out.counter("ld2450_frames_dropped_total", "Frames with a header but a bad footer or cut off", stats.dropped);
+  out.counter("ld2450_resyncs_total", "Times bytes were skipped to reach the next frame", stats.resyncs);
+  out.counter("ld2450_skipped_bytes_total", "Bytes skipped while looking for a frame", stats.skipped);
+  out.counter("ld2450_frame_overruns_total", "Decoded frames dropped because loop() did not take them in time", stats.overruns);
+  out.gauge("ld2450_baud_rate", "Baud rate of the sensor's UART", ld2450.getBaudRate());
+  sensorHealth.writeMetrics(out);
+
+  out.histogram("loop_duration_seconds", "Time one loop() takes, not counting the wait for a sensor frame", loopDuration);
+  out.histogram("frame_processing_seconds", "Time from the end of a frame on the UART to its WebSocket messages", frameDuration);
+#if SENSOR_WIRE_TIMING
+  out.histogram("ld2450_frame_wire_seconds", "Time from the first byte of a frame to the last on the wire", frameWireTime);
+#endif
+
+  char labels[16];
+  out.family("zone_occupied", "gauge", "1 while a target is in the zone");
+  for (int j = 0; j < ZONE_COUNT; j++)
+  {
+    snprintf(labels, sizeof(labels), "zone=\"%d\"", j + 1);
+    out.sample("zone_occupied", labels, (lastOccupied >> j) & 1);
+  }
+  out.family("zone_transitions_total", "counter", "Times the zone became occupied or empty");
+  for (int j = 0; j < ZONE_COUNT; j++)
+  {
+    snprintf(labels, sizeof(labels), "zone=\"%d\"", j + 1);
+    out.sample("zone_transitions_total", labels, zoneTransitions[j].value());
+  }
+
+  out.counter("wifi_reconnects_total", "Times the WiFi connection was lost and set up again", wifiReconnects.value());
+}
+
+static void writeWebMetrics(MetricsWriter &out)
+{
+  size_t queued = 0;
+  size_t deepest = 0;
+  ws.forEachClient([&](AsyncWebSocketClient *client)
+                   {
+                     queued += client->queueLength();
+                     deepest = max(deepest, client->queueLength()); });
+  out.gauge("websocket_clients", "Connected WebSocket clients", ws.count());
+  out.gauge("websocket_queued_messages", "Messages waiting in all client queues", queued);
+  out.gauge("websocket_queue_max", "Messages waiting in the fullest client queue", deepest);
+  out.counter("websocket_dropped_messages_total", "Messages thrown away on a full client queue", ws.droppedMessages());
+  out.counter("websocket_zone_resyncs_total", "Snapshots sent to clients that missed a zone change", zoneResyncs.value());
+
+  const AsyncWebRouteStats &routes = server.routeStats();
+  out.counter("http_routed_requests_total", "Requests routed to a handler", routes.requests);
+  out.counter("http_route_checks_total", "Handler filter and canHandle calls made while routing", routes.evaluated);
+  out.counter("http_route_linear_total", "Requests that needed the linear handler scan", routes.linear);
+  out.counter("http_route_microseconds_total", "Time spent picking handlers", routes.micros);
+  out.gauge("http_route_max_microseconds", "Slowest handler lookup", routes.maxMicros);
+}
+
+// Gives a client that just connected everything the UI draws: the zones and
+// the latest targets, so it does not have to wait for GET /zones or the next frame.
+// Also sent to a client that missed a zone change. False when it was not queued.
+static bool sendSnapshot(AsyncWebSocketClient *client, JsonArena &arena)
+{
+  Zone zones[ZONE_COUNT];
+  uint32_t generation = zonesGet(zones);
+  TargetFrame frame;
+  bool haveFrame = latestFrameLoad(frame);
+
+  JsonDocument doc(&arena);
+  doc["type"] = "snapshot";
+  doc["generation"] = generation;
+  zonesToJson(zones, doc["zones"].to<JsonArray>());
+  JsonArray targets = doc["targets"].to<JsonArray>();
+  for (int i = 0; haveFrame && i < frame.count; i++)
+  {
+    JsonObject target = targets.add<JsonObject>();
+    target["id"] = i + 1;
+    target["x"] = frame.targets[i].x;
+    target["y"] = frame.targets[i].y;
+  }
+
+  char json[384];
+  if (doc.overflowed() || measureJson(doc) >= sizeof(json))
+  {
+    logPrint(LOG_WEB, LOG_ERROR, "WebSocket snapshot too large");
+    return false;
+  }
+  size_t length = serializeJson(doc, json, sizeof(json));
+  return client->text(json, length);
+}
+
+static bool containsClient(const uint32_t *ids, size_t count, uint32_t id)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    if (ids[i] == id)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool isZoneClientCurrent(AsyncWebSocketClient *client)
+{
+  return !containsClient(staleZoneClients, staleZoneClientCount, client->id());
+}
+
+static void markZoneClientStale(AsyncWebSocketClient *client)
+{
+  uint32_t id = client->id();
+  if (!isZoneClientCurrent(client))
+  {
+    return;
+  }
+  if (staleZoneClientCount == sizeof(staleZoneClients) / sizeof(staleZoneClients[0]))
+  {
+    logPrint(LOG_WEB, LOG_ERROR, "WebSocket client #%u missed a zone change and cannot be resynced", (unsigned)id);
+    return;
+  }
+  staleZoneClients[staleZoneClientCount++] = id;
+}
+
+// Sends a snapshot to every client that missed a zone change and has room
+// for it now; it carries the latest zones, so no change is lost. Clients
+// that are gone drop out of the list.
+static void resyncZoneClients()
+{
+  if (staleZoneClientCount == 0)
+  {
+    return;
+  }
+  uint32_t stale[sizeof(staleZoneClients) / sizeof(staleZoneClients[0])];
+  size_t staleCount = staleZoneClientCount;
+  memcpy(stale, staleZoneClients, staleCount * sizeof(stale[0]));
+  staleZoneClientCount = 0;
+  ws.forEachClient([&](AsyncWebSocketClient *client)
+                   {
+                     if (!containsClient(stale, staleCount, client->id()))
+                     {
+                       return;
+                     }
+                     if (client->canSend() && sendSnapshot(client, loopJsonArena))
+                     {
+                       zoneResyncs.inc();
+                       return;
+                     }
+                     markZoneClientStale(client); });
+}
+
+// Tells every client which zones changed, at most once per loop() however
+// many updates came in since, so a dragged zone does not flood the clients
+static void broadcastZoneChanges()
+{
+  Zone zones[ZONE_COUNT];
+  uint32_t generation;
+  uint8_t changed = zonesTakeChanges(zones, &generation);
+  if (changed == 0)
+  {
+    return;
+  }
+
+  JsonDocument doc(&loopJsonArena);
+  doc["type"] = "zones";
+  doc["generation"] = generation;
+  JsonArray list = doc["changed"].to<JsonArray>();
+  for (int i = 0; i < ZONE_COUNT; i++)
+  {
+    if (changed & (1 << i))
+    {
+      JsonObject zone = list.add<JsonObject>();
+      zone["id"] = i + 1;
+      zone["x1"] = zones[i].x1;
+      zone["y1"] = zones[i].y1;
+      zone["x2"] = zones[i].x2;
+      zone["y2"] = zones[i].y2;
+    }
+  }
+
+  char json[256];
+  if (doc.overflowed() || measureJson(doc) >= sizeof(json))
+  {
+    logPrint(LOG_WEB, LOG_ERROR, "Zone change message too large");
+    return;
+  }
+  size_t length = serializeJson(doc, json, sizeof(json));
+  // A client that misses the change waits for a snapshot and gets no
+  // further changes until then
+  AsyncWebSocketMessageBuffer *buffer = ws.makeBuffer((uint8_t *)json, length);
+  if (buffer == NULL)
+  {
+    ws.forEachClient(markZoneClientStale);
+    return;
+  }
+  ws.textAll(buffer, isZoneClientCurrent, markZoneClientStale);
+}
+
+// Messages from clients are small JSON objects with a "type"
+void onWebSocketMessage(AsyncWebSocketClient *client, const uint8_t *data, size_t len)
+{
+  JsonDocument doc(&webJsonArena);
+  if (deserializeJson(doc, data, len))
+  {
+    sendWebSocketError(client, "Invalid JSON");
+    return;
+  }
+
+  const char *type = doc["type"];
+  const char *message = NULL;
+  if (type != NULL && strcmp(type, "zone") == 0)
+  {
+    // Live zone edits, answered with the generation they produced or why
+    // they were rejected; seq is echoed so the client can match the reply
+    uint32_t seq = doc["seq"] | 0;
+    uint32_t generation;
+    char json[128];
+    if (zonesEdit(doc.as<JsonObjectConst>(), &generation, &message))
+    {
+      snprintf(json, sizeof(json), "{\"type\":\"ack\",\"seq\":%u,\"generation\":%u}", (unsigned)seq, (unsigned)generation);
+    }
+    else
+    {
+      snprintf(json, sizeof(json), "{\"type\":\"nack\",\"seq\":%u,\"message\":\"%s\"}", (unsigned)seq, message);
+    }
+    client->text(json);
+  }
+  else if (type != NULL && strcmp(type, "subscribe") == 0)
+  {
+    if (subscriptionsApply(client, doc.as<JsonObjectConst>(), &message))
+    {
+      client->text("{\"type\":\"subscribed\"}");
+    }
+    else
+    {
+      sendWebSocketError(client, message);
+    }
+  }
+  else
+  {
+    sendWebSocketError(client, "Unknown message type");
+  }
+}
+
 // WebSocket event handling
 void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)
 {
   if (type == WS_EVT_CONNECT)
   {
-    Serial.printf("WebSocket client #%u connected from %s\n", client->id(), client->remoteIP().toString().c_str());
+    IPAddress ip = client->remoteIP();
+    logPrint(LOG_WEB, LOG_INFO, "WebSocket client #%u connected from %u.%u.%u.%u", client->id(), ip[0], ip[1], ip[2], ip[3]);
+    sendSnapshot(client, webJsonArena);
   }
   else if (type == WS_EVT_DISCONNECT)
   {
-    Serial.printf("WebSocket client #%u disconnected\n", client->id());
+    subscriptionsRemove(client);
+    logPrint(LOG_WEB, LOG_INFO, "WebSocket client #%u disconnected", client->id());
+  }
+  else if (type == WS_EVT_DATA)
+  {
+    // Only whole text messages in a single frame are expected
+    AwsFrameInfo *info = (AwsFrameInfo *)arg;
+    if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT)
+    {
+      onWebSocketMessage(client, data, len);
+    }
+    else if (info->index == 0)
+    {
+      sendWebSocketError(client, "Expected a single text frame");
+    }
   }
 }
 
@@ -81,9 +377,15 @@ void setup()
   Serial.begin(115200);
   // This delay gives the chance to wait for a Serial Monitor without blocking if none is found
   delay(1500);
+  // Everything after this prints through the log task
+  logBegin();
   ld2450.setNumberOfTargets(3);
-  // SETUP SENSOR USING HARDWARE SERIAL INTERFACE 2
-  ld2450.begin(Serial2, false);
+  ld2450.setWireTiming(SENSOR_WIRE_TIMING);
+  // SETUP SENSOR USING HARDWARE SERIAL INTERFACE 2, frames are parsed as the bytes arrive
+  ld2450.beginEventDriven(Serial2, false);
+  // Answered while loop() reads the first frames
+  ld2450.onCommandResult(onSensorCommand);
+  sensorControlBegin(ld2450);
 
   pinMode(ledPin, OUTPUT);
   digitalWrite(ledPin, LOW);
@@ -99,100 +401,97 @@ void setup()
   server.addHandler(&ws);
 
   // Debugging log
-  Serial.println("WebSocket server initialized.");
-
-  // Set up POST endpoint
-  server.on("/updateZones", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
-            {
-      // Process JSON data
-      StaticJsonDocument<512> doc;
-      DeserializationError error = deserializeJson(doc, data, len);
-
-      if (error) {
-        Serial.print("JSON parsing failed: ");
-        Serial.println(error.c_str());
-        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid JSON\"}");
-        return;
-      }
-
-      // Write JSON data into the Zone struct
-      for (int i = 0; i < 3; i++) {
-        zones[i].x1 = doc[i]["x1"] | zones[i].x1; // Default value if JSON value is missing
-        zones[i].y1 = doc[i]["y1"] | zones[i].y1;
-        zones[i].x2 = doc[i]["x2"] | zones[i].x2;
-        zones[i].y2 = doc[i]["y2"] | zones[i].y2;
-
-        // Debug output
-        Serial.print("Zone ");
-        Serial.print(i + 1);
-        Serial.print(": x1=");
-        Serial.print(zones[i].x1);
-        Serial.print(", y1=");
-        Serial.print(zones[i].y1);
-        Serial.print(", x2=");
-        Serial.print(zones[i].x2);
-        Serial.print(", y2=");
-        Serial.println(zones[i].y2);
-      }
-
-      // Send success message
-      request->send(200, "application/json", "{\"status\":\"success\",\"message\":\"Zones updated\"}"); });
-
-  // Handle GET request for zones
-  server.on("/zones", HTTP_GET, [](AsyncWebServerRequest *request)
-            {
-    StaticJsonDocument<512> doc;
-    
-    // Serialize zones into JSON array
-    JsonArray zonesArray = doc.to<JsonArray>();
-    for (int i = 0; i < 3; i++) {
-      JsonObject zone = zonesArray.createNestedObject();
-      zone["x1"] = zones[i].x1;
-      zone["y1"] = zones[i].y1;
-      zone["x2"] = zones[i].x2;
-      zone["y2"] = zones[i].y2;
-    }
-
-    String jsonResponse;
-    serializeJson(doc, jsonResponse);
-
-    // Send JSON response
-    request->send(200, "application/json", jsonResponse); });
+  logPrint(LOG_SYSTEM, LOG_INFO, "WebSocket server initialized.");
+
+  // Set up POST endpoint, the body is buffered and validated before the zones change
+  server.on("/updateZones", HTTP_POST, onUpdateZonesRequest, NULL, onUpdateZonesBody);
+
+  // Handle GET request for zones, answered from a cached buffer with an ETag
+  server.on("/zones", HTTP_GET, onGetZonesRequest);
+
+  // Prometheus metrics, streamed line by line
+  metricsAddSource(writeSensorMetrics);
+  metricsAddSource(writeWebMetrics);
+  metricsAddSource(subscriptionsWriteMetrics);
+  metricsAddSource(logWriteMetrics);
+  metricsAddSource(regionFilterWriteMetrics);
+  server.on("/metrics", HTTP_GET, onMetricsRequest);
+
+  // The last events of every task as Chrome trace JSON
+  server.on("/trace", HTTP_GET, onTraceRequest);
+
+  // CPU share and stack use of every FreeRTOS task
+  server.on("/tasks", HTTP_GET, onTasksRequest);
+
+  // The log records still in memory
+  server.on("/logs", HTTP_GET, onLogsRequest);
+  // Baud rate and tracking mode of the sensor, changed by loop()
+  server.on("/sensor", HTTP_GET, onSensorRequest);
+  server.on("/sensor", HTTP_POST, onSensorUpdateRequest);
+
+  // Serve the UI exported by npm run build:device. Next.js puts a content hash
+  // in every file name under _next/, so those never change; the pages
+  // themselves are revalidated so a new upload shows up right away.
+  // Registered last so the API routes above are matched first.
+  if (LittleFS.begin())
+  {
+    server.serveStatic("/_next/", LittleFS, "/_next/").setCacheControl("public, max-age=31536000, immutable");
+    server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html").setCacheControl("no-cache");
+  }
+  else
+  {
+    logPrint(LOG_SYSTEM, LOG_ERROR, "LittleFS mount failed, the UI is not served");
+  }
 
   // Start server
   server.begin();
-  Serial.println("HTTP server started.");
+  logPrint(LOG_SYSTEM, LOG_INFO, "HTTP server started.");
 }
 
 void loop()
 {
+  uint32_t loopStart = micros();
+  TraceScope loopTrace(TRACE_LOOP);
+
   // Reconnect to WiFi if connection is lost
   if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("WiFi connection lost. Reconnecting...");
+    TraceScope wifiTrace(TRACE_WIFI);
+    wifiReconnects.inc();
+    logPrint(LOG_WIFI, LOG_WARN, "WiFi connection lost. Reconnecting...");
     setup_wifi();
   }
 
-  last_target_data = "";
-  if (ld2450.read() > 0)
+  // Waits for the next frame instead of spinning on an idle UART
+  uint32_t readStart = micros();
+  int decoded = ld2450.read();
+  uint32_t readDuration = micros() - readStart;
+  traceRecord(TRACE_READ, readStart, decoded);
+  // Targets, presence and zone changes of this frame go out together at
+  // endBatch(), in one TCP write per client
+  ws.beginBatch();
+  if (decoded > 0)
   {
+    // Measured from when the frame's footer arrived
+    uint32_t frameStart = ld2450.getLastFrameTime();
+#if SENSOR_WIRE_TIMING
+    frameWireTime.observe(ld2450.getLastFrameWireTime());
+#endif
     if (ld2450.getTarget(0).valid == 0 && ld2450.getTarget(1).valid == 0 && ld2450.getTarget(2).valid == 0)
     {
       digitalWrite(ledPin, LOW);
       zone1 = false;
       zone2 = false;
       zone3 = false;
-      for (int i = 0; i < ld2450.getSensorSupportedTargetCount(); i++)
-      {
-        StaticJsonDocument<128> doc;
-        doc["id"] = i + 1;
-        doc["x"] = 0;
-        doc["y"] = 0;
-
-        String jsonString;
-        serializeJson(doc, jsonString);
-        ws.textAll(jsonString); // Send to all connected WebSocket clients
-        //delay(100);
-      }
+
+      // Send every target at the origin to the subscribed WebSocket clients
+      TargetFrame frame = {};
+      frame.time = millis();
+      frame.count = ld2450.getSensorSupportedTargetCount();
+      uint32_t publishStart = micros();
+      latestFrameStore(frame);
+      subscriptionsPublishTargets(ws, frame.targets, frame.count);
+      traceRecord(TRACE_PUBLISH, publishStart, frame.count);
+      frameDuration.observe(micros() - frameStart);
     }
     else
     {
@@ -201,30 +500,31 @@ void loop()
       tempZone3 = false;
 
       digitalWrite(ledPin, HIGH);
-      for (int i = 0; i < ld2450.getSensorSupportedTargetCount(); i++)
+      uint32_t zonesStart = micros();
+      Zone zones[ZONE_COUNT];
+      zonesGet(zones);
+      TargetFrame frame = {};
+      frame.time = millis();
+      frame.count = ld2450.getSensorSupportedTargetCount();
+      for (int i = 0; i < frame.count; i++)
       {
         const LD2450::RadarTarget target = ld2450.getTarget(i);
-        // Add target information to the string
-        last_target_data += "TARGET ID=" + String(i + 1) + " X=" + String((target.x)) + "mm, Y=" + String(target.y) + "mm, SPEED=" + String(target.speed) + "cm/s, RESOLUTION=" + String(target.resolution) + "mm, DISTANCE=" + String(target.distance) + "mm, VALID=" + String(target.valid) + "\n";
-        // Send positions via WebSocket
-        StaticJsonDocument<128> doc;
-        doc["id"] = i + 1;
-        doc["x"] = target.x;
-        doc["y"] = target.y;
-
-        String jsonString;
-        serializeJson(doc, jsonString);
-        if (ws.availableForWriteAll()) {
-          ws.textAll(jsonString); // Send to all connected WebSocket clients
-        }
-        //delay(100);
+        logPrint(LOG_SENSOR, LOG_DEBUG, "TARGET ID=%d X=%dmm, Y=%dmm, SPEED=%dcm/s, RESOLUTION=%umm, DISTANCE=%umm, VALID=%d",
+                 i + 1, target.x, target.y, target.speed, target.resolution, target.distance, target.valid);
+        TargetSample &sample = frame.targets[i];
+        sample.x = target.x;
+        sample.y = target.y;
+        sample.speed = target.speed;
+        sample.resolution = target.resolution;
+        sample.distance = target.distance;
 
         // Check if target is within any zone
-        for (int j = 0; j < 3; j++)
+        for (int j = 0; j < ZONE_COUNT; j++)
         {
           if ((target.x) >= zones[j].x1 && (target.x) <= zones[j].x2 && target.y >= zones[j].y1 && target.y <= zones[j].y2)
           {
-            Serial.println("TARGET ID=" + String(i + 1) + " is within ZONE " + String(j + 1));
+            sample.zones |= 1 << j;
+            logPrint(LOG_ZONES, LOG_DEBUG, "TARGET ID=%d is within ZONE %d", i + 1, j + 1);
             switch (j + 1)
             {
             case 1:
@@ -243,21 +543,77 @@ void loop()
       zone1 = tempZone1;
       zone2 = tempZone2;
       zone3 = tempZone3;
+      traceRecord(TRACE_ZONES, zonesStart, frame.count);
+
+      // Send positions to the WebSocket clients, each with what it subscribed to
+      uint32_t publishStart = micros();
+      latestFrameStore(frame);
+      subscriptionsPublishTargets(ws, frame.targets, frame.count);
+      traceRecord(TRACE_PUBLISH, publishStart, frame.count);
+      frameDuration.observe(micros() - frameStart);
+    }
+  }
 
-      Serial.println(last_target_data);
+  // A frame with no targets still shows the sensor is alive. The sensor
+  // stops reporting while it is being configured.
+  SensorAction action = ld2450.isConfiguring() ? SENSOR_NONE : sensorHealth.update(decoded >= 0, millis());
+  switch (action)
+  {
+  case SENSOR_FLUSH:
+    logPrint(LOG_SENSOR, LOG_WARN, "No frame from the sensor for %u ms, resyncing", (unsigned)((micros() - ld2450.getLastFrameTime()) / 1000));
+    ld2450.flush();
+    break;
+  case SENSOR_REINIT:
+    logPrint(LOG_SENSOR, LOG_WARN, "Sensor still silent, setting up Serial2 again");
+    Serial2.end();
+    if (!ld2450.beginEventDriven(Serial2, false))
+    {
+      logPrint(LOG_SENSOR, LOG_ERROR, "Could not set up Serial2 for the sensor");
     }
+    // A sensor left in its configuration mode stays silent
+    else if (!ld2450.endConfigMode())
+    {
+      logPrint(LOG_SENSOR, LOG_WARN, "Could not queue END_CONFIG for the sensor");
+    }
+    break;
+  default:
+    break;
   }
-  else{ 
-      Serial.println("No data received from sensor");
-      Serial2.end();
-      Serial.println("Serial2 closed");
-      delay(1500);
-      ld2450.setNumberOfTargets(3);
-      ld2450.begin(Serial2, false);
-      Serial.println("Serial2 opened");
-      delay(1500);
+
+  // Tell presence subscribers about zones that became occupied or empty
+  uint8_t occupied = (zone1 ? 1 : 0) | (zone2 ? 2 : 0) | (zone3 ? 4 : 0);
+  if (occupied != lastOccupied)
+  {
+    subscriptionsPublishPresence(ws, occupied, occupied ^ lastOccupied);
+    for (int j = 0; j < ZONE_COUNT; j++)
+    {
+      if ((occupied ^ lastOccupied) & (1 << j))
+      {
+        zoneTransitions[j].inc();
+        logPrint(LOG_ZONES, LOG_INFO, "ZONE %d %s", j + 1, (occupied & (1 << j)) ? "occupied" : "empty");
+      }
+    }
+    lastOccupied = occupied;
   }
 
+  broadcastZoneChanges();
+  resyncZoneClients();
+  ws.endBatch();
+  // Programs changed zones into the sensor when SENSOR_REGION_FILTER is on
+  regionFilterUpdate(ld2450, millis());
+  sensorControlUpdate(ld2450);
+
+  uint32_t cleanupStart = micros();
   ws.cleanupClients(); // Ensure WebSocket clients are handled
-  
+  traceRecord(TRACE_WS_CLEANUP, cleanupStart, ws.count());
+
+  tasksSample();
+
+  if (millis() - lastArenaReport >= arenaReportInterval)
+  {
+    lastArenaReport = millis();
+    JsonArena::logStats();
+  }
+
+  loopDuration.observe(micros() - loopStart - readDuration);
 }
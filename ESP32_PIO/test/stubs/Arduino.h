@@ -0,0 +1,351 @@
+#pragma once
+
+// Just enough of the Arduino core to build the LD2450 library, AsyncTCP
+// and the web server on the host.
+// Time is a counter the tests move: delay() and a wait on an empty queue
+// advance it. The UART is a byte buffer, see HardwareSerial below.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// size_t is unsigned int on the ESP32, the web server mixes the two in std::min()
+namespace std
+{
+inline unsigned long min(unsigned long a, unsigned int b)
+{
+  return a < b ? a : b;
+}
+} // namespace std
+
+// By value: decltype(a < b ? a : b) would be a reference to a parameter
+template <class A, class B>
+inline typename std::common_type<A, B>::type min(A a, B b)
+{
+  return a < b ? a : b;
+}
+
+template <class A, class B>
+inline typename std::common_type<A, B>::type max(A a, B b)
+{
+  return a > b ? a : b;
+}
+
+inline uint32_t &fakeMillis()
+{
+  static uint32_t ms = 0;
+  return ms;
+}
+
+inline uint32_t millis()
+{
+  return fakeMillis();
+}
+
+inline uint32_t micros()
+{
+  return fakeMillis() * 1000;
+}
+
+inline void delay(uint32_t ms)
+{
+  fakeMillis() += ms;
+}
+
+// Logging is dropped
+#define log_e(...) ((void)0)
+#define log_w(...) ((void)0)
+#define log_i(...) ((void)0)
+
+inline int ets_printf(const char *, ...)
+{
+  return 0;
+}
+
+// Program memory is ordinary memory on the host
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define FPSTR(p) ((const __FlashStringHelper *)(p))
+#define F(s) FPSTR(s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+#define vsnprintf_P vsnprintf
+class __FlashStringHelper;
+
+#define HEX 16
+#define DEC 10
+
+// Arduino's String over std::string: numbers are appended as text, and
+// searches return -1 instead of npos
+class String : public std::string
+{
+public:
+  String(const char *text = "") : std::string(text ? text : "") {}
+  String(const std::string &text) : std::string(text) {}
+  String(const __FlashStringHelper *text) : String((const char *)text) {}
+  explicit String(char c) : std::string(1, c) {}
+  explicit String(int value, unsigned char base = DEC) : String((long)value, base) {}
+  explicit String(unsigned value, unsigned char base = DEC) : String((unsigned long)value, base) {}
+  explicit String(long value, unsigned char base = DEC) : std::string(base == HEX ? format("%lx", value) : std::to_string(value)) {}
+  explicit String(unsigned long value, unsigned char base = DEC) : std::string(base == HEX ? format("%lx", value) : std::to_string(value)) {}
+  explicit String(double value, unsigned char decimals = 2) : std::string(format("%.*f", decimals, value)) {}
+
+  bool operator!() const { return empty(); }
+
+  bool reserve(size_t size)
+  {
+    std::string::reserve(size);
+    return true;
+  }
+
+  bool concat(const String &text)
+  {
+    append(text);
+    return true;
+  }
+  bool concat(const char *text)
+  {
+    append(text);
+    return true;
+  }
+  bool concat(char c)
+  {
+    push_back(c);
+    return true;
+  }
+  bool concat(int value) { return concat(String(value)); }
+  bool concat(unsigned value) { return concat(String(value)); }
+  bool concat(long value) { return concat(String(value)); }
+  bool concat(unsigned long value) { return concat(String(value)); }
+
+  template <class T>
+  String &operator+=(const T &value)
+  {
+    concat(value);
+    return *this;
+  }
+  String &operator+=(const char *text)
+  {
+    concat(text);
+    return *this;
+  }
+
+  char charAt(size_t index) const { return index < length() ? (*this)[index] : 0; }
+  void setCharAt(size_t index, char c)
+  {
+    if (index < length())
+    {
+      (*this)[index] = c;
+    }
+  }
+  bool equals(const String &other) const { return *this == other; }
+  bool equalsIgnoreCase(const String &other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+  bool startsWith(const String &prefix, size_t offset = 0) const
+  {
+    return offset + prefix.length() <= length() && compare(offset, prefix.length(), prefix) == 0;
+  }
+  bool endsWith(const String &suffix) const
+  {
+    return suffix.length() <= length() && compare(length() - suffix.length(), suffix.length(), suffix) == 0;
+  }
+  int indexOf(char c, size_t from = 0) const { return position(find(c, from)); }
+  int indexOf(const String &text, size_t from = 0) const { return position(find(text, from)); }
+  int lastIndexOf(char c) const { return position(rfind(c)); }
+  int lastIndexOf(const String &text) const { return position(rfind(text)); }
+  String substring(size_t left) const { return left < length() ? String(substr(left)) : String(); }
+  String substring(size_t left, size_t right) const
+  {
+    right = right < length() ? right : length();
+    return left < right ? String(substr(left, right - left)) : String();
+  }
+  void replace(const String &find, const String &with)
+  {
+    for (size_t at = 0; find.length() && (at = this->find(find, at)) != npos; at += with.length())
+    {
+      std::string::replace(at, find.length(), with);
+    }
+  }
+  void replace(char find, char with)
+  {
+    for (char &c : *this)
+    {
+      c = c == find ? with : c;
+    }
+  }
+  void remove(size_t index) { remove(index, npos); }
+  void remove(size_t index, size_t count)
+  {
+    if (index < length())
+    {
+      erase(index, count);
+    }
+  }
+  void toLowerCase()
+  {
+    for (char &c : *this)
+    {
+      c = tolower(c);
+    }
+  }
+  void toUpperCase()
+  {
+    for (char &c : *this)
+    {
+      c = toupper(c);
+    }
+  }
+  void trim()
+  {
+    size_t first = find_first_not_of(" \t\r\n");
+    size_t last = find_last_not_of(" \t\r\n");
+    *this = first == npos ? String() : String(substr(first, last - first + 1));
+  }
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return atof(c_str()); }
+  void getBytes(unsigned char *buffer, size_t size, size_t index = 0) const { toCharArray((char *)buffer, size, index); }
+  void toCharArray(char *buffer, size_t size, size_t index = 0) const
+  {
+    if (size)
+    {
+      size_t n = index < length() ? copy(buffer, size - 1, index) : 0;
+      buffer[n] = 0;
+    }
+  }
+
+private:
+  static int position(size_t at) { return at == npos ? -1 : (int)at; }
+  template <class T>
+  static std::string format(const char *format, T value)
+  {
+    char text[32];
+    snprintf(text, sizeof(text), format, value);
+    return text;
+  }
+  static std::string format(const char *format, int decimals, double value)
+  {
+    char text[64];
+    snprintf(text, sizeof(text), format, decimals, value);
+    return text;
+  }
+};
+
+inline String operator+(const String &a, const String &b)
+{
+  String sum(a);
+  sum += b;
+  return sum;
+}
+inline String operator+(const String &a, const char *b) { return a + String(b); }
+inline String operator+(const char *a, const String &b) { return String(a) + b; }
+inline String operator+(const String &a, char b) { return a + String(b); }
+inline String operator+(const String &a, int b) { return a + String(b); }
+inline String operator+(const String &a, unsigned b) { return a + String(b); }
+inline String operator+(const String &a, long b) { return a + String(b); }
+inline String operator+(const String &a, unsigned long b) { return a + String(b); }
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      write(buffer[i]);
+    }
+    return size;
+  }
+  size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+  size_t println(const char *text) { return print(text) + print("\r\n"); }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  size_t readBytes(uint8_t *buffer, size_t length)
+  {
+    size_t count = 0;
+    int value;
+    while (count < length && (value = read()) >= 0)
+    {
+      buffer[count++] = value;
+    }
+    return count;
+  }
+};
+
+// The sensor's UART: what the library writes collects in sent, receive()
+// hands bytes over the way the driver's event task does
+class HardwareSerial : public Stream
+{
+public:
+  std::vector<uint8_t> sent;
+  uint32_t baud = 0;
+  uint8_t rx_fifo_full = 0;
+
+  void begin(unsigned long rate) { baud = rate; }
+  void updateBaudRate(unsigned long rate) { baud = rate; }
+  bool setRxFIFOFull(uint8_t bytes)
+  {
+    rx_fifo_full = bytes;
+    return true;
+  }
+  bool setRxTimeout(uint8_t) { return true; }
+  void onReceive(std::function<void()> callback) { on_receive = callback; }
+
+  void receive(const uint8_t *buffer, size_t length)
+  {
+    rx.insert(rx.end(), buffer, buffer + length);
+    if (on_receive)
+    {
+      on_receive();
+    }
+  }
+
+  size_t write(uint8_t value) override
+  {
+    sent.push_back(value);
+    return 1;
+  }
+  using Print::write;
+  int available() override { return rx.size() - rx_read; }
+  int read() override { return rx_read < rx.size() ? rx[rx_read++] : -1; }
+  int peek() override { return rx_read < rx.size() ? rx[rx_read] : -1; }
+
+private:
+  std::vector<uint8_t> rx;
+  size_t rx_read = 0;
+  std::function<void()> on_receive;
+};
+
+// The console, nothing reads it
+static HardwareSerial Serial;
+
+// Like the core, Arduino.h brings the FreeRTOS API and esp_err_t along
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
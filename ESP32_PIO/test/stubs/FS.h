@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Arduino.h>
+#include <memory>
+#include <time.h>
+
+// A file system that only knows file names and sizes. Copies of an FS share
+// its files, as the core's do; add() puts a file in.
+
+namespace fs
+{
+enum SeekMode
+{
+  SeekSet,
+  SeekCur,
+  SeekEnd
+};
+
+class File : public Stream
+{
+public:
+  File(const String &path = String(), size_t size = 0) : _path(path), _size(size) {}
+
+  operator bool() const { return _path.length() != 0; }
+  bool isDirectory() { return false; }
+  const char *name() const { return _path.c_str() + _path.lastIndexOf('/') + 1; }
+  const char *path() const { return _path.c_str(); }
+  size_t size() const { return _size; }
+  time_t getLastWrite() { return 0; }
+  void close() { _path = String(); }
+
+  // Its contents are zeros
+  size_t write(uint8_t) override { return 0; }
+  using Print::write;
+  int available() override { return _size - _position; }
+  int read() override { return _position < _size ? (_position++, 0) : -1; }
+  int peek() override { return _position < _size ? 0 : -1; }
+  size_t read(uint8_t *buffer, size_t length)
+  {
+    length = min(length, _size - _position);
+    memset(buffer, 0, length);
+    _position += length;
+    return length;
+  }
+  bool seek(uint32_t position, SeekMode mode = SeekSet)
+  {
+    _position = mode == SeekSet ? position : mode == SeekCur ? _position + position : _size + position;
+    return _position <= _size;
+  }
+  size_t position() const { return _position; }
+
+private:
+  String _path;
+  size_t _size;
+  size_t _position = 0;
+};
+
+class FS
+{
+public:
+  FS() : _files(std::make_shared<std::vector<File>>()) {}
+
+  void add(const char *path, size_t size) { _files->push_back(File(path, size)); }
+
+  File open(const String &path, const char * = "r")
+  {
+    for (const File &file : *_files)
+    {
+      if (path == file.path())
+      {
+        return file;
+      }
+    }
+    return File();
+  }
+  bool exists(const String &path) { return open(path); }
+
+private:
+  std::shared_ptr<std::vector<File>> _files;
+};
+} // namespace fs
+
+using fs::File;
+using fs::FS;
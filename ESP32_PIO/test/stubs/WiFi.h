@@ -0,0 +1,12 @@
+#pragma once
+
+#include <IPAddress.h>
+
+// The station is never connected on the host
+class WiFiClass
+{
+public:
+  IPAddress localIP() { return IPAddress(); }
+};
+
+static WiFiClass WiFi;
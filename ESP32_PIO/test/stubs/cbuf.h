@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+// The core's byte FIFO, grown with resizeAdd()
+class cbuf
+{
+public:
+  cbuf(size_t size) : _size(size) {}
+
+  size_t available() const { return _data.size() - _read; }
+  size_t room() const { return _size - available(); }
+  size_t resizeAdd(size_t add)
+  {
+    _size += add;
+    return _size;
+  }
+  int read()
+  {
+    return available() ? (uint8_t)_data[_read++] : -1;
+  }
+  size_t read(char *dst, size_t size)
+  {
+    size = min(size, available());
+    memcpy(dst, _data.data() + _read, size);
+    _read += size;
+    return size;
+  }
+  size_t write(const char *src, size_t size)
+  {
+    size = min(size, room());
+    _data.append(src, size);
+    return size;
+  }
+
+private:
+  std::string _data;
+  size_t _read = 0;
+  size_t _size;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/task.h"
+
+inline esp_err_t esp_task_wdt_add(TaskHandle_t)
+{
+  return ESP_OK;
+}
+
+inline esp_err_t esp_task_wdt_delete(TaskHandle_t)
+{
+  return ESP_OK;
+}
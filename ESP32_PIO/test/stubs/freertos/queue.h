@@ -0,0 +1,91 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include <stdlib.h>
+
+// A queue of copies with a fixed item size in a ring, as FreeRTOS keeps it.
+// Nothing runs concurrently on the host, so a receive that would block lets
+// the time it waits pass instead.
+struct FakeQueue
+{
+  size_t item_size;
+  size_t capacity;
+  size_t head;
+  size_t count;
+  uint8_t *storage;
+};
+typedef FakeQueue *QueueHandle_t;
+typedef QueueHandle_t xQueueHandle;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  return new FakeQueue{item_size, length, 0, 0, (uint8_t *)calloc(length, item_size)};
+}
+
+inline void vQueueDelete(QueueHandle_t queue)
+{
+  free(queue->storage);
+  delete queue;
+}
+
+inline BaseType_t xQueueReset(QueueHandle_t queue)
+{
+  queue->head = 0;
+  queue->count = 0;
+  return pdTRUE;
+}
+
+inline uint8_t *fakeQueueItem(QueueHandle_t queue, size_t index)
+{
+  return queue->storage + ((queue->head + index) % queue->capacity) * queue->item_size;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t)
+{
+  if (queue->count >= queue->capacity)
+  {
+    return pdFALSE;
+  }
+  memcpy(fakeQueueItem(queue, queue->count), item, queue->item_size);
+  queue->count++;
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t)
+{
+  if (queue->count >= queue->capacity)
+  {
+    return pdFALSE;
+  }
+  queue->head = (queue->head + queue->capacity - 1) % queue->capacity;
+  queue->count++;
+  memcpy(fakeQueueItem(queue, 0), item, queue->item_size);
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  return queue->count;
+}
+
+inline BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait)
+{
+  if (!queue->count)
+  {
+    delay(wait);
+    return pdFALSE;
+  }
+  memcpy(item, fakeQueueItem(queue, 0), queue->item_size);
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+  if (!xQueuePeek(queue, item, wait))
+  {
+    return pdFALSE;
+  }
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->count--;
+  return pdTRUE;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+// Tasks are not started, tests call what they would run
+typedef void *TaskHandle_t;
+
+inline BaseType_t xTaskCreateUniversal(void (*)(void *), const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *handle, BaseType_t)
+{
+  static int task;
+  *handle = &task;
+  return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t)
+{
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string.h>
+
+// Encodes every input as that many 'A's: only lengths matter on the host
+#define base64_encode_expected_len(n) ((((4 * (n)) / 3) + 3) & ~3)
+
+inline int base64_encode_chars(const char *, int length, char *out)
+{
+  int n = base64_encode_expected_len(length);
+  memset(out, 'A', n);
+  out[n] = 0;
+  return n;
+}
+
+typedef struct
+{
+  int length;
+} base64_encodestate;
+
+inline void base64_init_encodestate(base64_encodestate *state)
+{
+  state->length = 0;
+}
+
+inline int base64_encode_block(const char *, int length, char *out, base64_encodestate *state)
+{
+  state->length += length;
+  return 0;
+}
+
+inline int base64_encode_blockend(char *out, base64_encodestate *state)
+{
+  return base64_encode_chars(NULL, state->length, out);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "lwip/ip_addr.h"
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *arg);
+
+// Names are never resolved
+inline err_t dns_gethostbyname(const char *, ip_addr_t *, dns_found_callback, void *)
+{
+  return ERR_VAL;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "lwip/opt.h"
+
+#define IPADDR_TYPE_V4 0
+#define IPADDR_TYPE_ANY 46
+#define IPADDR_ANY ((uint32_t)0x00000000UL)
+
+typedef struct ip4_addr
+{
+  uint32_t addr;
+} ip4_addr_t;
+
+typedef struct ip_addr
+{
+  union
+  {
+    ip4_addr_t ip4;
+  } u_addr;
+  uint8_t type;
+} ip_addr_t;
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "lwip/err.h"
+
+// The ESP32 core's lwIP settings
+#define TCP_MSS 1436
+#define TCP_SND_BUF 5744
+#define TCP_SND_QUEUELEN ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
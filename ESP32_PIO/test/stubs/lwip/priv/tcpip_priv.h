@@ -0,0 +1,16 @@
+#pragma once
+
+#include "lwip/opt.h"
+
+struct tcpip_api_call_data
+{
+  err_t err;
+};
+
+typedef err_t (*tcpip_api_call_fn)(struct tcpip_api_call_data *call);
+
+// The caller is the tcpip thread
+inline err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call)
+{
+  return fn(call);
+}
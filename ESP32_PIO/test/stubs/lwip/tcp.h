@@ -0,0 +1,171 @@
+#pragma once
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+// A connection with lwIP's send side: tcp_write() fills segments of at most
+// mss bytes and takes pbufs from the send queue the way lwIP 2.1 does, and
+// takes a write whole or refuses it. What it accepts is appended to sent,
+// tcp_output() sends every unsent segment and tcp_fake_ack() acks them.
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+#define TCP_PRIO_NORMAL 64
+
+typedef uint32_t tcpwnd_size_t;
+
+struct tcp_pcb
+{
+  int state;
+  ip_addr_t local_ip;
+  ip_addr_t remote_ip;
+  uint16_t local_port;
+  uint16_t remote_port;
+  uint16_t mss;
+  tcpwnd_size_t snd_wnd_max;
+  uint16_t snd_buf;
+  uint16_t snd_queuelen;
+  uint16_t unsent_len;      // bytes in the last unsent segment, 0 for none
+  uint16_t unsent_oversize; // room left in its last pbuf for a copied write
+  uint8_t sent[4 * TCP_SND_BUF];
+  size_t sent_len;
+  unsigned outputs;
+};
+
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *pcb, uint16_t len);
+typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *pcb);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+typedef err_t (*tcp_connected_fn)(void *arg, struct tcp_pcb *pcb, err_t err);
+typedef err_t (*tcp_accept_fn)(void *arg, struct tcp_pcb *pcb, err_t err);
+
+#define tcp_sndbuf(pcb) ((pcb)->snd_buf)
+#define tcp_sndqueuelen(pcb) ((pcb)->snd_queuelen)
+#define tcp_mss(pcb) ((pcb)->mss)
+#define tcp_nagle_disable(pcb) ((void)(pcb))
+#define tcp_nagle_enable(pcb) ((void)(pcb))
+#define tcp_nagle_disabled(pcb) ((void)(pcb), 1)
+
+// A fresh established connection with an empty send queue
+inline void tcp_fake_open(struct tcp_pcb *pcb)
+{
+  *pcb = tcp_pcb();
+  pcb->state = 4;
+  pcb->mss = TCP_MSS;
+  pcb->snd_wnd_max = 8 * TCP_MSS;
+  pcb->snd_buf = TCP_SND_BUF;
+}
+
+// The peer acks everything sent so far
+inline void tcp_fake_ack(struct tcp_pcb *pcb)
+{
+  pcb->snd_buf = TCP_SND_BUF;
+  pcb->snd_queuelen = 0;
+  pcb->unsent_len = 0;
+  pcb->unsent_oversize = 0;
+}
+
+inline err_t tcp_write(struct tcp_pcb *pcb, const void *data, uint16_t len, uint8_t apiflags)
+{
+  if (len > pcb->snd_buf || pcb->snd_queuelen >= TCP_SND_QUEUELEN)
+  {
+    return ERR_MEM;
+  }
+  uint16_t mss = pcb->snd_wnd_max / 2 < pcb->mss ? pcb->snd_wnd_max / 2 : pcb->mss;
+  if (!mss)
+  {
+    mss = pcb->mss;
+  }
+  bool copy = apiflags & TCP_WRITE_FLAG_COPY;
+  bool more = apiflags & TCP_WRITE_FLAG_MORE;
+  uint16_t queuelen = pcb->snd_queuelen;
+  uint16_t unsent = pcb->unsent_len;
+  uint16_t oversize = copy ? pcb->unsent_oversize : 0;
+  uint16_t pos = 0;
+  // Copies first go into the last pbuf's spare room
+  if (oversize)
+  {
+    pos = len < oversize ? len : oversize;
+    unsent += pos;
+    oversize -= pos;
+  }
+  // Then into a pbuf of their own in the rest of the last segment
+  if (pos < len && unsent && unsent < mss)
+  {
+    uint16_t n = len - pos < mss - unsent ? len - pos : mss - unsent;
+    queuelen++;
+    pos += n;
+    unsent += n;
+    oversize = copy && more ? mss - unsent : 0;
+  }
+  // Then into new segments: a pbuf each, or a header and the data when referenced
+  while (pos < len)
+  {
+    uint16_t n = len - pos < mss ? len - pos : mss;
+    queuelen += copy ? 1 : 2;
+    pos += n;
+    unsent = n;
+    oversize = copy && more ? mss - unsent : 0;
+  }
+  if (queuelen > TCP_SND_QUEUELEN || pcb->sent_len + len > sizeof(pcb->sent))
+  {
+    return ERR_MEM;
+  }
+  pcb->snd_queuelen = queuelen;
+  pcb->snd_buf -= len;
+  pcb->unsent_len = unsent;
+  pcb->unsent_oversize = oversize;
+  memcpy(pcb->sent + pcb->sent_len, data, len);
+  pcb->sent_len += len;
+  return ERR_OK;
+}
+
+// The window is open, everything unsent goes out
+inline err_t tcp_output(struct tcp_pcb *pcb)
+{
+  pcb->unsent_len = 0;
+  pcb->unsent_oversize = 0;
+  pcb->outputs++;
+  return ERR_OK;
+}
+
+inline void tcp_arg(struct tcp_pcb *, void *) {}
+inline void tcp_recv(struct tcp_pcb *, tcp_recv_fn) {}
+inline void tcp_sent(struct tcp_pcb *, tcp_sent_fn) {}
+inline void tcp_poll(struct tcp_pcb *, tcp_poll_fn, uint8_t) {}
+inline void tcp_err(struct tcp_pcb *, tcp_err_fn) {}
+inline void tcp_accept(struct tcp_pcb *, tcp_accept_fn) {}
+inline void tcp_recved(struct tcp_pcb *, uint16_t) {}
+inline void tcp_setprio(struct tcp_pcb *, uint8_t) {}
+
+inline err_t tcp_close(struct tcp_pcb *pcb)
+{
+  pcb->state = 0;
+  return ERR_OK;
+}
+
+inline void tcp_abort(struct tcp_pcb *pcb)
+{
+  pcb->state = 0;
+}
+
+// Nothing connects or listens on the host
+inline struct tcp_pcb *tcp_new_ip_type(uint8_t)
+{
+  return NULL;
+}
+
+inline err_t tcp_connect(struct tcp_pcb *, const ip_addr_t *, uint16_t, tcp_connected_fn)
+{
+  return ERR_CONN;
+}
+
+inline err_t tcp_bind(struct tcp_pcb *, const ip_addr_t *, uint16_t)
+{
+  return ERR_USE;
+}
+
+inline struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *, uint8_t)
+{
+  return NULL;
+}
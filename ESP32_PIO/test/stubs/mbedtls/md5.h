@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Hashes nothing: authentication is not tested on the host, every digest is zeros
+typedef struct
+{
+  int unused;
+} mbedtls_md5_context;
+
+inline void mbedtls_md5_init(mbedtls_md5_context *) {}
+inline int mbedtls_md5_starts_ret(mbedtls_md5_context *) { return 0; }
+inline int mbedtls_md5_update_ret(mbedtls_md5_context *, const unsigned char *, size_t) { return 0; }
+inline int mbedtls_md5_finish_ret(mbedtls_md5_context *, unsigned char output[16])
+{
+  memset(output, 0, 16);
+  return 0;
+}
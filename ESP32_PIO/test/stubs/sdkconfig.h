@@ -0,0 +1,4 @@
+#pragma once
+
+// What AsyncTCP reads from the ESP32 core's configuration
+#define CONFIG_LWIP_MAX_ACTIVE_TCP 16
@@ -0,0 +1,210 @@
+#include <Arduino.h>
+// The library's lwIP callbacks and write helpers are static, so it is built
+// into the test. lwIP is the fake in test/stubs/lwip/tcp.h
+#include <AsyncTCP.cpp>
+#include <unity.h>
+#include <stdio.h>
+
+static tcp_pcb pcb;
+static uint8_t payload[2 * TCP_SND_BUF];
+
+void setUp()
+{
+  tcp_fake_open(&pcb);
+  for (size_t i = 0; i < sizeof(payload); i++)
+  {
+    payload[i] = i * 7;
+  }
+}
+
+void tearDown()
+{
+}
+
+// Clients take one of a fixed number of slots, the peer closing hands it back
+static void closeByPeer(AsyncClient &client)
+{
+  AsyncClient::_s_lwip_fin(&client, &pcb, ERR_OK);
+}
+
+// A frame the way a corked webSocketSendFrame() writes it: the header
+// copied, the payload after it, sized by space() for the two writes.
+// Returns the payload length, 0 when the frame has to wait.
+static size_t addFrame(AsyncClient &client, const uint8_t *data, size_t len, uint8_t apiflags = 0)
+{
+  size_t space = client.space(2);
+  if (space < 2 + len)
+  {
+    return 0;
+  }
+  const uint8_t header[2] = {0x82, 0x7E};
+  TEST_ASSERT_EQUAL(2, client.add((const char *)header, 2));
+  if (len)
+  {
+    // A header out without its payload would break the stream
+    TEST_ASSERT_EQUAL(len, client.add((const char *)data, len, apiflags));
+  }
+  return len;
+}
+
+// What a frame of len bytes added by addFrame() looks like on the wire
+static void assertFrames(size_t offset, size_t frames, size_t len)
+{
+  for (size_t f = 0; f < frames; f++)
+  {
+    const uint8_t *frame = pcb.sent + offset + f * (2 + len);
+    TEST_ASSERT_EQUAL_UINT8(0x82, frame[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x7E, frame[1]);
+    if (len)
+    {
+      TEST_ASSERT_EQUAL_MEMORY(payload, frame + 2, len);
+    }
+  }
+}
+
+void test_partial_tcp_write_stops_at_a_segment()
+{
+  AsyncClient client(&pcb);
+  // Four pbufs left: the first segment takes two, a header and its data,
+  // the next two one each in the same TCP segment, the fourth does not fit
+  pcb.snd_queuelen = TCP_SND_QUEUELEN - 4;
+  async_tcp_segment_t segments[4];
+  for (size_t i = 0; i < 4; i++)
+  {
+    segments[i] = {(const char *)payload + i * 100, 100, 0};
+  }
+  TEST_ASSERT_EQUAL(300, client.add(segments, 4));
+  TEST_ASSERT_EQUAL(300, pcb.sent_len);
+  TEST_ASSERT_EQUAL(TCP_SND_QUEUELEN, pcb.snd_queuelen);
+  TEST_ASSERT_EQUAL_MEMORY(payload, pcb.sent, 300);
+  TEST_ASSERT_EQUAL(0, client.space());
+  closeByPeer(client);
+}
+
+void test_corked_batch_stops_before_a_full_queue()
+{
+  AsyncClient client(&pcb);
+  // Room in the send buffer for every frame, but not in the send queue
+  pcb.snd_queuelen = TCP_SND_QUEUELEN - 8;
+  client.cork();
+  size_t frames = 0;
+  while (frames < 16 && addFrame(client, payload, 100))
+  {
+    frames++;
+  }
+  TEST_ASSERT_TRUE(client.send());
+  TEST_ASSERT_TRUE(client.uncork());
+  TEST_ASSERT_TRUE(frames > 0 && frames < 16);
+  TEST_ASSERT_EQUAL(4, pcb.state);
+  TEST_ASSERT_EQUAL(frames * 102, pcb.sent_len);
+  assertFrames(0, frames, 100);
+  char line[128];
+  int used = snprintf(line, sizeof(line), "16 frames of 100 bytes: %u", (unsigned)frames);
+
+  // The rest goes out as the peer acks
+  size_t acks = 0;
+  while (frames < 16)
+  {
+    tcp_fake_ack(&pcb);
+    acks++;
+    size_t offset = pcb.sent_len;
+    size_t more = 0;
+    client.cork();
+    while (frames + more < 16 && addFrame(client, payload, 100))
+    {
+      more++;
+    }
+    TEST_ASSERT_TRUE(client.uncork());
+    TEST_ASSERT_TRUE(more > 0);
+    assertFrames(offset, more, 100);
+    frames += more;
+    used += snprintf(line + used, sizeof(line) - used, ", %u", (unsigned)more);
+  }
+  TEST_ASSERT_EQUAL(4, pcb.state);
+  closeByPeer(client);
+  snprintf(line + used, sizeof(line) - used, " after %u acks", (unsigned)acks);
+  TEST_MESSAGE(line);
+}
+
+// Whatever the queue already holds and however big the frames, a cork
+// only collects what lwIP then takes, flushes in between included
+void test_collected_segments_always_fit()
+{
+  const size_t lengths[] = {0, 1, 60, 125, 700, TCP_MSS - 2, TCP_MSS, 2000, TCP_SND_BUF - 2};
+  const uint16_t windows[] = {8 * TCP_MSS, 2 * 536};
+  const uint8_t flags[] = {0, ASYNC_WRITE_FLAG_COPY};
+  size_t batches = 0;
+  for (uint16_t window : windows)
+  {
+    for (uint8_t apiflags : flags)
+    {
+      for (size_t len : lengths)
+      {
+        for (uint16_t queued = 0; queued < TCP_SND_QUEUELEN; queued++)
+        {
+          tcp_fake_open(&pcb);
+          pcb.snd_wnd_max = window;
+          pcb.snd_queuelen = queued;
+          pcb.unsent_len = queued ? 300 : 0;
+          AsyncClient client(&pcb);
+          client.cork();
+          size_t frames = 0;
+          while (frames < 40 && client.space(2) >= 2 + len)
+          {
+            addFrame(client, payload, len, apiflags);
+            frames++;
+          }
+          TEST_ASSERT_TRUE(client.uncork());
+          TEST_ASSERT_EQUAL(4, pcb.state);
+          assertFrames(0, frames, len);
+          closeByPeer(client);
+          batches++;
+        }
+      }
+    }
+  }
+  char line[64];
+  snprintf(line, sizeof(line), "%u batches", (unsigned)batches);
+  TEST_MESSAGE(line);
+}
+
+// A small payload copied after its header joins it in one write, and the
+// next frame's too: referenced payloads take a pbuf for the header and one
+// for the data, copied ones share pbufs and many more frames fit the queue
+void test_copied_frames_share_pbufs()
+{
+  size_t frames[2];
+  size_t pbufs[2];
+  for (int copy = 0; copy < 2; copy++)
+  {
+    tcp_fake_open(&pcb);
+    AsyncClient client(&pcb);
+    client.cork();
+    frames[copy] = 0;
+    while (frames[copy] < 100 && addFrame(client, payload, 60, copy ? ASYNC_WRITE_FLAG_COPY : 0))
+    {
+      frames[copy]++;
+    }
+    TEST_ASSERT_TRUE(client.uncork());
+    assertFrames(0, frames[copy], 60);
+    pbufs[copy] = pcb.snd_queuelen;
+    closeByPeer(client);
+  }
+  TEST_ASSERT_EQUAL(2 * frames[0], pbufs[0]);
+  TEST_ASSERT_TRUE(pbufs[1] < frames[1]);
+  TEST_ASSERT_TRUE(frames[1] > 2 * frames[0]);
+
+  char line[128];
+  snprintf(line, sizeof(line), "frames of 60 bytes: %u referenced in %u pbufs, %u copied in %u", (unsigned)frames[0], (unsigned)pbufs[0], (unsigned)frames[1], (unsigned)pbufs[1]);
+  TEST_MESSAGE(line);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_partial_tcp_write_stops_at_a_segment);
+  RUN_TEST(test_corked_batch_stops_before_a_full_queue);
+  RUN_TEST(test_collected_segments_always_fit);
+  RUN_TEST(test_copied_frames_share_pbufs);
+  return UNITY_END();
+}
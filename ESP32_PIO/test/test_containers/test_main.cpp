@@ -0,0 +1,245 @@
+#include <StringArray.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+
+// LinkedList as it was before it kept a tail and a count, trimmed to what
+// the benchmark uses: add() and length() walk the list, every add allocates
+template <typename T>
+class OldLinkedList
+{
+  LinkedListNode<T> *_root = nullptr;
+  std::function<void(const T &)> _onRemove;
+
+public:
+  OldLinkedList(std::function<void(const T &)> onRemove) : _onRemove(onRemove) {}
+  void add(const T &t)
+  {
+    auto it = new LinkedListNode<T>(t);
+    if (!_root)
+    {
+      _root = it;
+      return;
+    }
+    auto i = _root;
+    while (i->next)
+    {
+      i = i->next;
+    }
+    i->next = it;
+  }
+  size_t length() const
+  {
+    size_t i = 0;
+    for (auto it = _root; it; it = it->next)
+    {
+      i++;
+    }
+    return i;
+  }
+  bool isEmpty() const { return _root == nullptr; }
+  T &front() const { return _root->value(); }
+  void removeFront()
+  {
+    auto it = _root;
+    _root = _root->next;
+    _onRemove(it->value());
+    delete it;
+  }
+  template <typename F>
+  void each(F f) const
+  {
+    for (auto it = _root; it; it = it->next)
+    {
+      f(it->value());
+    }
+  }
+};
+
+struct Header : public IntrusiveListNode<Header>
+{
+  int name;
+  explicit Header(int n) : name(n) {}
+};
+
+static int removed;
+
+void setUp()
+{
+  removed = 0;
+}
+
+void tearDown()
+{
+}
+
+void test_intrusive_list_add_remove()
+{
+  IntrusiveList<Header> list([](Header *h) { removed++; delete h; });
+  Header *h[5];
+  for (int i = 0; i < 5; i++)
+  {
+    list.add(h[i] = new Header(i));
+  }
+  TEST_ASSERT_EQUAL_UINT32(5, list.length());
+  TEST_ASSERT_TRUE(list.remove(h[2]));
+  TEST_ASSERT_TRUE(list.remove(h[4]));
+  TEST_ASSERT_EQUAL_UINT32(3, list.length());
+  TEST_ASSERT_EQUAL_INT(3, list.nth(2)->name);
+  // Removing the element being visited is allowed
+  for (Header *it : list)
+  {
+    if (it->name == 1)
+    {
+      list.remove(it);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(2, list.length());
+  TEST_ASSERT_EQUAL_INT(0, list.front()->name);
+  TEST_ASSERT_EQUAL_INT(3, list.nth(1)->name);
+  list.add(new Header(5));
+  TEST_ASSERT_EQUAL_INT(5, list.nth(2)->name);
+  list.free();
+  TEST_ASSERT_TRUE(list.isEmpty());
+  TEST_ASSERT_EQUAL_INT(6, removed);
+}
+
+void test_ring_queue_wraps_and_fills()
+{
+  RingQueue<int, 4> queue([](const int &) { removed++; });
+  for (int round = 0; round < 3; round++)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      TEST_ASSERT_TRUE(queue.push(round * 10 + i));
+    }
+    TEST_ASSERT_TRUE(queue.isFull());
+    TEST_ASSERT_FALSE(queue.push(99));
+    TEST_ASSERT_EQUAL_INT(round * 10 + 3, queue[3]);
+    queue.pop();
+    queue.pop();
+    queue.pop();
+    TEST_ASSERT_EQUAL_INT(round * 10 + 3, queue.front());
+    queue.pop();
+    TEST_ASSERT_TRUE(queue.isEmpty());
+  }
+  TEST_ASSERT_TRUE(queue.push(1));
+  TEST_ASSERT_TRUE(queue.push(2));
+  queue.free();
+  TEST_ASSERT_EQUAL_UINT32(0, queue.length());
+  TEST_ASSERT_EQUAL_INT(14, removed);
+}
+
+// ns per call of run, the best of five batches
+template <typename Run>
+static double timeRun(Run run, uint32_t rounds)
+{
+  double best = 0;
+  for (int batch = 0; batch < 5; batch++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+      run();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+    if (batch == 0 || ns < best)
+    {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+static volatile int sink;
+
+// Not a pass/fail check. The request headers: 16 are added, looked up
+// once and freed, as a request does. The headers are allocated either way,
+// the lists differ in the node they allocate and in walking to the tail.
+void test_header_list_benchmark()
+{
+  const int count = 16;
+  double old_list = timeRun([]() {
+    OldLinkedList<Header *> list([](Header *const &h) { delete h; });
+    for (int i = 0; i < count; i++)
+    {
+      list.add(new Header(i));
+    }
+    list.each([](Header *const &h) { sink = sink + h->name; });
+    while (!list.isEmpty())
+    {
+      list.removeFront();
+    }
+  }, 200000);
+  double linked_list = timeRun([]() {
+    LinkedList<Header *> list([](Header *const &h) { delete h; });
+    for (int i = 0; i < count; i++)
+    {
+      list.add(new Header(i));
+    }
+    for (Header *const &h : list)
+    {
+      sink = sink + h->name;
+    }
+    list.free();
+  }, 200000);
+  double intrusive = timeRun([]() {
+    IntrusiveList<Header> list([](Header *h) { delete h; });
+    for (int i = 0; i < count; i++)
+    {
+      list.add(new Header(i));
+    }
+    for (Header *h : list)
+    {
+      sink = sink + h->name;
+    }
+    list.free();
+  }, 200000);
+  char line[160];
+  snprintf(line, sizeof(line), "16 headers: old LinkedList %.0f ns, LinkedList %.0f ns, IntrusiveList %.0f ns", old_list, linked_list, intrusive);
+  TEST_MESSAGE(line);
+}
+
+// Not a pass/fail check. A WebSocket client's message queue: filled to
+// WS_MAX_QUEUED_MESSAGES with the length checked before every message as
+// _queueMessage() did, then drained from the front
+void test_message_queue_benchmark()
+{
+  static int message;
+  const size_t limit = 8;
+  double old_list = timeRun([]() {
+    OldLinkedList<int *> queue([](int *const &) {});
+    while (queue.length() < limit)
+    {
+      queue.add(&message);
+    }
+    while (!queue.isEmpty())
+    {
+      queue.removeFront();
+    }
+  }, 500000);
+  double ring = timeRun([]() {
+    RingQueue<int *, limit> queue([](int *const &) {});
+    while (queue.push(&message))
+    {
+    }
+    while (!queue.isEmpty())
+    {
+      queue.pop();
+    }
+  }, 500000);
+  char line[160];
+  snprintf(line, sizeof(line), "8 messages: old LinkedList %.0f ns, RingQueue %.0f ns", old_list, ring);
+  TEST_MESSAGE(line);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_intrusive_list_add_remove);
+  RUN_TEST(test_ring_queue_wraps_and_fills);
+  RUN_TEST(test_header_list_benchmark);
+  RUN_TEST(test_message_queue_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,341 @@
+#include <LD2450.h>
+#include <unity.h>
+
+// Frames as the sensor sends them, from the LD2450 protocol document
+static const uint8_t ACK_ENABLE_CONFIG[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x08, 0x00, 0xFF, 0x01, 0x00, 0x00, 0x01, 0x00, 0x40, 0x00, 0x04, 0x03, 0x02, 0x01};
+static const uint8_t ACK_END_CONFIG[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x04, 0x00, 0xFE, 0x01, 0x00, 0x00, 0x04, 0x03, 0x02, 0x01};
+static const uint8_t ACK_FIRMWARE[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x0C, 0x00, 0xA0, 0x01, 0x00, 0x00, 0x00, 0x01, 0x07, 0x01, 0x16, 0x15, 0x09, 0x22, 0x04, 0x03, 0x02, 0x01};
+static const uint8_t ACK_MAC[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x0A, 0x00, 0xA5, 0x01, 0x00, 0x00, 0x8F, 0x27, 0x2E, 0xB8, 0x0F, 0x65, 0x04, 0x03, 0x02, 0x01};
+static const uint8_t ACK_TRACKING_MULTI[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x06, 0x00, 0x91, 0x01, 0x00, 0x00, 0x02, 0x00, 0x04, 0x03, 0x02, 0x01};
+static const uint8_t ACK_BAUD_REFUSED[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x04, 0x00, 0xA1, 0x01, 0x01, 0x00, 0x04, 0x03, 0x02, 0x01};
+static const uint8_t ACK_BAUD[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x04, 0x00, 0xA1, 0x01, 0x00, 0x00, 0x04, 0x03, 0x02, 0x01};
+static const uint8_t ACK_RESTART[] = {0xFD, 0xFC, 0xFB, 0xFA, 0x04, 0x00, 0xA3, 0x01, 0x00, 0x00, 0x04, 0x03, 0x02, 0x01};
+// One target at x -782 mm, y 1713 mm, moving at -16 cm/s
+static const uint8_t REPORT[] = {0xAA, 0xFF, 0x03, 0x00, 0x0E, 0x03, 0xB1, 0x86, 0x10, 0x00, 0x40, 0x01, 0x00, 0x00, 0x00,
+                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x55, 0xCC};
+
+struct Result
+{
+  uint16_t command;
+  int result;
+};
+
+static HardwareSerial uart;
+static LD2450 *sensor;
+static std::vector<Result> results;
+
+static void onResult(uint16_t command, int result)
+{
+  results.push_back({command, result});
+}
+
+static void receive(const std::vector<uint8_t> &bytes)
+{
+  uart.receive(bytes.data(), bytes.size());
+}
+
+template <size_t N>
+static std::vector<uint8_t> frame(const uint8_t (&bytes)[N])
+{
+  return std::vector<uint8_t>(bytes, bytes + N);
+}
+
+static std::vector<uint8_t> operator+(std::vector<uint8_t> a, const std::vector<uint8_t> &b)
+{
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+// Checks the library sent exactly the command frame given since sent was
+// cleared
+static void expectFrame(uint16_t command, std::vector<uint8_t> value = {})
+{
+  std::vector<uint8_t> expected = {0xFD, 0xFC, 0xFB, 0xFA, (uint8_t)(2 + value.size()), 0x00, (uint8_t)(command & 0xFF), (uint8_t)(command >> 8)};
+  expected = expected + value + std::vector<uint8_t>{0x04, 0x03, 0x02, 0x01};
+  TEST_ASSERT_EQUAL_UINT32(expected.size(), uart.sent.size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected.data(), uart.sent.data(), expected.size());
+}
+
+// Runs read() once, which sends the next command
+static void expectSent(uint16_t command, std::vector<uint8_t> value = {})
+{
+  uart.sent.clear();
+  sensor->read();
+  expectFrame(command, value);
+}
+
+static void expectResult(size_t index, uint16_t command, int result)
+{
+  TEST_ASSERT_TRUE(index < results.size());
+  TEST_ASSERT_EQUAL_HEX16(command, results[index].command);
+  TEST_ASSERT_EQUAL_INT(result, results[index].result);
+}
+
+// Runs read() until there are count results or ms have passed
+static void readUntil(size_t count, uint32_t ms)
+{
+  uint32_t start = millis();
+  while (results.size() < count && millis() - start < ms)
+  {
+    uart.sent.clear();
+    sensor->read();
+  }
+  TEST_ASSERT_EQUAL_UINT32(count, results.size());
+}
+
+// A switch to 460800 that the sensor answers in full; the UART is then
+// switched and waits for a frame at the new rate
+static void acceptBaudSwitch()
+{
+  TEST_ASSERT_TRUE(sensor->switchBaudRate(460800));
+  expectSent(LD2450_CMD_ENABLE_CONFIG, {0x01, 0x00});
+  receive(frame(ACK_ENABLE_CONFIG));
+  expectSent(LD2450_CMD_SET_BAUD_RATE, {0x08, 0x00});
+  receive(frame(ACK_BAUD));
+  expectSent(LD2450_CMD_RESTART);
+  receive(frame(ACK_RESTART));
+  sensor->read();
+  TEST_ASSERT_EQUAL_UINT32(3, results.size());
+  expectResult(2, LD2450_CMD_RESTART, LD2450_COMMAND_OK);
+  TEST_ASSERT_EQUAL_UINT32(460800, uart.baud);
+  TEST_ASSERT_TRUE(sensor->isConfiguring());
+}
+
+void setUp()
+{
+  uart = HardwareSerial();
+  results.clear();
+  sensor = new LD2450();
+  TEST_ASSERT_TRUE(sensor->beginEventDriven(uart));
+  sensor->onCommandResult(onResult);
+}
+
+void tearDown()
+{
+  delete sensor;
+}
+
+void test_acks_are_matched_to_their_commands()
+{
+  TEST_ASSERT_TRUE(sensor->requestFirmwareVersion());
+  TEST_ASSERT_TRUE(sensor->isConfiguring());
+
+  expectSent(LD2450_CMD_ENABLE_CONFIG, {0x01, 0x00});
+  receive(frame(ACK_ENABLE_CONFIG));
+  expectSent(LD2450_CMD_FIRMWARE_VERSION);
+  // An answer to another command is not taken for this one
+  receive(frame(ACK_MAC));
+  sensor->read();
+  TEST_ASSERT_EQUAL_UINT32(1, results.size());
+  receive(frame(ACK_FIRMWARE));
+  expectSent(LD2450_CMD_END_CONFIG);
+  receive(frame(ACK_END_CONFIG));
+  sensor->read();
+
+  TEST_ASSERT_FALSE(sensor->isConfiguring());
+  TEST_ASSERT_EQUAL_UINT32(3, results.size());
+  expectResult(0, LD2450_CMD_ENABLE_CONFIG, LD2450_COMMAND_OK);
+  expectResult(1, LD2450_CMD_FIRMWARE_VERSION, LD2450_COMMAND_OK);
+  expectResult(2, LD2450_CMD_END_CONFIG, LD2450_COMMAND_OK);
+  const LD2450::SensorInfo &info = sensor->getSensorInfo();
+  TEST_ASSERT_TRUE(info.firmware_valid);
+  TEST_ASSERT_EQUAL_HEX16(0x0107, info.firmware_major);
+  TEST_ASSERT_EQUAL_HEX32(0x22091516, info.firmware_minor);
+  TEST_ASSERT_FALSE(info.mac_valid);
+}
+
+void test_refused_baud_rate_ends_the_configuration_mode()
+{
+  TEST_ASSERT_TRUE(sensor->switchBaudRate(460800));
+  // A second switch or anything else waits until this one is done
+  TEST_ASSERT_FALSE(sensor->switchBaudRate(115200));
+
+  expectSent(LD2450_CMD_ENABLE_CONFIG, {0x01, 0x00});
+  receive(frame(ACK_ENABLE_CONFIG));
+  expectSent(LD2450_CMD_SET_BAUD_RATE, {0x08, 0x00});
+  receive(frame(ACK_BAUD_REFUSED));
+  // The restart is skipped, the sensor is told to leave the configuration mode
+  expectSent(LD2450_CMD_END_CONFIG);
+  receive(frame(ACK_END_CONFIG));
+  sensor->read();
+
+  TEST_ASSERT_FALSE(sensor->isConfiguring());
+  TEST_ASSERT_EQUAL_UINT32(5, results.size());
+  expectResult(1, LD2450_CMD_SET_BAUD_RATE, LD2450_COMMAND_FAILED);
+  expectResult(2, LD2450_CMD_RESTART, LD2450_COMMAND_ABORTED);
+  expectResult(3, LD2450_CMD_END_CONFIG, LD2450_COMMAND_OK);
+  expectResult(4, LD2450_BAUD_SWITCHED, LD2450_COMMAND_FAILED);
+  TEST_ASSERT_EQUAL_UINT32(LD2450_SERIAL_SPEED, sensor->getBaudRate());
+  TEST_ASSERT_EQUAL_UINT32(LD2450_SERIAL_SPEED, uart.baud);
+}
+
+void test_unanswered_command_times_out()
+{
+  TEST_ASSERT_TRUE(sensor->requestMacAddress());
+
+  expectSent(LD2450_CMD_ENABLE_CONFIG, {0x01, 0x00});
+  receive(frame(ACK_ENABLE_CONFIG));
+  expectSent(LD2450_CMD_MAC_ADDRESS, {0x01, 0x00});
+  uint32_t sent = millis();
+  // read() comes back every LD2450_COMMAND_POLL ms while the command is out
+  while (results.size() < 2)
+  {
+    uart.sent.clear();
+    sensor->read();
+  }
+  TEST_ASSERT_TRUE(millis() - sent >= LD2450_ACK_TIMEOUT);
+  expectResult(1, LD2450_CMD_MAC_ADDRESS, LD2450_COMMAND_TIMEOUT);
+
+  // The configuration mode is still ended, a late answer is not taken for it
+  TEST_ASSERT_TRUE(sensor->isConfiguring());
+  expectFrame(LD2450_CMD_END_CONFIG);
+  receive(frame(ACK_MAC) + frame(ACK_END_CONFIG));
+  sensor->read();
+
+  TEST_ASSERT_FALSE(sensor->isConfiguring());
+  TEST_ASSERT_EQUAL_UINT32(3, results.size());
+  expectResult(2, LD2450_CMD_END_CONFIG, LD2450_COMMAND_OK);
+  TEST_ASSERT_FALSE(sensor->getSensorInfo().mac_valid);
+}
+
+void test_reports_interleaved_with_acks()
+{
+  TEST_ASSERT_TRUE(sensor->requestTrackingMode());
+  expectSent(LD2450_CMD_ENABLE_CONFIG, {0x01, 0x00});
+
+  // Reports keep coming in the configuration mode, in the same handover as
+  // an ACK or around one cut in two
+  receive(frame(REPORT) + frame(ACK_ENABLE_CONFIG) + frame(REPORT));
+  TEST_ASSERT_EQUAL_INT(LD2450_MAX_SENSOR_TARGETS, sensor->read());
+  TEST_ASSERT_EQUAL_INT(LD2450_MAX_SENSOR_TARGETS, sensor->read());
+  expectResult(0, LD2450_CMD_ENABLE_CONFIG, LD2450_COMMAND_OK);
+
+  std::vector<uint8_t> ack = frame(ACK_TRACKING_MULTI);
+  receive(frame(REPORT) + std::vector<uint8_t>(ack.begin(), ack.begin() + 7));
+  receive(std::vector<uint8_t>(ack.begin() + 7, ack.end()) + frame(REPORT));
+  TEST_ASSERT_EQUAL_INT(LD2450_MAX_SENSOR_TARGETS, sensor->read());
+  TEST_ASSERT_EQUAL_INT(LD2450_MAX_SENSOR_TARGETS, sensor->read());
+  expectResult(1, LD2450_CMD_QUERY_TRACKING, LD2450_COMMAND_OK);
+  TEST_ASSERT_TRUE(sensor->getSensorInfo().tracking_valid);
+  TEST_ASSERT_TRUE(sensor->getSensorInfo().multi_target);
+
+  LD2450::RadarTarget target = sensor->getTarget(0);
+  TEST_ASSERT_TRUE(target.valid);
+  TEST_ASSERT_EQUAL_INT16(-782, target.x);
+  TEST_ASSERT_EQUAL_INT16(1713, target.y);
+  TEST_ASSERT_EQUAL_INT16(-16, target.speed);
+  TEST_ASSERT_EQUAL_UINT16(320, target.resolution);
+  TEST_ASSERT_FALSE(sensor->getTarget(1).valid);
+
+  const LD2450::Stats &stats = sensor->getStats();
+  TEST_ASSERT_EQUAL_UINT32(4, stats.frames);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.acks);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.dropped);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.skipped);
+}
+
+void test_baud_switch_succeeds()
+{
+  acceptBaudSwitch();
+  receive(frame(REPORT));
+  readUntil(4, 1000);
+  expectResult(3, LD2450_BAUD_SWITCHED, LD2450_COMMAND_OK);
+  TEST_ASSERT_EQUAL_UINT32(460800, sensor->getBaudRate());
+  TEST_ASSERT_FALSE(sensor->isConfiguring());
+}
+
+void test_sensor_already_at_the_new_rate()
+{
+  // It does not understand the old rate, so nothing is answered
+  TEST_ASSERT_TRUE(sensor->switchBaudRate(460800));
+  expectSent(LD2450_CMD_ENABLE_CONFIG, {0x01, 0x00});
+  readUntil(3, 1000);
+  expectResult(0, LD2450_CMD_ENABLE_CONFIG, LD2450_COMMAND_TIMEOUT);
+  expectResult(1, LD2450_CMD_SET_BAUD_RATE, LD2450_COMMAND_ABORTED);
+  expectResult(2, LD2450_CMD_RESTART, LD2450_COMMAND_ABORTED);
+  // END_CONFIG still goes out at the old rate before the new one is tried
+  expectFrame(LD2450_CMD_END_CONFIG);
+  TEST_ASSERT_EQUAL_UINT32(LD2450_SERIAL_SPEED, uart.baud);
+  readUntil(4, 1000);
+  expectResult(3, LD2450_CMD_END_CONFIG, LD2450_COMMAND_TIMEOUT);
+  TEST_ASSERT_EQUAL_UINT32(460800, uart.baud);
+
+  receive(frame(REPORT));
+  readUntil(5, 1000);
+  expectResult(4, LD2450_BAUD_SWITCHED, LD2450_COMMAND_OK);
+  TEST_ASSERT_EQUAL_UINT32(460800, sensor->getBaudRate());
+}
+
+void test_silently_refused_rate_falls_back()
+{
+  // Every command is acknowledged but the sensor comes back at the old rate
+  acceptBaudSwitch();
+  uint32_t switched = millis();
+  while (uart.baud != LD2450_SERIAL_SPEED && millis() - switched < 2 * LD2450_BAUD_VERIFY)
+  {
+    sensor->read();
+  }
+  TEST_ASSERT_EQUAL_UINT32(LD2450_SERIAL_SPEED, uart.baud);
+  TEST_ASSERT_TRUE(millis() - switched >= LD2450_BAUD_VERIFY);
+  TEST_ASSERT_EQUAL_UINT32(3, results.size());
+
+  receive(frame(REPORT));
+  readUntil(4, 1000);
+  expectResult(3, LD2450_BAUD_SWITCHED, LD2450_COMMAND_FAILED);
+  TEST_ASSERT_EQUAL_UINT32(LD2450_SERIAL_SPEED, sensor->getBaudRate());
+  TEST_ASSERT_FALSE(sensor->isConfiguring());
+}
+
+void test_no_frames_at_either_rate()
+{
+  acceptBaudSwitch();
+  readUntil(4, 2 * LD2450_BAUD_VERIFY + 500);
+  expectResult(3, LD2450_BAUD_SWITCHED, LD2450_COMMAND_TIMEOUT);
+  TEST_ASSERT_EQUAL_UINT32(LD2450_SERIAL_SPEED, uart.baud);
+  TEST_ASSERT_FALSE(sensor->isConfiguring());
+}
+
+void test_wire_time_of_a_whole_frame_handover()
+{
+  TEST_ASSERT_EQUAL_UINT8(LD2450_RX_FIFO_FULL, uart.rx_fifo_full);
+  receive(frame(REPORT));
+  TEST_ASSERT_EQUAL_INT(LD2450_MAX_SENSOR_TARGETS, sensor->read());
+  // Counted back from the handover: 29 bytes of 10 bits at 256000 baud
+  TEST_ASSERT_EQUAL_UINT32(1132, sensor->getLastFrameWireTime());
+}
+
+void test_wire_timing_measures_the_handovers()
+{
+  sensor->setWireTiming(true);
+  TEST_ASSERT_EQUAL_UINT8(1, uart.rx_fifo_full);
+  TEST_ASSERT_TRUE(sensor->beginEventDriven(uart));
+  TEST_ASSERT_EQUAL_UINT8(1, uart.rx_fifo_full);
+
+  // A byte every ms, far slower than the line, so only a measurement gets it
+  for (uint8_t value : frame(REPORT))
+  {
+    receive({value});
+    delay(1);
+  }
+  TEST_ASSERT_EQUAL_INT(LD2450_MAX_SENSOR_TARGETS, sensor->read());
+  TEST_ASSERT_EQUAL_UINT32(29000, sensor->getLastFrameWireTime());
+
+  sensor->setWireTiming(false);
+  TEST_ASSERT_EQUAL_UINT8(LD2450_RX_FIFO_FULL, uart.rx_fifo_full);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_acks_are_matched_to_their_commands);
+  RUN_TEST(test_refused_baud_rate_ends_the_configuration_mode);
+  RUN_TEST(test_unanswered_command_times_out);
+  RUN_TEST(test_reports_interleaved_with_acks);
+  RUN_TEST(test_baud_switch_succeeds);
+  RUN_TEST(test_sensor_already_at_the_new_rate);
+  RUN_TEST(test_silently_refused_rate_falls_back);
+  RUN_TEST(test_no_frames_at_either_rate);
+  RUN_TEST(test_wire_time_of_a_whole_frame_handover);
+  RUN_TEST(test_wire_timing_measures_the_handovers);
+  return UNITY_END();
+}
@@ -0,0 +1,251 @@
+#include <Arduino.h>
+// The web server is built into the test with AsyncTCP under it, against the
+// fakes in test/stubs. It is 32-bit code: its printf formats take size_t
+// for unsigned int, which the host does not.
+#include <AsyncTCP.cpp>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat"
+#include <WebServer.cpp>
+#include <WebRequest.cpp>
+#include <WebHandlers.cpp>
+#include <WebResponses.cpp>
+#include <WebRouteTable.cpp>
+#include <WebAuthentication.cpp>
+#include <AsyncWebSocket.cpp>
+#pragma GCC diagnostic pop
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+void *pxCurrentTCB; // the running task, for AsyncWebLock
+
+class RouteServer : public AsyncWebServer
+{
+public:
+  RouteServer() : AsyncWebServer(80) {}
+  using AsyncWebServer::_findHandler;
+  size_t handlers() const { return _handlers.length(); }
+};
+
+static RouteServer *server;
+static AsyncWebSocket *ws;
+static FS files;
+
+// The handlers setup() in main_zone.cpp registers, in the same order
+static AsyncWebHandler *zonesUpdate;
+static AsyncWebHandler *zones;
+static AsyncWebHandler *metrics;
+static AsyncWebHandler *sensorGet;
+static AsyncWebHandler *sensorPost;
+static AsyncWebHandler *nextAssets;
+static AsyncWebHandler *pages;
+
+static void addFirmwareRoutes()
+{
+  ArRequestHandlerFunction answer = [](AsyncWebServerRequest *) {};
+  ArBodyHandlerFunction body = [](AsyncWebServerRequest *, uint8_t *, size_t, size_t, size_t) {};
+  server->addHandler(ws);
+  zonesUpdate = &server->on("/updateZones", HTTP_POST, answer, NULL, body);
+  zones = &server->on("/zones", HTTP_GET, answer);
+  metrics = &server->on("/metrics", HTTP_GET, answer);
+  server->on("/trace", HTTP_GET, answer);
+  server->on("/tasks", HTTP_GET, answer);
+  server->on("/logs", HTTP_GET, answer);
+  sensorGet = &server->on("/sensor", HTTP_GET, answer);
+  sensorPost = &server->on("/sensor", HTTP_POST, answer);
+  nextAssets = &server->serveStatic("/_next/", files, "/_next/").setCacheControl("public, max-age=31536000, immutable");
+  pages = &server->serveStatic("/", files, "/").setDefaultFile("index.html").setCacheControl("no-cache");
+}
+
+void setUp()
+{
+  files = FS();
+  // What npm run build:device exports
+  files.add("/index.html", 12000);
+  files.add("/settings/index.html", 9000);
+  files.add("/404.html", 3000);
+  files.add("/favicon.ico", 15000);
+  files.add("/_next/static/chunks/main-4f1c.js.gz", 40000);
+  files.add("/_next/static/chunks/pages/index-9a2b.js.gz", 8000);
+  files.add("/_next/static/css/app-77de.css", 6000);
+  server = new RouteServer();
+  ws = new AsyncWebSocket("/ws");
+  addFirmwareRoutes();
+}
+
+// The server deletes its handlers, the WebSocket with them
+void tearDown()
+{
+  delete server;
+}
+
+// A request that has been through the parser up to its last header, the
+// point where the server picks its handler
+struct Request
+{
+  AsyncClient client;
+  AsyncWebServerRequest request;
+
+  Request(const char *method, const char *url, bool upgrade = false) : request(server, &client)
+  {
+    String head = String(method) + " " + url + " HTTP/1.1\r\nHost: 192.168.4.1\r\n";
+    if (upgrade)
+    {
+      head += "Connection: Upgrade\r\nUpgrade: websocket\r\n";
+    }
+    pbuf pb = pbuf();
+    pb.payload = &head[0];
+    pb.len = pb.tot_len = head.length();
+    pb.ref = 1;
+    AsyncClient::_s_recv(&client, NULL, &pb, ERR_OK);
+  }
+};
+
+static AsyncWebHandler *route(Request &r, bool table)
+{
+  server->useRouteTable(table);
+  return server->_findHandler(&r.request);
+}
+
+void test_firmware_routes()
+{
+  struct
+  {
+    const char *method;
+    const char *url;
+    bool upgrade;
+    AsyncWebHandler *handler;
+  } cases[] = {
+      {"GET", "/ws", true, ws},
+      {"POST", "/updateZones", false, zonesUpdate},
+      {"GET", "/zones", false, zones},
+      {"GET", "/metrics", false, metrics},
+      {"GET", "/sensor", false, sensorGet},
+      {"POST", "/sensor", false, sensorPost},
+      {"GET", "/_next/static/chunks/main-4f1c.js", false, nextAssets},
+      {"GET", "/", false, pages},
+      {"GET", "/settings/", false, pages},
+      {"GET", "/favicon.ico", false, pages},
+      {"GET", "/ws", false, NULL},
+      {"GET", "/updateZones", false, NULL},
+      {"GET", "/_next/static/missing.js", false, NULL},
+      {"GET", "/missing", false, NULL},
+  };
+  for (auto &c : cases)
+  {
+    Request r(c.method, c.url, c.upgrade);
+    TEST_ASSERT_TRUE(route(r, true) == c.handler);
+    TEST_ASSERT_TRUE(route(r, false) == c.handler);
+  }
+  // The table never fell back, only the scans asked for went through the list
+  TEST_ASSERT_EQUAL(sizeof(cases) / sizeof(cases[0]), server->routeStats().linear);
+}
+
+static const char *const methods[] = {"GET", "POST", "PUT", "DELETE"};
+static const char *const urls[] = {
+    "/", "//", "/index.html", "/settings", "/settings/", "/favicon.ico", "/404.html",
+    "/ws", "/ws/", "/wss", "/zones", "/zones/", "/zones/1", "/zonesx", "/updateZones",
+    "/metrics", "/metrics?x=1", "/trace", "/tasks", "/logs", "/logs/old", "/sensor", "/sensor/baud",
+    "/_next", "/_next/", "/_nextx/a", "/_next/static/chunks/main-4f1c.js",
+    "/_next/static/chunks/pages/index-9a2b.js", "/_next/static/css/app-77de.css", "/missing"};
+
+// Every method and url, a WebSocket upgrade or not: the table picks the
+// handler the linear scan picks
+void test_table_matches_linear_scan()
+{
+  size_t compared = 0;
+  for (const char *method : methods)
+  {
+    for (const char *url : urls)
+    {
+      for (int upgrade = 0; upgrade < 2; upgrade++)
+      {
+        Request r(method, url, upgrade);
+        AsyncWebHandler *table = route(r, true);
+        AsyncWebHandler *linear = route(r, false);
+        if (table != linear)
+        {
+          printf("  %s %s%s\n", method, url, upgrade ? " (upgrade)" : "");
+        }
+        TEST_ASSERT_TRUE(table == linear);
+        compared++;
+      }
+    }
+  }
+  char line[64];
+  snprintf(line, sizeof(line), "%u requests routed alike", (unsigned)compared);
+  TEST_MESSAGE(line);
+}
+
+// ns per request over the set, the best of five batches, and the handlers asked
+static double timeRouting(std::vector<Request *> &requests, bool table, uint32_t &evaluated)
+{
+  server->resetRouteStats();
+  for (Request *r : requests)
+  {
+    route(*r, table);
+  }
+  evaluated = server->routeStats().evaluated;
+  double best = 0;
+  for (int batch = 0; batch < 5; batch++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < 2000; round++)
+    {
+      for (Request *r : requests)
+      {
+        route(*r, table);
+      }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / (2000 * requests.size());
+    if (batch == 0 || ns < best)
+    {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+// Not a pass/fail check. What loading the UI asks for: the page, its
+// assets, the API calls and the WebSocket, and a miss
+void test_routing_benchmark()
+{
+  std::vector<Request *> requests = {
+      new Request("GET", "/"),
+      new Request("GET", "/_next/static/chunks/main-4f1c.js"),
+      new Request("GET", "/_next/static/chunks/pages/index-9a2b.js"),
+      new Request("GET", "/_next/static/css/app-77de.css"),
+      new Request("GET", "/favicon.ico"),
+      new Request("GET", "/ws", true),
+      new Request("GET", "/zones"),
+      new Request("GET", "/sensor"),
+      new Request("POST", "/updateZones"),
+      new Request("GET", "/metrics"),
+      new Request("GET", "/missing"),
+  };
+  uint32_t linearAsked;
+  uint32_t tableAsked;
+  double linear = timeRouting(requests, false, linearAsked);
+  double table = timeRouting(requests, true, tableAsked);
+  TEST_ASSERT_EQUAL(0, server->routeStats().linear);
+  for (Request *r : requests)
+  {
+    delete r;
+  }
+
+  char line[160];
+  snprintf(line, sizeof(line), "%u requests, %u handlers: linear scan %.0f ns a request, %u handlers asked; route table %.0f ns, %u asked",
+           (unsigned)requests.size(), (unsigned)server->handlers(), linear, (unsigned)linearAsked, table, (unsigned)tableAsked);
+  TEST_MESSAGE(line);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_firmware_routes);
+  RUN_TEST(test_table_matches_linear_scan);
+  RUN_TEST(test_routing_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,299 @@
+#include <Arduino.h>
+// The event queue and the lwIP callbacks are static, so the library is built
+// into the test, against the fake lwIP and FreeRTOS queue in test/stubs
+#include <AsyncTCP.cpp>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+// A connect/disconnect storm: the queue is full of data received for every
+// client, then half of them go away before the async_tcp task gets to it
+static const size_t client_count = CONFIG_LWIP_MAX_ACTIVE_TCP;
+static AsyncClient *clients[client_count];
+static pbuf pbufs[256]; // one per queued event, they tell the events apart
+
+static bool tornDown(size_t client)
+{
+  return client % 2 == 0;
+}
+
+static void useQueue(size_t depth)
+{
+  if (_async_queue)
+  {
+    vQueueDelete(_async_queue);
+  }
+  _async_queue = xQueueCreate(depth, sizeof(lwip_event_packet_t *));
+}
+
+void setUp()
+{
+  for (size_t c = 0; c < client_count; c++)
+  {
+    clients[c] = new AsyncClient();
+  }
+}
+
+void tearDown()
+{
+  for (size_t c = 0; c < client_count; c++)
+  {
+    delete clients[c];
+  }
+}
+
+// Fills the queue the way lwIP does, through _tcp_recv(), round robin
+static void fillQueue(size_t depth)
+{
+  for (size_t i = 0; i < depth; i++)
+  {
+    pbufs[i] = pbuf();
+    pbufs[i].ref = 1;
+    TEST_ASSERT_EQUAL(ERR_OK, _tcp_recv(clients[i % client_count], NULL, &pbufs[i], ERR_OK));
+  }
+}
+
+static void tombstoneClients()
+{
+  for (size_t c = 0; c < client_count; c++)
+  {
+    if (tornDown(c))
+    {
+      _tcp_clear_events(clients[c]);
+    }
+  }
+}
+
+// The same events as the old code queued them: not linked to their client
+static void fillQueueUnlinked(size_t depth)
+{
+  for (size_t i = 0; i < depth; i++)
+  {
+    pbufs[i] = pbuf();
+    pbufs[i].ref = 1;
+    lwip_event_packet_t *e = _alloc_event();
+    e->event = LWIP_TCP_RECV;
+    e->arg = clients[i % client_count];
+    e->recv.pcb = NULL;
+    e->recv.pb = &pbufs[i];
+    e->recv.err = ERR_OK;
+    e->client_prev = NULL;
+    e->client_next = NULL;
+    TEST_ASSERT_TRUE(xQueueSend(_async_queue, &e, 0) == pdPASS);
+  }
+}
+
+// _remove_events_with_arg() as the task ran it for each closing client's
+// LWIP_TCP_CLEAR event: the whole queue goes through the front and back in
+static bool rotateOutEvents(void *arg)
+{
+  lwip_event_packet_t *first_packet = NULL;
+  lwip_event_packet_t *packet = NULL;
+
+  if (!_async_queue)
+  {
+    return false;
+  }
+  // figure out which is the first packet so we can keep the order
+  while (!first_packet)
+  {
+    if (xQueueReceive(_async_queue, &first_packet, 0) != pdPASS)
+    {
+      return false;
+    }
+    // discard packet if matching
+    if (first_packet->arg == arg)
+    {
+      _free_event(first_packet);
+      first_packet = NULL;
+      // return first packet to the back of the queue
+    }
+    else if (xQueueSend(_async_queue, &first_packet, portMAX_DELAY) != pdPASS)
+    {
+      return false;
+    }
+  }
+
+  while (xQueuePeek(_async_queue, &packet, 0) == pdPASS && packet != first_packet)
+  {
+    if (xQueueReceive(_async_queue, &packet, 0) != pdPASS)
+    {
+      return false;
+    }
+    if (packet->arg == arg)
+    {
+      _free_event(packet);
+      packet = NULL;
+    }
+    else if (xQueueSend(_async_queue, &packet, portMAX_DELAY) != pdPASS)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void rotateOutClients()
+{
+  for (size_t c = 0; c < client_count; c++)
+  {
+    if (tornDown(c))
+    {
+      TEST_ASSERT_TRUE(rotateOutEvents(clients[c]));
+    }
+  }
+}
+
+// The task's side: tombstones are handled, which discards them, the
+// survivors' events are taken off their client and their pbufs noted
+static void drainQueue(std::vector<size_t> &survivors)
+{
+  lwip_event_packet_t *e;
+  while (xQueueReceive(_async_queue, &e, 0) == pdPASS)
+  {
+    if (!e->arg)
+    {
+      _handle_async_event(e);
+      continue;
+    }
+    survivors.push_back(e->recv.pb - pbufs);
+    _unlink_event(e);
+    _free_event(e);
+  }
+}
+
+static void assertSurvivors(const std::vector<size_t> &survivors, size_t depth)
+{
+  size_t expected = 0;
+  for (size_t i = 0; i < depth; i++)
+  {
+    if (!tornDown(i % client_count))
+    {
+      TEST_ASSERT_TRUE(expected < survivors.size());
+      TEST_ASSERT_EQUAL(i, survivors[expected]);
+      expected++;
+    }
+  }
+  TEST_ASSERT_EQUAL(expected, survivors.size());
+}
+
+void test_teardown_tombstones_only_its_events()
+{
+  const size_t depth = CONFIG_ASYNC_TCP_QUEUE_SIZE;
+  useQueue(depth);
+  async_tcp_event_stats_t before;
+  async_tcp_get_event_stats(&before);
+  fillQueue(depth);
+  tombstoneClients();
+  // Nothing moved in the queue, the torn down clients hold no events
+  TEST_ASSERT_EQUAL(depth, uxQueueMessagesWaiting(_async_queue));
+  for (size_t c = 0; c < client_count; c++)
+  {
+    if (tornDown(c))
+    {
+      TEST_ASSERT_TRUE(clients[c]->_events == NULL);
+    }
+  }
+  async_tcp_event_stats_t stats;
+  async_tcp_get_event_stats(&stats);
+  TEST_ASSERT_EQUAL(depth / 2, stats.tombstoned - before.tombstoned);
+
+  std::vector<size_t> survivors;
+  drainQueue(survivors);
+  assertSurvivors(survivors, depth);
+  // Tombstones gave back their packet and their pbuf, the survivors' wait for the client
+  for (size_t i = 0; i < depth; i++)
+  {
+    TEST_ASSERT_EQUAL(tornDown(i % client_count) ? 0 : 1, pbufs[i].ref);
+  }
+  for (size_t c = 0; c < client_count; c++)
+  {
+    TEST_ASSERT_TRUE(clients[c]->_events == NULL);
+  }
+  async_tcp_get_event_stats(&stats);
+  TEST_ASSERT_EQUAL(before.pool_in_use, stats.pool_in_use);
+}
+
+// The old rotation leaves the survivors in the same order
+void test_rotation_keeps_the_same_events()
+{
+  const size_t depth = CONFIG_ASYNC_TCP_QUEUE_SIZE;
+  useQueue(depth);
+  fillQueueUnlinked(depth);
+  rotateOutClients();
+  TEST_ASSERT_EQUAL(depth / 2, uxQueueMessagesWaiting(_async_queue));
+  std::vector<size_t> survivors;
+  drainQueue(survivors);
+  assertSurvivors(survivors, depth);
+}
+
+// ns per storm, the best of five batches: fill() is not timed, run() is
+template <typename Fill, typename Run>
+static double timeStorm(Fill fill, Run run, uint32_t rounds)
+{
+  double best = 0;
+  for (int batch = 0; batch < 5; batch++)
+  {
+    std::chrono::steady_clock::duration elapsed(0);
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+      fill();
+      auto start = std::chrono::steady_clock::now();
+      run();
+      elapsed += std::chrono::steady_clock::now() - start;
+    }
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+    if (batch == 0 || ns < best)
+    {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+// Not a pass/fail check. Half the clients are torn down with the queue full,
+// then the task drains it. Timed is the teardown and the drain, the
+// survivors' events are only taken off the queue. The old way also queued a
+// LWIP_TCP_CLEAR event per client, which is left out. The firmware's queue
+// depth, and one deep enough to hold a storm of 16 events per client.
+void test_teardown_benchmark()
+{
+  const size_t depths[] = {CONFIG_ASYNC_TCP_QUEUE_SIZE, sizeof(pbufs) / sizeof(pbufs[0])};
+  for (size_t depth : depths)
+  {
+    useQueue(depth);
+    std::vector<size_t> survivors;
+    survivors.reserve(depth);
+    double rotation = timeStorm([depth, &survivors]() {
+      survivors.clear();
+      fillQueueUnlinked(depth);
+    }, [&survivors]() {
+      rotateOutClients();
+      drainQueue(survivors);
+    }, 2000);
+    assertSurvivors(survivors, depth);
+    double tombstones = timeStorm([depth, &survivors]() {
+      survivors.clear();
+      fillQueue(depth);
+    }, [&survivors]() {
+      tombstoneClients();
+      drainQueue(survivors);
+    }, 2000);
+    assertSurvivors(survivors, depth);
+
+    char line[160];
+    snprintf(line, sizeof(line), "%u events, %u of %u clients torn down: queue rotation %.0f ns, tombstones %.0f ns",
+             (unsigned)depth, (unsigned)(client_count / 2), (unsigned)client_count, rotation, tombstones);
+    TEST_MESSAGE(line);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_teardown_tombstones_only_its_events);
+  RUN_TEST(test_rotation_keeps_the_same_events);
+  RUN_TEST(test_teardown_benchmark);
+  return UNITY_END();
+}
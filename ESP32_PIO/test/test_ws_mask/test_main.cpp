@@ -0,0 +1,124 @@
+#include <Arduino.h>
+#include <WebSocketMask.h>
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+// What AsyncWebSocket did before webSocketMaskPayload()
+static void maskBytes(uint8_t *data, size_t len, const uint8_t *mask, size_t offset)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    data[i] ^= mask[(offset + i) % 4];
+  }
+}
+
+static const uint8_t MASK[4] = {0x37, 0xFA, 0x21, 0x3D};
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_mask_matches_the_byte_loop()
+{
+  uint8_t expected[300 + 4];
+  uint8_t actual[300 + 4];
+  uint32_t seed = 1;
+  for (size_t len = 0; len <= 300; len += 7)
+  {
+    for (size_t align = 0; align < 4; align++)
+    {
+      for (size_t offset = 0; offset < 8; offset++)
+      {
+        for (size_t i = 0; i < len; i++)
+        {
+          seed = seed * 1103515245 + 12345;
+          expected[align + i] = actual[align + i] = seed >> 16;
+        }
+        maskBytes(expected + align, len, MASK, offset);
+        webSocketMaskPayload(actual + align, len, MASK, offset);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(expected + align, actual + align, len);
+      }
+    }
+  }
+}
+
+// Masks the same payload over and over, an even count leaves it unmasked.
+// Returns ns per payload, the best of five batches.
+template <typename Mask>
+static double timeMask(Mask mask, std::vector<uint8_t> &payload, size_t offset, uint32_t rounds)
+{
+  double best = 0;
+  for (int batch = 0; batch < 5; batch++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+      mask(payload.data() + offset, payload.size() - offset, MASK, 0);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+    if (batch == 0 || ns < best)
+    {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+// Not a pass/fail check: prints ns per payload for the sizes a frame
+// usually has, one TCP segment and a large message. Runs on the host and on
+// the ESP32, where the word loop also saves the Xtensa's byte loads.
+void test_mask_benchmark()
+{
+  static const size_t sizes[] = {64, 1460, 16384};
+  char line[128];
+  for (size_t size : sizes)
+  {
+    std::vector<uint8_t> payload(size + 1, 0x5A);
+    uint32_t rounds = 4000000 / size * 2;
+    for (size_t offset = 0; offset < 2; offset++)
+    {
+      double bytes = timeMask(maskBytes, payload, offset, rounds);
+      double words = timeMask(webSocketMaskPayload, payload, offset, rounds);
+      snprintf(line, sizeof(line), "%5u bytes%s: byte loop %9.1f ns, word loop %9.1f ns, %.1fx", (unsigned)size,
+               offset ? " unaligned" : "", bytes, words, bytes / words);
+      TEST_MESSAGE(line);
+    }
+    for (uint8_t value : payload)
+    {
+      TEST_ASSERT_EQUAL_HEX8(0x5A, value);
+    }
+  }
+}
+
+static int runTests()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_mask_matches_the_byte_loop);
+  RUN_TEST(test_mask_benchmark);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+  // Lets the test runner open the serial port after the reset
+  delay(2000);
+  runTests();
+}
+
+void loop()
+{
+}
+#else
+int main()
+{
+  return runTests();
+}
+#endif
@@ -1,5 +1,6 @@
 import { NextResponse } from 'next/server'
 import { getConfig } from '@/config'
+import { constrainZones } from '@/utils/zones'
 
 let zones = [
   { x1: 1, y1: 1, x2: 4000, y2: 4000 },
@@ -7,20 +8,34 @@ let zones = [
   { x1: -4001, y1: 4001, x2: 4001, y2: 8000 }
 ]
 
+// Last zones seen per ESP32, revalidated with If-None-Match
+const zonesCache = new Map<string, { etag: string; zones: unknown }>()
+
 export async function GET(request: Request) {
   const esp32Ip = request.headers.get('x-esp32-ip') || getConfig().esp32.defaultIp
   const config = getConfig(esp32Ip)
   const ESP32_URL_GETZONES = `${config.esp32.apiBaseUrl}${config.esp32.endpoints.zones}`
 
   try {
-    // Anfrage an den ESP32 senden
+    // Anfrage an den ESP32 senden, mit dem ETag der zuletzt geholten Zonen
+    const cached = zonesCache.get(ESP32_URL_GETZONES)
+    const headers: Record<string, string> = {
+      'Content-Type': 'application/json'
+    }
+    if (cached) {
+      headers['If-None-Match'] = cached.etag
+    }
     const response = await fetch(ESP32_URL_GETZONES, {
       method: 'GET',
-      headers: {
-        'Content-Type': 'application/json'
-      }
+      headers,
+      cache: 'no-store'
     })
 
+    // Zonen unverändert, der ESP32 schickt keinen Body
+    if (response.status === 304 && cached) {
+      return NextResponse.json(cached.zones)
+    }
+
     if (!response.ok) {
       throw new Error(`Failed to fetch zones from ESP32. Status: ${response.status}`)
     }
@@ -29,6 +44,11 @@ export async function GET(request: Request) {
     const esp32Zones = await response.json()
     console.log('Zones fetched from ESP32:', esp32Zones)
 
+    const etag = response.headers.get('etag')
+    if (etag) {
+      zonesCache.set(ESP32_URL_GETZONES, { etag, zones: esp32Zones })
+    }
+
     return NextResponse.json(esp32Zones)
 
   } catch (error) {
@@ -52,16 +72,8 @@ export async function POST(request: Request) {
   const ESP32_URL = `${config.esp32.apiBaseUrl}${config.esp32.endpoints.updateZones}`
   const newZones = await request.json()
 
-  // Ensure we only have up to 3 zones
-  zones = newZones.slice(0, config.zones.maxCount)
-
-  // Validate and constrain zone coordinates
-  zones = zones.map(zone => ({
-    x1: Math.round(Math.max(config.room.coordinates.minX, Math.min(config.room.coordinates.maxX, zone.x1))),
-    y1: Math.round(Math.max(config.room.coordinates.minY, Math.min(config.room.coordinates.maxY, zone.y1))),
-    x2: Math.round(Math.max(config.room.coordinates.minX, Math.min(config.room.coordinates.maxX, zone.x2))),
-    y2: Math.round(Math.max(config.room.coordinates.minY, Math.min(config.room.coordinates.maxY, zone.y2)))
-  }))
+  // Ensure we only have up to 3 zones with valid coordinates
+  zones = constrainZones(newZones, config)
 
   try {
     // Send updated zones to ESP32
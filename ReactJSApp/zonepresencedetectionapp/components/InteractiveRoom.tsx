@@ -10,7 +10,8 @@ import { DetectedPoints } from './DetectedPoints'
 import { useWebSocket } from '@/hooks/useWebSocket'
 import { Zone } from '@/types'
 import { mapCoordinate } from '@/utils/coordinates'
-import { getConfig } from '@/config'
+import { getConfig, deviceBuild } from '@/config'
+import { constrainZones } from '@/utils/zones'
 import { Select, SelectContent, SelectItem, SelectTrigger, SelectValue } from "@/components/ui/select"
 import { Input } from "@/components/ui/input"
 import { Trash2 } from 'lucide-react' // Add this import
@@ -26,6 +27,12 @@ export function InteractiveRoomEsp32() {
   // Handle initial mount and localStorage load
   useEffect(() => {
     setMounted(true)
+    if (deviceBuild) {
+      // Served by the ESP32, so that is the one to talk to
+      setSavedIps([window.location.host])
+      setCurrentIp(window.location.host)
+      return
+    }
     const saved = localStorage.getItem('savedIps')
     if (saved) {
       const parsedIps = JSON.parse(saved)
@@ -45,7 +52,7 @@ export function InteractiveRoomEsp32() {
 
   // Update localStorage whenever savedIps changes
   useEffect(() => {
-    if (mounted) {
+    if (mounted && !deviceBuild) {
       localStorage.setItem('savedIps', JSON.stringify(savedIps))
     }
   }, [savedIps, mounted])
@@ -56,7 +63,7 @@ export function InteractiveRoomEsp32() {
   const colors = config.zones.colors
   const [connectionStatus, setConnectionStatus] = useState<'connected' | 'disconnected'>('disconnected')
   
-  const { points} = useWebSocket(config.esp32.webSocketUrl)
+  const { points, snapshot, sendZoneEdit } = useWebSocket(config.esp32.webSocketUrl)
 
   const handleIpChange = (value: string) => {
     if (value === 'custom') {
@@ -104,19 +111,36 @@ export function InteractiveRoomEsp32() {
     return () => window.removeEventListener('resize', updateRoomSize)
   }, [])
 
+  const showZones = (data: Omit<Zone, 'id' | 'color'>[]) => {
+    setZones(data.map((zone, index) => ({
+      ...zone,
+      id: index + 1, // Assign IDs 1, 2, 3
+      color: colors[index % colors.length],
+    })))
+  }
+
+  // The WebSocket snapshot brings the zones along with the first targets and
+  // is kept up to date with changes from other dashboards; GET /zones is only
+  // needed if it does not show up. While editing, the local zones win.
   useEffect(() => {
+    if (snapshot) {
+      if (!isEditMode) {
+        showZones(snapshot.zones)
+      }
+      setConnectionStatus('connected')
+      return
+    }
+    if (isEditMode) {
+      return
+    }
+
     const fetchZones = async () => {
       try {
-        const response = await fetch('/api/zones', {
+        const response = await fetch(config.esp32.zonesUrl, {
           headers: { 'x-esp32-ip': currentIp }
         })
         if (response.ok) {
-          const data = await response.json()
-          setZones(data.map((zone: Zone, index: number) => ({
-            ...zone,
-            id: index + 1, // Assign IDs 1, 2, 3
-            color: colors[index % colors.length],
-          })))
+          showZones(await response.json())
           setConnectionStatus('connected')
         } else {
           throw new Error('Connection failed')
@@ -128,8 +152,9 @@ export function InteractiveRoomEsp32() {
       }
     }
 
-    fetchZones()
-  }, [currentIp])
+    const timer = setTimeout(fetchZones, config.esp32.snapshotTimeout)
+    return () => clearTimeout(timer)
+  }, [currentIp, snapshot, isEditMode])
 
   const createNewZone = () => {
     if (roomRef.current && zones.length < 3) {
@@ -150,12 +175,23 @@ export function InteractiveRoomEsp32() {
     sendZoneUpdate([])
   }
 
+  // Drags go to the ESP32 as they happen over the WebSocket, so occupancy
+  // follows the zone; without a socket they fall back to a POST
+  const sendZoneChange = (updatedZones: Zone[], id: number) => {
+    // The ESP32 numbers zones by their position in the list
+    const index = updatedZones.findIndex(zone => zone.id === id)
+    if (index < 0 || index >= config.zones.maxCount ||
+        !sendZoneEdit(index + 1, constrainZones([updatedZones[index]], config)[0])) {
+      sendZoneUpdate(updatedZones)
+    }
+  }
+
   const handleResize = (id: number, x1: number, y1: number, x2: number, y2: number) => {
     const updatedZones = zones.map(zone =>
       zone.id === id ? { ...zone, x1, y1, x2, y2 } : zone
     )
     setZones(updatedZones)
-    sendZoneUpdate(updatedZones)
+    sendZoneChange(updatedZones, id)
   }
 
   const handleMove = (id: number, x1: number, y1: number, x2: number, y2: number) => {
@@ -163,7 +199,7 @@ export function InteractiveRoomEsp32() {
       zone.id === id ? { ...zone, x1, y1, x2, y2 } : zone
     )
     setZones(updatedZones)
-    sendZoneUpdate(updatedZones)
+    sendZoneChange(updatedZones, id)
   }
 
   const handleDelete = (id: number) => {
@@ -174,9 +210,9 @@ export function InteractiveRoomEsp32() {
 
   const sendZoneUpdate = async (updatedZones: Zone[]) => {
     if (!isEditMode) {
-      const esp32Zones = updatedZones.map(({ id, x1, y1, x2, y2 }) => ({ id, x1, y1, x2, y2 }))
+      const esp32Zones = constrainZones(updatedZones, config)
       try {
-        const response = await fetch('/api/zones', {
+        const response = await fetch(config.esp32.updateZonesUrl, {
           method: 'POST',
           headers: {
             'Content-Type': 'application/json',
@@ -194,9 +230,9 @@ export function InteractiveRoomEsp32() {
   }
 
   const sendFinalZoneUpdate = async () => {
-    const esp32Zones = zones.map(({ id, x1, y1, x2, y2 }) => ({ id, x1, y1, x2, y2 }))
+    const esp32Zones = constrainZones(zones, config)
     try {
-      const response = await fetch('/api/zones', {
+      const response = await fetch(config.esp32.updateZonesUrl, {
         method: 'POST',
         headers: {
           'Content-Type': 'application/json',
@@ -1,5 +1,9 @@
 const DEFAULT_ESP32_IP = '192.168.178.145'
 
+// Set by `npm run build:device`: the UI is served by the ESP32 itself and
+// talks to it directly instead of going through the /api/zones proxy
+export const deviceBuild = process.env.NEXT_PUBLIC_DEVICE_BUILD === '1'
+
 export const getConfig = (ip: string = DEFAULT_ESP32_IP) => ({
   esp32: {
     ip,
@@ -9,7 +13,12 @@ export const getConfig = (ip: string = DEFAULT_ESP32_IP) => ({
     endpoints: {
       zones: '/zones',
       updateZones: '/updateZones'
-    }
+    },
+    // URLs the browser uses for the zones
+    zonesUrl: deviceBuild ? '/zones' : '/api/zones',
+    updateZonesUrl: deviceBuild ? '/updateZones' : '/api/zones',
+    // How long to wait for the WebSocket snapshot before fetching the zones
+    snapshotTimeout: 2000 // ms
   },
   room: {
     coordinates: {
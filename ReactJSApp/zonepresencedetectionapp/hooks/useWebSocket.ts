@@ -1,13 +1,51 @@
-import { useState, useEffect } from 'react'
-import { Point } from '@/types'
+import { useState, useEffect, useRef, useCallback } from 'react'
+import { Point, ZoneSnapshot } from '@/types'
 import { config } from '@/config'
 
+type ZoneCoordinates = ZoneSnapshot['zones'][number]
+
+// A zone edit waiting for its ack, by device zone id
+type ZoneEdit = { seq: number, zone: ZoneCoordinates }
+
 export const useWebSocket = (url: string) => {
   const [points, setPoints] = useState<Point[]>([])
   const [isConnected, setIsConnected] = useState(false)
+  const [snapshot, setSnapshot] = useState<ZoneSnapshot | null>(null)
+  const socket = useRef<WebSocket | null>(null)
+  // One edit per zone is in flight; newer ones wait in pending and replace
+  // each other, so a drag sends as fast as the ESP32 answers and no faster
+  const inFlight = useRef(new Map<number, ZoneEdit>())
+  const pending = useRef(new Map<number, ZoneCoordinates>())
+  const nextSeq = useRef(1)
+
+  const flushZoneEdit = useCallback((id: number) => {
+    const ws = socket.current
+    const zone = pending.current.get(id)
+    if (!ws || ws.readyState !== WebSocket.OPEN || !zone || inFlight.current.has(id)) {
+      return
+    }
+    pending.current.delete(id)
+    const seq = nextSeq.current++
+    inFlight.current.set(id, { seq, zone })
+    ws.send(JSON.stringify({ type: 'zone', id, ...zone, seq }))
+  }, [])
+
+  // Sends a zone to the ESP32 over the socket; false if it is not open, so
+  // the caller can fall back to POST /updateZones
+  const sendZoneEdit = useCallback((id: number, zone: ZoneCoordinates) => {
+    if (!socket.current || socket.current.readyState !== WebSocket.OPEN) {
+      return false
+    }
+    pending.current.set(id, zone)
+    flushZoneEdit(id)
+    return true
+  }, [flushZoneEdit])
 
   useEffect(() => {
     const ws = new WebSocket(url)
+    socket.current = ws
+    inFlight.current.clear()
+    pending.current.clear()
 
     ws.onopen = () => {
       setIsConnected(true)
@@ -15,6 +53,55 @@ export const useWebSocket = (url: string) => {
 
     ws.onmessage = (event) => {
       const data = JSON.parse(event.data)
+      // Sent once on connect with the zones and the latest targets
+      if (data.type === 'snapshot') {
+        setSnapshot({ generation: data.generation, zones: data.zones })
+        setPoints(data.targets.map((target: Point) => ({ id: target.id, x: target.x, y: target.y })))
+        return
+      }
+      // Zones changed by any client; older generations are already included
+      if (data.type === 'zones') {
+        setSnapshot((prev) => {
+          if (!prev || data.generation <= prev.generation) {
+            return prev
+          }
+          const zones = [...prev.zones]
+          for (const { id, x1, y1, x2, y2 } of data.changed) {
+            zones[id - 1] = { x1, y1, x2, y2 }
+          }
+          return { generation: data.generation, zones }
+        })
+        return
+      }
+      // Answers to zone edits; an accepted edit is part of the device's zones
+      if (data.type === 'ack' || data.type === 'nack') {
+        inFlight.current.forEach((edit, id) => {
+          if (edit.seq !== data.seq) {
+            return
+          }
+          inFlight.current.delete(id)
+          if (data.type === 'ack') {
+            // The generation stays: the broadcast of data.generation may carry
+            // other clients' zones too and must not be taken as already seen
+            setSnapshot((prev) => {
+              if (!prev || data.generation <= prev.generation) {
+                return prev
+              }
+              const zones = [...prev.zones]
+              zones[id - 1] = edit.zone
+              return { generation: prev.generation, zones }
+            })
+          } else {
+            console.error('Zone edit rejected:', data.message)
+          }
+          flushZoneEdit(id)
+        })
+        return
+      }
+      // Target positions carry no type, other messages are for other subscribers
+      if (data.type !== undefined) {
+        return
+      }
       setPoints((prevPoints) => {
         const existingPointIndex = prevPoints.findIndex((point) => point.id === data.id)
         if (existingPointIndex !== -1) {
@@ -30,8 +117,13 @@ export const useWebSocket = (url: string) => {
       setIsConnected(false)
     }
 
-    return () => ws.close()
-  }, [url])
+    setSnapshot(null)
+
+    return () => {
+      socket.current = null
+      ws.close()
+    }
+  }, [url, flushZoneEdit])
 
-  return { points, isConnected }
+  return { points, isConnected, snapshot, sendZoneEdit }
 }
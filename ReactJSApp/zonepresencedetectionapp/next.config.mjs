@@ -1,9 +1,19 @@
+// `npm run build:device` exports a static build that the ESP32 serves from
+// LittleFS. It has no server, so the /api route is left out of that build.
+const deviceBuild = process.env.NEXT_PUBLIC_DEVICE_BUILD === '1';
+
 /** @type {import('next').NextConfig} */
-const nextConfig = {
-  output: 'standalone',
-  experimental: {
-    outputFileTracingRoot: process.cwd(),
-  },
-};
+const nextConfig = deviceBuild
+  ? {
+      output: 'export',
+      pageExtensions: ['tsx'],
+      images: { unoptimized: true },
+    }
+  : {
+      output: 'standalone',
+      experimental: {
+        outputFileTracingRoot: process.cwd(),
+      },
+    };
 
 export default nextConfig;
@@ -0,0 +1,67 @@
+// Builds the UI for the ESP32: a static export, gzipped into the PlatformIO
+// data directory. Upload it with `pio run -t uploadfs` from ESP32_PIO.
+import { execSync } from 'node:child_process'
+import { gzipSync } from 'node:zlib'
+import fs from 'node:fs'
+import path from 'node:path'
+
+const outDir = 'out'
+const dataDir = path.join('..', '..', 'ESP32_PIO', 'data')
+
+// LittleFS on the ESP32 keeps full paths up to 64 bytes including the NUL
+const maxPathLength = 63
+
+// Already compressed, gzip would only add a header
+const storeAsIs = new Set(['.png', '.jpg', '.jpeg', '.gif', '.webp', '.woff', '.woff2', '.ico', '.gz'])
+
+execSync('npx next build', {
+  stdio: 'inherit',
+  env: { ...process.env, NEXT_PUBLIC_DEVICE_BUILD: '1' }
+})
+
+const files = []
+const walk = (dir) => {
+  for (const entry of fs.readdirSync(dir, { withFileTypes: true })) {
+    const file = path.join(dir, entry.name)
+    if (entry.isDirectory()) {
+      walk(file)
+    } else {
+      files.push(file)
+    }
+  }
+}
+walk(outDir)
+
+fs.rmSync(dataDir, { recursive: true, force: true })
+
+let total = 0
+const tooLong = []
+for (const file of files) {
+  const relative = path.relative(outDir, file).split(path.sep).join('/')
+  // Client side navigation payloads, unused by the single page
+  if (relative.endsWith('.txt')) {
+    continue
+  }
+
+  let content = fs.readFileSync(file)
+  let target = relative
+  if (!storeAsIs.has(path.extname(relative))) {
+    content = gzipSync(content, { level: 9 })
+    target += '.gz'
+  }
+  if (target.length + 1 > maxPathLength) {
+    tooLong.push(target)
+  }
+
+  const destination = path.join(dataDir, target)
+  fs.mkdirSync(path.dirname(destination), { recursive: true })
+  fs.writeFileSync(destination, content)
+  total += content.length
+}
+
+console.log(`Wrote ${total} bytes to ${dataDir}`)
+if (tooLong.length > 0) {
+  console.error('These paths are too long for LittleFS:')
+  tooLong.forEach(file => console.error(`  /${file}`))
+  process.exit(1)
+}
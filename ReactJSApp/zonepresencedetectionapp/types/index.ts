@@ -12,3 +12,9 @@ export interface Point {
   x: number
   y: number
 }
+
+// Zones as the ESP32 sends them, without id and color
+export interface ZoneSnapshot {
+  generation: number
+  zones: { x1: number; y1: number; x2: number; y2: number }[]
+}
@@ -0,0 +1,18 @@
+import { getConfig } from '@/config'
+
+type ZoneCoordinates = { x1: number, y1: number, x2: number, y2: number }
+
+// Limits the zones to what the ESP32 accepts: at most maxCount zones with
+// whole millimetre coordinates inside the room
+export const constrainZones = (zones: ZoneCoordinates[], config = getConfig()) => {
+  const { minX, maxX, minY, maxY } = config.room.coordinates
+  const clampX = (value: number) => Math.round(Math.max(minX, Math.min(maxX, value)))
+  const clampY = (value: number) => Math.round(Math.max(minY, Math.min(maxY, value)))
+
+  return zones.slice(0, config.zones.maxCount).map(zone => ({
+    x1: clampX(zone.x1),
+    y1: clampY(zone.y1),
+    x2: clampX(zone.x2),
+    y2: clampY(zone.y2)
+  }))
+}